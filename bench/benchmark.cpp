@@ -0,0 +1,298 @@
+// Stage microbenchmarks and end-to-end decoding of a synthetic corpus. Prints one JSON object per
+// line with throughput in MB/s of input and megapixels/s of output.
+//
+//   benchmark [--filter SUBSTRING] [--max-side PIXELS] [--min-time SECONDS]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+#include "../decoder.h"
+#include "../decoder/bit_reader.h"
+#include "../decoder/color_converter.h"
+#include "../decoder/huffman_tree.h"
+#include "../decoder/idct.h"
+#include "../decoder/zigzag_writer.h"
+#include "synthetic_jpeg.h"
+
+namespace {
+
+struct Settings {
+    std::string filter;
+    int max_side = 16384;
+    double min_time = 0.5;
+};
+
+Settings settings;
+
+// One block as the decoder stores it: 64 row-major int16 values on a cache line boundary.
+struct Coefficients {
+    alignas(64) int16_t values_[64];
+};
+
+template <class T>
+void KeepAlive(const T& value) {
+    asm volatile("" : : "g"(&value) : "memory");
+}
+
+// Runs `body` until `min_time` has passed and reports the rate of `bytes` and `pixels` per call.
+template <class Body>
+void Run(const std::string& name, double bytes, double pixels, Body&& body) {
+    if (name.find(settings.filter) == std::string::npos) {
+        return;
+    }
+    using Clock = std::chrono::steady_clock;
+    body();
+    int64_t iterations = 0;
+    double seconds = 0;
+    auto start = Clock::now();
+    for (int64_t batch = 1; seconds < settings.min_time; batch *= 2) {
+        for (int64_t i = 0; i < batch; i++) {
+            body();
+        }
+        iterations += batch;
+        seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    }
+    double calls = iterations / seconds;
+    std::printf(
+        "{\"name\": \"%s\", \"iterations\": %lld, \"seconds\": %.6f, \"bytes\": %.0f, "
+        "\"pixels\": %.0f, \"mb_per_s\": %.3f, \"mp_per_s\": %.3f}\n",
+        name.c_str(), static_cast<long long>(iterations), seconds, bytes, pixels,
+        bytes * calls / 1e6, pixels * calls / 1e6);
+    std::fflush(stdout);
+}
+
+// Entropy-coded data with stuffed 0xFF bytes, read in variable-width chunks as Huffman decoding
+// does.
+void BenchBitReader() {
+    std::mt19937 rng(1);
+    std::vector<uint8_t> data;
+    int64_t bits = 0;
+    for (; bits < int64_t{8} << 20; bits += 8) {
+        uint8_t byte = rng();
+        data.push_back(byte);
+        if (byte == 0xff) {
+            data.push_back(0);
+        }
+    }
+    // Stay clear of the end, where the reader pads with zeros.
+    bits -= 64;
+    Run("bit_reader/peek_skip", data.size(), 0, [&] {
+        BitReader reader(data, 0);
+        int sum = 0;
+        for (int64_t read = 0, width = 1; read < bits; read += width, width = width % 16 + 1) {
+            sum += reader.Peek(width);
+            reader.Skip(width);
+        }
+        KeepAlive(sum);
+    });
+}
+
+// AC symbols with a realistic mix of short runs, long runs and EOBs.
+void BenchHuffman() {
+    std::mt19937 rng(2);
+    const HuffmanSpec& spec = StandardHuffmanSpec(1, 0);
+    std::vector<uint8_t> symbols(1 << 20);
+    for (auto& symbol : symbols) {
+        int kind = rng() % 16;
+        symbol = kind == 0 ? 0x00 : kind == 1 ? 0xf0 : (rng() % 4) * 16 + 1 + rng() % 4;
+    }
+    auto data = EncodeSymbols(spec, symbols);
+    HuffmanTree tree;
+    size_t index = 0;
+    for (int len = 1; len <= 16; len++) {
+        for (int i = 0; i < spec.counts[len - 1]; i++) {
+            tree.Add(len, spec.symbols[index++]);
+        }
+    }
+    Run("huffman/read_coefficient", data.size(), 0, [&] {
+        BitReader reader(data, 0);
+        int sum = 0;
+        for (size_t i = 0; i < symbols.size(); i++) {
+            auto [symbol, value] = tree.ReadCoefficient(reader);
+            sum += symbol + value;
+        }
+        KeepAlive(sum);
+    });
+}
+
+void BenchZigZag() {
+    constexpr int kBlocks = 4096;
+    std::vector<int> values(kBlocks * 64);
+    std::mt19937 rng(3);
+    for (auto& value : values) {
+        value = static_cast<int>(rng() % 64) - 32;
+    }
+    struct Matrix {
+        int values_[8][8];
+    };
+    std::vector<Matrix> blocks(kBlocks);
+    Run("zigzag/write", values.size() * sizeof(int), kBlocks * 64.0, [&] {
+        for (int b = 0; b < kBlocks; b++) {
+            ZigZagWriter writer(blocks[b].values_);
+            for (int k = 0; k < 64; k++) {
+                writer.Write(values[b * 64 + k]);
+            }
+        }
+        KeepAlive(blocks);
+    });
+}
+
+// Dequantization and IDCT of blocks that, like real ones, have most energy in the first few
+// zigzag positions. Full-size blocks are timed per method for each path the entropy decoder's
+// end-of-block position selects: all 64 coefficients, only the first ten (the first four
+// anti-diagonals, which lie in the top-left quarter) and DC alone. The reduced sizes share one
+// implementation across methods and are timed once.
+void BenchIdct() {
+    constexpr int kBlocks = 4096;
+    constexpr int kQuarterLast = 9;
+    std::vector<Coefficients> blocks(kBlocks), quarters(kBlocks);
+    std::mt19937 rng(4);
+    for (int b = 0; b < kBlocks; b++) {
+        for (int i = 0; i < 8; i++) {
+            for (int j = 0; j < 8; j++) {
+                int range = i + j < 3 ? 64 : i + j < 6 ? 8 : 1;
+                int value = static_cast<int>(rng() % (2 * range + 1)) - range;
+                blocks[b].values_[i * 8 + j] = value;
+                quarters[b].values_[i * 8 + j] = i + j <= 3 ? value : 0;
+            }
+        }
+    }
+    int quant[8][8];
+    for (int i = 0; i < 8; i++) {
+        for (int j = 0; j < 8; j++) {
+            quant[i][j] = 2 + i + j;
+        }
+    }
+    auto bench = [&](const std::string& name, const Idct& idct, const IdctTable& table,
+                     const std::vector<Coefficients>& input, int size, int last) {
+        std::vector<uint8_t> out(kBlocks * size * size);
+        Run(name, kBlocks * sizeof(Coefficients), kBlocks * size * size, [&] {
+            for (int b = 0; b < kBlocks; b++) {
+                idct.Transform(input[b].values_, table, &out[b * size * size], size, size, last);
+            }
+            KeepAlive(out);
+        });
+    };
+    const std::pair<IdctMethod, const char*> methods[] = {
+        {IdctMethod::IntegerSlow, "integer"}, {IdctMethod::FloatAan, "float"},
+        {IdctMethod::Simd, "simd"}};
+    for (auto [method, method_name] : methods) {
+        Idct idct(method);
+        if (idct.Method() != method) {
+            continue;
+        }
+        IdctTable table;
+        idct.BuildTable(quant, &table);
+        std::string prefix = std::string("idct/") + method_name;
+        bench(prefix + "/full", idct, table, blocks, 8, 63);
+        bench(prefix + "/quarter", idct, table, quarters, 8, kQuarterLast);
+        bench(prefix + "/dc", idct, table, blocks, 8, 0);
+    }
+    Idct idct;
+    IdctTable table;
+    idct.BuildTable(quant, &table);
+    for (int size : {4, 2, 1}) {
+        bench("idct/reduced/" + std::to_string(size), idct, table, blocks, size, 63);
+    }
+}
+
+// The per-row work of the color stage: chroma upsampling and YCbCr to RGB conversion.
+void BenchColor() {
+    constexpr int kWidth = 4096;
+    std::vector<uint8_t> y(kWidth), cb(kWidth), cr(kWidth), half(kWidth / 2), far(kWidth / 2);
+    std::mt19937 rng(5);
+    for (int x = 0; x < kWidth; x++) {
+        y[x] = rng();
+        cb[x] = 96 + rng() % 64;
+        cr[x] = 96 + rng() % 64;
+    }
+    for (int x = 0; x < kWidth / 2; x++) {
+        half[x] = cb[2 * x];
+        far[x] = cr[2 * x];
+    }
+    const std::pair<PixelFormat, const char*> formats[] = {{PixelFormat::RGB24, "rgb24"},
+                                                           {PixelFormat::RGBA32, "rgba32"},
+                                                           {PixelFormat::BGR24, "bgr24"}};
+    for (auto [format, format_name] : formats) {
+        ColorConverter converter(format);
+        std::vector<uint8_t> out(kWidth * BytesPerPixel(format));
+        Run(std::string("color/convert/") + format_name, kWidth * 3, kWidth, [&] {
+            converter.ConvertRow(y.data(), cb.data(), cr.data(), out.data(), kWidth);
+            KeepAlive(out);
+        });
+    }
+    for (bool fancy : {false, true}) {
+        std::string name = std::string("color/upsample_h2/") + (fancy ? "fancy" : "plain");
+        Run(name, kWidth / 2, kWidth, [&] {
+            UpsampleRow(half.data(), fancy ? far.data() : nullptr, kWidth / 2, 2, fancy,
+                        cb.data());
+            KeepAlive(cb);
+        });
+    }
+}
+
+void BenchDecode() {
+    const std::pair<Subsampling, const char*> subsamplings[] = {{Subsampling::Gray, "gray"},
+                                                                {Subsampling::S444, "444"},
+                                                                {Subsampling::S422, "422"},
+                                                                {Subsampling::S420, "420"},
+                                                                {Subsampling::S440, "440"},
+                                                                {Subsampling::S411, "411"}};
+    for (int side : {64, 256, 1024, 4096, 16384}) {
+        if (side > settings.max_side) {
+            continue;
+        }
+        for (auto [subsampling, subsampling_name] : subsamplings) {
+            for (int quality : {50, 75, 95}) {
+                std::string name = "decode/" + std::string(subsampling_name) + "/q" +
+                                   std::to_string(quality) + "/" + std::to_string(side) + "x" +
+                                   std::to_string(side);
+                bool color = subsampling != Subsampling::Gray;
+                // Color images are also decoded to luma only, which skips chroma reconstruction.
+                if (name.find(settings.filter) == std::string::npos &&
+                    (!color || (name + "/luma").find(settings.filter) == std::string::npos)) {
+                    continue;
+                }
+                auto data = MakeSyntheticJpeg({side, side, subsampling, quality});
+                DecodeOptions options;
+                options.format = color ? PixelFormat::RGB24 : PixelFormat::Gray8;
+                Image image;
+                Run(name, data.size(), static_cast<double>(side) * side,
+                    [&] { Decode(data, image, options); });
+                if (color) {
+                    options.format = PixelFormat::Gray8;
+                    Run(name + "/luma", data.size(), static_cast<double>(side) * side,
+                        [&] { Decode(data, image, options); });
+                }
+            }
+        }
+    }
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (!std::strcmp(argv[i], "--filter")) {
+            settings.filter = argv[i + 1];
+        } else if (!std::strcmp(argv[i], "--max-side")) {
+            settings.max_side = std::atoi(argv[i + 1]);
+        } else if (!std::strcmp(argv[i], "--min-time")) {
+            settings.min_time = std::atof(argv[i + 1]);
+        } else {
+            std::fprintf(stderr, "Unknown option %s\n", argv[i]);
+            return 1;
+        }
+    }
+    BenchBitReader();
+    BenchHuffman();
+    BenchZigZag();
+    BenchIdct();
+    BenchColor();
+    BenchDecode();
+    return 0;
+}
@@ -0,0 +1,374 @@
+#include <algorithm>
+#include <cmath>
+#include <numbers>
+#include <stdexcept>
+#include "synthetic_jpeg.h"
+
+namespace {
+
+constexpr int kZigZag[64] = {0,  1,  8,  16, 9,  2,  3,  10, 17, 24, 32, 25, 18, 11, 4,  5,
+                             12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13, 6,  7,  14, 21, 28,
+                             35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+                             58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63};
+
+constexpr int kLumaQuant[64] = {16, 11, 10, 16, 24,  40,  51,  61,  12, 12, 14, 19, 26,
+                                58, 60, 55, 14, 13,  16,  24,  40,  57, 69, 56, 14, 17,
+                                22, 29, 51, 87, 80,  62,  18,  22,  37, 56, 68, 109, 103,
+                                77, 24, 35, 55, 64,  81,  104, 113, 92, 49, 64, 78,  87,
+                                103, 121, 120, 101, 72, 92, 95, 98, 112, 100, 103, 99};
+
+constexpr int kChromaQuant[64] = {17, 18, 24, 47, 99, 99, 99, 99, 18, 21, 26, 66, 99, 99, 99, 99,
+                                  24, 26, 56, 99, 99, 99, 99, 99, 47, 66, 99, 99, 99, 99, 99, 99,
+                                  99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99,
+                                  99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99};
+
+std::vector<uint8_t> AcSymbols(std::initializer_list<uint8_t> head) {
+    // Both standard AC tables end with every run/size pair with a size of 1 to 10 not listed earlier,
+    // in increasing order.
+    std::vector<uint8_t> symbols(head);
+    for (int symbol = 0; symbol < 256; symbol++) {
+        int size = symbol % 16;
+        if (size >= 1 && size <= 10 &&
+            std::find(symbols.begin(), symbols.end(), symbol) == symbols.end()) {
+            symbols.push_back(symbol);
+        }
+    }
+    return symbols;
+}
+
+const HuffmanSpec kDcLuma = {{0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0},
+                             {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11}};
+const HuffmanSpec kDcChroma = {{0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0},
+                               {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11}};
+const HuffmanSpec kAcLuma = {
+    {0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7d},
+    AcSymbols({0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06, 0x13,
+               0x51, 0x61, 0x07, 0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xa1, 0x08, 0x23, 0x42,
+               0xb1, 0xc1, 0x15, 0x52, 0xd1, 0xf0, 0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0a,
+               0x16, 0x17, 0x18, 0x19, 0x1a, 0x25, 0x26, 0x27, 0x28, 0x29, 0x2a, 0x34, 0x35,
+               0x36, 0x37, 0x38, 0x39, 0x3a})};
+const HuffmanSpec kAcChroma = {
+    {0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77},
+    AcSymbols({0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06, 0x12, 0x41, 0x51,
+               0x07, 0x61, 0x71, 0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91, 0xa1, 0xb1,
+               0xc1, 0x09, 0x23, 0x33, 0x52, 0xf0, 0x15, 0x62, 0x72, 0xd1, 0x0a, 0x16, 0x24,
+               0x34, 0xe1, 0x25, 0xf1, 0x17, 0x18, 0x19, 0x1a, 0x26, 0x27, 0x28, 0x29, 0x2a,
+               0x35, 0x36, 0x37, 0x38, 0x39, 0x3a})};
+
+struct HuffmanCodes {
+    explicit HuffmanCodes(const HuffmanSpec& spec) {
+        int code = 0;
+        size_t index = 0;
+        for (int len = 1; len <= 16; len++) {
+            for (int i = 0; i < spec.counts[len - 1]; i++) {
+                uint8_t symbol = spec.symbols.at(index++);
+                codes_[symbol] = code++;
+                lengths_[symbol] = len;
+            }
+            code <<= 1;
+        }
+    }
+
+    uint16_t codes_[256] = {};
+    uint8_t lengths_[256] = {};
+};
+
+class BitWriter {
+public:
+    explicit BitWriter(std::vector<uint8_t>& out) : out_(out) {
+    }
+
+    void Write(uint32_t bits, int count) {
+        buffer_ = (buffer_ << count) | (bits & ((1u << count) - 1));
+        count_ += count;
+        while (count_ >= 8) {
+            count_ -= 8;
+            uint8_t byte = buffer_ >> count_;
+            out_.push_back(byte);
+            if (byte == 0xff) {
+                out_.push_back(0);
+            }
+        }
+    }
+
+    void Write(const HuffmanCodes& codes, int symbol) {
+        Write(codes.codes_[symbol], codes.lengths_[symbol]);
+    }
+
+    // Pads the last byte with ones.
+    void Flush() {
+        if (count_ > 0) {
+            Write(0x7f, 8 - count_);
+        }
+    }
+
+private:
+    std::vector<uint8_t>& out_;
+    uint64_t buffer_ = 0;
+    int count_ = 0;
+};
+
+int Category(int value) {
+    int magnitude = std::abs(value), size = 0;
+    while (magnitude) {
+        magnitude >>= 1;
+        size++;
+    }
+    return size;
+}
+
+void WriteValue(BitWriter& writer, int value, int size) {
+    writer.Write(value < 0 ? value - 1 : value, size);
+}
+
+uint32_t Hash(uint32_t x, uint32_t y) {
+    uint32_t h = x * 0x9e3779b1u ^ y * 0x85ebca77u;
+    h ^= h >> 15;
+    h *= 0x2c1b3c6du;
+    return h ^ (h >> 12);
+}
+
+// Smooth gradients with flat patches that produce sharp edges, a fine texture and noise.
+int SampleLuma(int x, int y, int width, int height) {
+    int value = 16 + x * 160 / width + y * 64 / height;
+    if ((x / 37 + y / 53) % 5 == 0) {
+        value += 48;
+    }
+    value += ((x * 7) ^ (y * 13)) & 15;
+    value += static_cast<int>(Hash(x, y) % 9) - 4;
+    return std::clamp(value, 0, 255);
+}
+
+int SampleChroma(int component, int x, int y, int width, int height) {
+    int value = component == 1 ? 88 + x * 80 / width : 168 - y * 80 / height;
+    value += ((x / 29 + y / 31) % 3 - 1) * 12;
+    return std::clamp(value, 0, 255);
+}
+
+class Encoder {
+public:
+    Encoder(const SyntheticJpegOptions& options, std::vector<uint8_t>& out)
+        : options_(options), out_(out), writer_(out) {
+        for (int u = 0; u < 8; u++) {
+            double scale = u == 0 ? std::sqrt(0.125) : 0.5;
+            for (int x = 0; x < 8; x++) {
+                cos_[u][x] = scale * std::cos((2 * x + 1) * u * std::numbers::pi / 16);
+            }
+        }
+        int quality = std::clamp(options.quality, 1, 100);
+        int scale = quality < 50 ? 5000 / quality : 200 - quality * 2;
+        for (int k = 0; k < 64; k++) {
+            quant_[0][k] = std::clamp((kLumaQuant[k] * scale + 50) / 100, 1, 255);
+            quant_[1][k] = std::clamp((kChromaQuant[k] * scale + 50) / 100, 1, 255);
+        }
+    }
+
+    void WriteHeaders(int components, int h, int v) {
+        WriteMarker(0xd8);
+        WriteSegment(0xe0, {'J', 'F', 'I', 'F', 0, 1, 1, 0, 0, 1, 0, 1, 0, 0});
+        std::vector<uint8_t> dqt;
+        for (int id = 0; id < (components == 1 ? 1 : 2); id++) {
+            dqt.push_back(id);
+            for (int k = 0; k < 64; k++) {
+                dqt.push_back(quant_[id][kZigZag[k]]);
+            }
+        }
+        WriteSegment(0xdb, dqt);
+        std::vector<uint8_t> sof = {8,
+                                    static_cast<uint8_t>(options_.height >> 8),
+                                    static_cast<uint8_t>(options_.height),
+                                    static_cast<uint8_t>(options_.width >> 8),
+                                    static_cast<uint8_t>(options_.width),
+                                    static_cast<uint8_t>(components)};
+        for (int c = 0; c < components; c++) {
+            sof.push_back(c + 1);
+            sof.push_back(c == 0 ? h * 16 + v : 0x11);
+            sof.push_back(c == 0 ? 0 : 1);
+        }
+        WriteSegment(0xc0, sof);
+        for (int id = 0; id < (components == 1 ? 1 : 2); id++) {
+            for (int table_class = 0; table_class < 2; table_class++) {
+                const HuffmanSpec& spec = StandardHuffmanSpec(table_class, id);
+                std::vector<uint8_t> dht = {static_cast<uint8_t>(table_class * 16 + id)};
+                dht.insert(dht.end(), spec.counts.begin(), spec.counts.end());
+                dht.insert(dht.end(), spec.symbols.begin(), spec.symbols.end());
+                WriteSegment(0xc4, dht);
+            }
+        }
+        if (options_.restart_interval > 0) {
+            WriteSegment(0xdd, {static_cast<uint8_t>(options_.restart_interval >> 8),
+                                static_cast<uint8_t>(options_.restart_interval)});
+        }
+        std::vector<uint8_t> sos = {static_cast<uint8_t>(components)};
+        for (int c = 0; c < components; c++) {
+            sos.push_back(c + 1);
+            sos.push_back(c == 0 ? 0x00 : 0x11);
+        }
+        sos.insert(sos.end(), {0, 63, 0});
+        WriteSegment(0xda, sos);
+    }
+
+    void WriteScan(int components, int h, int v) {
+        HuffmanCodes dc[2] = {HuffmanCodes(kDcLuma), HuffmanCodes(kDcChroma)};
+        HuffmanCodes ac[2] = {HuffmanCodes(kAcLuma), HuffmanCodes(kAcChroma)};
+        int mcus_x = (options_.width + 8 * h - 1) / (8 * h);
+        int mcus_y = (options_.height + 8 * v - 1) / (8 * v);
+        int last_dc[3] = {};
+        int mcu = 0, restarts = 0;
+        for (int my = 0; my < mcus_y; my++) {
+            for (int mx = 0; mx < mcus_x; mx++, mcu++) {
+                if (options_.restart_interval > 0 && mcu > 0 &&
+                    mcu % options_.restart_interval == 0) {
+                    writer_.Flush();
+                    WriteMarker(0xd0 + restarts++ % 8);
+                    std::fill(last_dc, last_dc + 3, 0);
+                }
+                for (int by = 0; by < v; by++) {
+                    for (int bx = 0; bx < h; bx++) {
+                        int x0 = (mx * h + bx) * 8, y0 = (my * v + by) * 8;
+                        WriteBlock(0, x0, y0, 1, 1, dc[0], ac[0], last_dc[0]);
+                    }
+                }
+                for (int c = 1; c < components; c++) {
+                    WriteBlock(c, mx * 8, my * 8, h, v, dc[1], ac[1], last_dc[c]);
+                }
+            }
+        }
+        writer_.Flush();
+        WriteMarker(0xd9);
+    }
+
+private:
+    void WriteMarker(int marker) {
+        out_.push_back(0xff);
+        out_.push_back(marker);
+    }
+
+    void WriteSegment(int marker, const std::vector<uint8_t>& payload) {
+        WriteMarker(marker);
+        out_.push_back((payload.size() + 2) >> 8);
+        out_.push_back(payload.size() + 2);
+        out_.insert(out_.end(), payload.begin(), payload.end());
+    }
+
+    // Codes the block whose top-left sample is (x0, y0) in a plane subsampled by h x v.
+    void WriteBlock(int component, int x0, int y0, int h, int v, const HuffmanCodes& dc,
+                    const HuffmanCodes& ac, int& last_dc) {
+        double samples[8][8], rows[8][8];
+        for (int y = 0; y < 8; y++) {
+            int py = std::min((y0 + y) * v, options_.height - 1);
+            for (int x = 0; x < 8; x++) {
+                int px = std::min((x0 + x) * h, options_.width - 1);
+                int value = component == 0
+                                ? SampleLuma(px, py, options_.width, options_.height)
+                                : SampleChroma(component, px, py, options_.width,
+                                               options_.height);
+                samples[y][x] = value - 128;
+            }
+        }
+        for (int y = 0; y < 8; y++) {
+            for (int u = 0; u < 8; u++) {
+                double sum = 0;
+                for (int x = 0; x < 8; x++) {
+                    sum += cos_[u][x] * samples[y][x];
+                }
+                rows[y][u] = sum;
+            }
+        }
+        int coef[64];
+        const int* quant = quant_[component == 0 ? 0 : 1];
+        for (int v_freq = 0; v_freq < 8; v_freq++) {
+            for (int u = 0; u < 8; u++) {
+                double sum = 0;
+                for (int y = 0; y < 8; y++) {
+                    sum += cos_[v_freq][y] * rows[y][u];
+                }
+                int k = v_freq * 8 + u;
+                coef[k] = static_cast<int>(std::lround(sum / quant[k]));
+            }
+        }
+        int diff = coef[0] - last_dc;
+        last_dc = coef[0];
+        int size = Category(diff);
+        writer_.Write(dc, size);
+        WriteValue(writer_, diff, size);
+        int run = 0;
+        for (int k = 1; k < 64; k++) {
+            int value = coef[kZigZag[k]];
+            if (value == 0) {
+                run++;
+                continue;
+            }
+            for (; run > 15; run -= 16) {
+                writer_.Write(ac, 0xf0);
+            }
+            size = Category(value);
+            writer_.Write(ac, run * 16 + size);
+            WriteValue(writer_, value, size);
+            run = 0;
+        }
+        if (run > 0) {
+            writer_.Write(ac, 0x00);
+        }
+    }
+
+    const SyntheticJpegOptions& options_;
+    std::vector<uint8_t>& out_;
+    BitWriter writer_;
+    double cos_[8][8];
+    int quant_[2][64];
+};
+
+}  // namespace
+
+const HuffmanSpec& StandardHuffmanSpec(int table_class, int id) {
+    if (table_class == 0) {
+        return id == 0 ? kDcLuma : kDcChroma;
+    }
+    return id == 0 ? kAcLuma : kAcChroma;
+}
+
+std::vector<uint8_t> MakeSyntheticJpeg(const SyntheticJpegOptions& options) {
+    if (options.width < 1 || options.height < 1 || options.width > 65535 ||
+        options.height > 65535) {
+        throw std::invalid_argument("Invalid synthetic image size");
+    }
+    int components = options.subsampling == Subsampling::Gray ? 1 : 3;
+    int h = 1, v = 1;
+    switch (options.subsampling) {
+        case Subsampling::S422:
+            h = 2;
+            break;
+        case Subsampling::S420:
+            h = v = 2;
+            break;
+        case Subsampling::S440:
+            v = 2;
+            break;
+        case Subsampling::S411:
+            h = 4;
+            break;
+        default:
+            break;
+    }
+    std::vector<uint8_t> out;
+    out.reserve(static_cast<size_t>(options.width) * options.height / 4 + 1024);
+    Encoder encoder(options, out);
+    encoder.WriteHeaders(components, h, v);
+    encoder.WriteScan(components, h, v);
+    return out;
+}
+
+std::vector<uint8_t> EncodeSymbols(const HuffmanSpec& spec, std::span<const uint8_t> symbols) {
+    HuffmanCodes codes(spec);
+    std::vector<uint8_t> out;
+    BitWriter writer(out);
+    uint32_t state = 1;
+    for (uint8_t symbol : symbols) {
+        writer.Write(codes, symbol);
+        state = state * 1664525u + 1013904223u;
+        writer.Write(state >> 16, symbol % 16);
+    }
+    writer.Flush();
+    return out;
+}
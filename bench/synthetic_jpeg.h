@@ -0,0 +1,37 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+enum class Subsampling { Gray, S444, S422, S420, S440, S411 };
+
+struct SyntheticJpegOptions {
+    int width = 256;
+    int height = 256;
+    Subsampling subsampling = Subsampling::S420;
+    // IJG quality, 1 to 100.
+    int quality = 75;
+    // MCUs per restart interval; 0 writes no DRI.
+    int restart_interval = 0;
+};
+
+// Encodes a deterministic procedural image (gradients, edges and noise) as a baseline JPEG with
+// the standard Huffman tables. Pixels are generated on the fly, so very large images only cost
+// the size of the compressed output.
+std::vector<uint8_t> MakeSyntheticJpeg(const SyntheticJpegOptions& options);
+
+// Huffman table in DHT form: code counts per length and symbols in code order.
+struct HuffmanSpec {
+    std::array<uint8_t, 16> counts;
+    std::vector<uint8_t> symbols;
+};
+
+// Standard tables from Annex K of the JPEG specification; `table_class` is 0 for DC and 1 for
+// AC, `id` is 0 for luma and 1 for chroma.
+const HuffmanSpec& StandardHuffmanSpec(int table_class, int id);
+
+// Entropy-codes `symbols` with `spec`, following each one with symbol % 16 pseudo-random extra
+// bits as coefficients are, and stuffs a zero after every 0xFF byte.
+std::vector<uint8_t> EncodeSymbols(const HuffmanSpec& spec, std::span<const uint8_t> symbols);
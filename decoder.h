@@ -2,6 +2,293 @@
 
 #include "image.h"
 
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <exception>
 #include <filesystem>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <span>
+#include <vector>
 
-Image Decode(const std::filesystem::path& path);
+enum class IdctMethod { Auto, IntegerSlow, FloatAan, Simd };
+
+// Worker threads for decoding, declared in decoder/thread_pool.h.
+class ThreadPool;
+
+struct Rect {
+    size_t x = 0;
+    size_t y = 0;
+    size_t width = 0;
+    size_t height = 0;
+};
+
+// Per-stage counters and timings. They are only collected when the library is built with
+// JPEG_DECODER_STATS=1; otherwise the collection code is compiled out and this stays untouched.
+// Values accumulate over every decode given the same object.
+struct DecodeStats {
+    // Bytes of each marker segment, marker included, indexed by the marker's second byte. The
+    // entropy-coded data after SOS, restart markers included, is counted separately.
+    std::array<uint64_t, 256> marker_bytes{};
+    uint64_t entropy_bytes = 0;
+    uint64_t mcus = 0;
+    uint64_t blocks = 0;
+    uint64_t huffman_symbols = 0;
+    // AC symbols that skip zeros (ZRL included), and end-of-block symbols (EOBRUN included).
+    uint64_t zero_runs = 0;
+    uint64_t eobs = 0;
+    std::chrono::nanoseconds marker_time{};
+    // Laying out a scan and allocating its coefficient arena, sample planes and row buffers.
+    std::chrono::nanoseconds setup_time{};
+    std::chrono::nanoseconds entropy_time{};
+    std::chrono::nanoseconds idct_time{};
+    // Upsampling and color conversion.
+    std::chrono::nanoseconds color_time{};
+    // Largest coefficient buffers and intermediate sample planes of a single decode.
+    size_t peak_coefficient_bytes = 0;
+    size_t peak_sample_bytes = 0;
+};
+
+// Upper bounds for one decode, against files that declare huge images or carry endless data.
+// A zero bound is not checked.
+struct DecodeLimits {
+    // Width times height of the frame, checked as soon as the frame header is read.
+    uint64_t max_pixels = 0;
+    // Peak memory as EstimateDecodeMemory reports it, checked before anything large is allocated.
+    size_t max_memory = 0;
+    // Marker segments and their total size, markers included.
+    size_t max_markers = 0;
+    size_t max_segment_bytes = 0;
+    // Entropy-coded data over all scans, checked after every MCU row.
+    size_t max_scan_bytes = 0;
+    // Checked after every MCU row; the default never passes.
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max();
+};
+
+enum class DecodeLimit { Pixels, Memory, Markers, SegmentBytes, ScanBytes, Deadline };
+
+// Thrown when a decode runs into one of its DecodeLimits.
+class LimitExceeded : public std::runtime_error {
+public:
+    explicit LimitExceeded(DecodeLimit limit);
+
+    DecodeLimit Limit() const {
+        return limit_;
+    }
+
+private:
+    DecodeLimit limit_;
+};
+
+struct DecodeOptions {
+    PixelFormat format = PixelFormat::RGB24;
+    IdctMethod idct_method = IdctMethod::Auto;
+    // Interpolates subsampled chroma with a triangle filter instead of replicating samples.
+    bool fancy_upsampling = false;
+    // Threads for decoding a whole image: restart intervals are entropy-decoded in parallel, and
+    // without them rows are reconstructed on other threads while the scan is decoded; once all
+    // coefficients are decoded, bands of rows are reconstructed on every thread. 0 uses one per
+    // core. The threads come from `pool`, so no more than its size take part.
+    int threads = 0;
+    // Pool that multithreaded decodes run on, which may be shared by any number of concurrent
+    // decodes; null uses a process-wide pool with a thread per core.
+    ThreadPool* pool = nullptr;
+    // Output is 1/scale of the full size (1, 2, 4 or 8), using reduced-size IDCTs.
+    int scale = 1;
+    // Decodes only this rectangle of the scaled image; the output has the rectangle's size.
+    std::optional<Rect> region;
+    // Decodes only the DC scans of a progressive image and steps over the others, giving one flat
+    // color per block. Baseline images are decoded in full.
+    bool dc_only = false;
+    // Turns whole decoded images upright as their EXIF orientation says, while writing the rows
+    // out. The region still refers to the image as stored, and scanline interfaces hand out
+    // rows as stored.
+    bool apply_orientation = false;
+    DecodeLimits limits;
+    // Receives counters when statistics are compiled in; ignored by BatchDecoder.
+    DecodeStats* stats = nullptr;
+};
+
+// Position of a marker segment's payload within the JPEG data.
+struct SegmentLocation {
+    int marker;
+    size_t offset;
+    size_t size;
+};
+
+struct ComponentInfo {
+    int id;
+    int horizontal;
+    int vertical;
+    int quant_table;
+};
+
+// Frame header fields and metadata found before the first scan.
+struct JpegInfo {
+    int width = 0;
+    int height = 0;
+    int precision = 0;
+    // Set for SOF2 frames.
+    bool progressive = false;
+    // Sampling factors as stored in the frame header.
+    std::vector<ComponentInfo> components;
+    int restart_interval = 0;
+    std::vector<SegmentLocation> app_segments;
+    std::optional<SegmentLocation> comment;
+    // EXIF orientation from 1 to 8 as in the TIFF tag, 1 without one: 2 to 4 flip the image, 5 to 8
+    // also swap its axes.
+    int orientation = 1;
+};
+
+// Quantized DCT coefficients of one component as stored in the file, before dequantization.
+struct ComponentCoefficients {
+    ComponentInfo info;
+    // Blocks of the component in whole MCUs, so the last rows and columns may be padding that lies
+    // outside the image.
+    size_t width_in_blocks = 0;
+    size_t height_in_blocks = 0;
+    // Blocks row by row, each 64 values in row-major order with the DC value first.
+    std::vector<int16_t> coefficients;
+
+    std::span<const int16_t, 64> Block(size_t row, size_t column) const {
+        return std::span<const int16_t, 64>(&coefficients[(row * width_in_blocks + column) * 64],
+                                            64);
+    }
+};
+
+// Number of codes of each length from 1 to 16 and the symbols in code order, as in DHT.
+struct HuffmanTable {
+    // 0 for DC, 1 for AC.
+    int table_class = 0;
+    int id = 0;
+    std::array<uint8_t, 16> counts{};
+    std::vector<uint8_t> symbols;
+};
+
+// What re-encoding an image losslessly or comparing images by their coefficients needs.
+struct JpegCoefficients {
+    JpegInfo info;
+    // Indexed by table id, in row-major order.
+    std::vector<std::array<uint16_t, 64>> quant_tables;
+    // The tables defined last; earlier scans of a progressive image may have used others.
+    std::vector<HuffmanTable> huffman_tables;
+    std::vector<ComponentCoefficients> components;
+};
+
+// Parses markers up to the first SOS without touching the entropy-coded data.
+JpegInfo ProbeJpeg(const std::filesystem::path& path);
+JpegInfo ProbeJpeg(std::span<const uint8_t> data);
+
+// Peak memory of decoding the image with `options` into a new image, estimated from its headers:
+// the output and every buffer of the decoder. Scanline decoding holds one band of output instead.
+size_t EstimateDecodeMemory(const std::filesystem::path& path, const DecodeOptions& options = {});
+size_t EstimateDecodeMemory(std::span<const uint8_t> data, const DecodeOptions& options = {});
+
+// Entropy-decodes the whole image and stops there: no dequantization, IDCT or color conversion.
+JpegCoefficients ReadCoefficients(const std::filesystem::path& path);
+JpegCoefficients ReadCoefficients(std::span<const uint8_t> data);
+
+// Files are memory-mapped where the platform supports it and read whole otherwise. A decode
+// keeps all its state to itself, so any number may run at once on different threads.
+Image Decode(const std::filesystem::path& path, const DecodeOptions& options = {});
+Image Decode(std::span<const uint8_t> data, const DecodeOptions& options = {});
+Image Decode(const std::filesystem::path& path, const Rect& roi, DecodeOptions options = {});
+Image Decode(std::span<const uint8_t> data, const Rect& roi, DecodeOptions options = {});
+
+// Decodes into `output`, reusing its buffer; an image wrapping caller memory must be large enough.
+void Decode(const std::filesystem::path& path, Image& output, const DecodeOptions& options = {});
+void Decode(std::span<const uint8_t> data, Image& output, const DecodeOptions& options = {});
+
+// Decodes top to bottom, keeping only one MCU row of intermediate data; memory scales with the
+// image width rather than its area. Progressive images are entropy-decoded whole first.
+class ScanlineDecoder {
+public:
+    explicit ScanlineDecoder(const std::filesystem::path& path, const DecodeOptions& options = {});
+    // `data` must stay valid until the decoder is destroyed.
+    explicit ScanlineDecoder(std::span<const uint8_t> data, const DecodeOptions& options = {});
+    ~ScanlineDecoder();
+
+    size_t Width() const;
+    size_t Height() const;
+    size_t NextScanline() const;
+
+    // Writes up to `count` rows into `rows` starting at its first row and returns how many were
+    // written; `rows` must have the image width, the requested format and at least `count` rows.
+    size_t ReadScanlines(Image& rows, size_t count);
+
+private:
+    struct Impl;
+    std::unique_ptr<Impl> impl_;
+};
+
+// Calls `callback` with each decoded band of rows; `rows.Height()` rows starting at `first_row`.
+using ScanlineCallback = std::function<void(size_t first_row, const Image& rows)>;
+
+void DecodeScanlines(const std::filesystem::path& path, const ScanlineCallback& callback,
+                     const DecodeOptions& options = {});
+void DecodeScanlines(std::span<const uint8_t> data, const ScanlineCallback& callback,
+                     const DecodeOptions& options = {});
+
+// Decodes a JPEG whose bytes arrive in pieces, for example from a socket, without waiting for the
+// whole file. When the data runs out inside a marker segment or an MCU row, decoding stops before
+// it and resumes there once more has been fed; bytes that are not needed again are released, so
+// a baseline image buffers about one MCU row of input. A progressive image hands out its rows
+// after its last scan.
+class IncrementalDecoder {
+public:
+    enum class Status { NeedData, Done };
+
+    explicit IncrementalDecoder(const DecodeOptions& options = {});
+    ~IncrementalDecoder();
+
+    // Appends the next bytes of the file; they are copied.
+    void Feed(std::span<const uint8_t> bytes);
+    // Marks the end of the input, after which missing data is an error rather than awaited.
+    void Close();
+
+    // Decodes as far as the fed data allows and calls `callback` with each finished band of rows.
+    Status Poll(const ScanlineCallback& callback);
+
+    // Zero until the header has been parsed.
+    size_t Width() const;
+    size_t Height() const;
+
+private:
+    struct Impl;
+    std::unique_ptr<Impl> impl_;
+};
+
+// Called after each decoded scan with the image rendered from the first `scans` scans;
+// returning false stops decoding. Baseline images have one scan.
+using ProgressCallback = std::function<bool(int scans, const Image& image)>;
+
+// Decodes a progressive image scan by scan, so that a coarse version is available early. The
+// whole image's coefficients are kept until the last scan.
+void DecodeProgressive(const std::filesystem::path& path, const ProgressCallback& callback,
+                       const DecodeOptions& options = {});
+void DecodeProgressive(std::span<const uint8_t> data, const ProgressCallback& callback,
+                       const DecodeOptions& options = {});
+
+// Decodes many images on `DecodeOptions::threads` threads of the pool. Each thread keeps its own
+// decoder state between images and output images are reused, so a steady stream of similar
+// images from memory is decoded without allocations.
+class BatchDecoder {
+public:
+    explicit BatchDecoder(const DecodeOptions& options = {});
+    ~BatchDecoder();
+
+    // Decodes `inputs[i]` into `outputs[i]`. A failed image leaves its exception in `errors[i]`
+    // without stopping the others; successful ones get a null pointer. One object decodes one
+    // batch at a time and throws if called again before that returns; concurrent batches need
+    // their own BatchDecoders, which may share a pool.
+    void Decode(std::span<const std::span<const uint8_t>> inputs, std::span<Image> outputs,
+                std::span<std::exception_ptr> errors);
+    void Decode(std::span<const std::filesystem::path> paths, std::span<Image> outputs,
+                std::span<std::exception_ptr> errors);
+
+private:
+    struct Impl;
+    std::unique_ptr<Impl> impl_;
+};
@@ -1,47 +1,70 @@
-#include <cstdint>
-#include <iostream>
+#include <cstring>
 #include "bit_reader.h"
 
-BitReader::BitReader(std::istream& is) : is_(is) {
+namespace {
+
+constexpr uint64_t kLowBits = 0x0101010101010101ull;
+constexpr uint64_t kHighBits = 0x8080808080808080ull;
+
+bool HasByteFF(uint64_t word) {
+    uint64_t inverted = ~word;
+    return ((inverted - kLowBits) & word & kHighBits) != 0;
+}
+
+}  // namespace
+
+BitReader::BitReader(std::span<const uint8_t> data, size_t pos) : data_(data), pos_(pos) {
 }
-bool BitReader::Read() {
-    if (last_byte_ == -1) {
-        char bytes[1];
-        is_.read(bytes, 1);
-        if (is_.gcount() == 0) {
-            throw std::runtime_error("Unexpected EOF");
+
+void BitReader::Refill() {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    if (pos_ + 8 <= data_.size()) {
+        uint64_t word;
+        std::memcpy(&word, data_.data() + pos_, 8);
+        if (!HasByteFF(word)) {
+            // Bits of the first byte that does not fit are repeated by the next refill.
+            int count = (64 - bits_) / 8;
+            buffer_ |= __builtin_bswap64(word) >> bits_;
+            bits_ += count * 8;
+            pos_ += count;
+            return;
         }
-        last_byte_ = static_cast<uint8_t>(bytes[0]);
-        if (last_byte_ == 0xff) {
-            is_.read(bytes, 1);
-            if (is_.gcount() == 0 || static_cast<uint8_t>(bytes[0]) != 0) {
-                throw std::runtime_error("Unexpected EOF");
+    }
+#endif
+    while (bits_ <= 56 && !end_) {
+        if (pos_ == data_.size()) {
+            end_ = true;
+            break;
+        }
+        uint8_t byte = data_[pos_];
+        if (byte == 0xff) {
+            if (pos_ + 1 == data_.size() || data_[pos_ + 1] != 0) {
+                end_ = true;
+                break;
             }
+            ++pos_;
         }
+        ++pos_;
+        buffer_ |= static_cast<uint64_t>(byte) << (56 - bits_);
+        bits_ += 8;
     }
-    bool ans = last_byte_ & (1 << (7 - idx_));
-    idx_++;
-    if (idx_ == 8) {
-        last_byte_ = -1;
-        idx_ = 0;
+    while (bits_ <= 56) {
+        padding_ += 8;
+        bits_ += 8;
     }
-    return ans;
 }
 
-int BitReader::ReadN(int n) {
-    int val = 0;
-    bool begin = true, first_zero = false;
-    for (int i = 0; i < n; i++) {
-        bool bit = Read();
-        if (!bit && begin) {
-            first_zero = true;
-        }
-        begin = false;
-        val *= 2;
-        val += bit;
-    }
-    if (first_zero) {
-        val = val - (1 << n) + 1;
+void BitReader::Resume(std::span<const uint8_t> data, size_t discarded) {
+    data_ = data;
+    pos_ -= discarded;
+    bits_ -= padding_;
+    padding_ = 0;
+    end_ = false;
+}
+
+size_t BitReader::Finish() {
+    while (pos_ + 1 < data_.size() && (data_[pos_] != 0xff || data_[pos_ + 1] == 0)) {
+        pos_ += data_[pos_] == 0xff ? 2 : 1;
     }
-    return val;
+    return pos_;
 }
@@ -1,13 +1,77 @@
 #pragma once
-#include <istream>
+#include <cstdint>
+#include <span>
+#include <stdexcept>
 
-struct BitReader {
-    BitReader(std::istream& is);
-    bool Read();
-    int ReadN(int n);
+// The data ended before decoding did. Incremental decoding waits for more data instead.
+class UnexpectedEof : public std::runtime_error {
+public:
+    UnexpectedEof() : std::runtime_error("Unexpected EOF") {
+    }
+};
+
+class BitReader {
+public:
+    BitReader(std::span<const uint8_t> data, size_t pos);
+
+    int Peek(int n) {
+        if (bits_ < n) {
+            Refill();
+        }
+        return buffer_ >> (64 - n);
+    }
+
+    void Skip(int n) {
+        if (bits_ < n) {
+            Refill();
+        }
+        buffer_ <<= n;
+        bits_ -= n;
+        if (bits_ < padding_) {
+            throw UnexpectedEof();
+        }
+    }
+
+    int ReadBits(int n) {
+        if (n == 0) {
+            return 0;
+        }
+        int val = Peek(n);
+        Skip(n);
+        return val;
+    }
+
+    int ReadSigned(int n) {
+        if (n == 0) {
+            return 0;
+        }
+        int val = Peek(n);
+        Skip(n);
+        if (val < (1 << (n - 1))) {
+            val = val - (1 << n) + 1;
+        }
+        return val;
+    }
+
+    // Returns the position of the marker that ends the entropy-coded segment.
+    size_t Finish();
+
+    // Bytes before this position are buffered already and not read again.
+    size_t Position() const {
+        return pos_;
+    }
+
+    // Continues on `data`, which extends the previous data without its first `discarded` bytes,
+    // as if the end of the previous data had never been reached.
+    void Resume(std::span<const uint8_t> data, size_t discarded);
 
 private:
-    std::istream& is_;
-    int last_byte_ = -1;
-    int idx_ = 0;
+    void Refill();
+
+    std::span<const uint8_t> data_;
+    size_t pos_;
+    uint64_t buffer_ = 0;
+    int bits_ = 0;
+    int padding_ = 0;
+    bool end_ = false;
 };
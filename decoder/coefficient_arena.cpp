@@ -0,0 +1,59 @@
+#include <cstring>
+#include <new>
+#include "coefficient_arena.h"
+
+namespace {
+
+constexpr size_t kBlockBytes = 64 * sizeof(int16_t);
+
+}  // namespace
+
+CoefficientArena::~CoefficientArena() {
+    if (coefficients_) {
+        ::operator delete(coefficients_, std::align_val_t{kAlignment});
+    }
+}
+
+size_t CoefficientArena::BytesFor(const Extent (&extents)[kComponents]) {
+    size_t blocks = 0;
+    for (const auto& extent : extents) {
+        blocks += extent.lines_ * extent.columns_;
+    }
+    return blocks * (kBlockBytes + 1);
+}
+
+void CoefficientArena::Init(const Extent (&extents)[kComponents]) {
+    size_t blocks = 0;
+    for (int c = 0; c < kComponents; c++) {
+        extents_[c] = extents[c];
+        offsets_[c] = blocks;
+        blocks += extents[c].lines_ * extents[c].columns_;
+    }
+    if (blocks <= capacity_) {
+        return;
+    }
+    // A fresh allocation is all zeros, which keeps every block consistent with its last index of
+    // zero. Reused storage is consistent already: each block slot keeps its own index.
+    if (coefficients_) {
+        ::operator delete(coefficients_, std::align_val_t{kAlignment});
+        coefficients_ = nullptr;
+        capacity_ = 0;
+    }
+    size_t bytes = blocks * (kBlockBytes + 1);
+    void* memory = ::operator new(bytes, std::align_val_t{kAlignment});
+    std::memset(memory, 0, bytes);
+    coefficients_ = static_cast<int16_t*>(memory);
+    last_ = reinterpret_cast<uint8_t*>(coefficients_ + blocks * 64);
+    capacity_ = blocks;
+}
+
+void CoefficientArena::Clear() {
+    size_t blocks = offsets_[kComponents - 1] +
+                    extents_[kComponents - 1].lines_ * extents_[kComponents - 1].columns_;
+    std::memset(coefficients_, 0, blocks * kBlockBytes);
+    std::memset(last_, 0, blocks);
+}
+
+size_t CoefficientArena::Bytes() const {
+    return capacity_ * (kBlockBytes + 1);
+}
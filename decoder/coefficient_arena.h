@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Quantized coefficients of every component in one 64-byte aligned allocation. A component is
+// `lines` rows of `columns` blocks, stored row after row; a block is 64 int16 values in
+// row-major order, so each one fills exactly two cache lines. Next to each block is the zigzag
+// index of its last nonzero coefficient. The allocation is reused while new layouts fit in it.
+class CoefficientArena {
+public:
+    static constexpr size_t kAlignment = 64;
+    static constexpr int kComponents = 3;
+
+    struct Extent {
+        size_t lines_ = 0;
+        size_t columns_ = 0;
+    };
+
+    CoefficientArena() = default;
+    ~CoefficientArena();
+
+    CoefficientArena(const CoefficientArena&) = delete;
+    CoefficientArena& operator=(const CoefficientArena&) = delete;
+
+    // Size of a fresh allocation for these extents.
+    static size_t BytesFor(const Extent (&extents)[kComponents]);
+
+    void Init(const Extent (&extents)[kComponents]);
+    // Zeroes every block of the current layout and its last index.
+    void Clear();
+
+    int16_t* Block(int component, size_t line, size_t column) {
+        return coefficients_ + Index(component, line, column) * 64;
+    }
+
+    const int16_t* Block(int component, size_t line, size_t column) const {
+        return coefficients_ + Index(component, line, column) * 64;
+    }
+
+    uint8_t& Last(int component, size_t line, size_t column) {
+        return last_[Index(component, line, column)];
+    }
+
+    uint8_t Last(int component, size_t line, size_t column) const {
+        return last_[Index(component, line, column)];
+    }
+
+    size_t Columns(int component) const {
+        return extents_[component].columns_;
+    }
+
+    // Size of the allocation, which may exceed what the current layout uses.
+    size_t Bytes() const;
+
+private:
+    size_t Index(int component, size_t line, size_t column) const {
+        return offsets_[component] + line * extents_[component].columns_ + column;
+    }
+
+    int16_t* coefficients_ = nullptr;
+    uint8_t* last_ = nullptr;
+    size_t capacity_ = 0;
+    Extent extents_[kComponents];
+    size_t offsets_[kComponents] = {};
+};
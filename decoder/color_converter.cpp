@@ -0,0 +1,240 @@
+#include <algorithm>
+#include <cstring>
+#include "color_converter.h"
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+namespace {
+
+// JFIF coefficients scaled by 2^14. Chroma is pre-shifted by 6 so that the high half of the
+// 16-bit product keeps four fractional bits for rounding.
+constexpr int kChromaShift = 6;
+constexpr int kFractionBits = 4;
+constexpr int kRound = 1 << (kFractionBits - 1);
+constexpr int kCrToR = 22970;
+constexpr int kCbToB = 29032;
+constexpr int kCbToG = 5638;
+constexpr int kCrToG = 11700;
+
+int MulHigh(int a, int k) {
+    return (a * k) >> 16;
+}
+
+uint8_t Clamp(int x) {
+    return std::min(std::max(x, 0), 255);
+}
+
+void StorePixel(uint8_t* out, int r, int g, int b, PixelFormat format) {
+    switch (format) {
+        case PixelFormat::BGR24:
+            out[0] = b;
+            out[1] = g;
+            out[2] = r;
+            break;
+        case PixelFormat::RGBA32:
+            out[3] = 255;
+            [[fallthrough]];
+        default:
+            out[0] = r;
+            out[1] = g;
+            out[2] = b;
+    }
+}
+
+size_t ScalarKernel(const uint8_t* y, const uint8_t* cb, const uint8_t* cr, uint8_t* out,
+                    size_t width, PixelFormat format) {
+    size_t pixel_size = BytesPerPixel(format);
+    for (size_t x = 0; x < width; x++) {
+        int cbs = (cb[x] - 128) * (1 << kChromaShift);
+        int crs = (cr[x] - 128) * (1 << kChromaShift);
+        int r = y[x] + ((MulHigh(crs, kCrToR) + kRound) >> kFractionBits);
+        int g = y[x] - ((MulHigh(cbs, kCbToG) + MulHigh(crs, kCrToG) + kRound) >> kFractionBits);
+        int b = y[x] + ((MulHigh(cbs, kCbToB) + kRound) >> kFractionBits);
+        StorePixel(out + x * pixel_size, Clamp(r), Clamp(g), Clamp(b), format);
+    }
+    return width;
+}
+
+#if defined(__SSE2__)
+
+[[gnu::always_inline]] inline void ConvertWords(__m128i y, __m128i cb, __m128i cr, __m128i& r,
+                                                __m128i& g, __m128i& b) {
+    const __m128i bias = _mm_set1_epi16(128);
+    const __m128i round = _mm_set1_epi16(kRound);
+    cb = _mm_slli_epi16(_mm_sub_epi16(cb, bias), kChromaShift);
+    cr = _mm_slli_epi16(_mm_sub_epi16(cr, bias), kChromaShift);
+    __m128i rd = _mm_mulhi_epi16(cr, _mm_set1_epi16(kCrToR));
+    __m128i gd = _mm_add_epi16(_mm_mulhi_epi16(cb, _mm_set1_epi16(kCbToG)),
+                               _mm_mulhi_epi16(cr, _mm_set1_epi16(kCrToG)));
+    __m128i bd = _mm_mulhi_epi16(cb, _mm_set1_epi16(kCbToB));
+    r = _mm_add_epi16(y, _mm_srai_epi16(_mm_add_epi16(rd, round), kFractionBits));
+    g = _mm_sub_epi16(y, _mm_srai_epi16(_mm_add_epi16(gd, round), kFractionBits));
+    b = _mm_add_epi16(y, _mm_srai_epi16(_mm_add_epi16(bd, round), kFractionBits));
+}
+
+[[gnu::always_inline]] inline void StoreRgba(__m128i r, __m128i g, __m128i b, uint8_t* out) {
+    __m128i alpha = _mm_set1_epi8(-1);
+    __m128i rg_lo = _mm_unpacklo_epi8(r, g), rg_hi = _mm_unpackhi_epi8(r, g);
+    __m128i ba_lo = _mm_unpacklo_epi8(b, alpha), ba_hi = _mm_unpackhi_epi8(b, alpha);
+    __m128i* dst = reinterpret_cast<__m128i*>(out);
+    _mm_storeu_si128(dst, _mm_unpacklo_epi16(rg_lo, ba_lo));
+    _mm_storeu_si128(dst + 1, _mm_unpackhi_epi16(rg_lo, ba_lo));
+    _mm_storeu_si128(dst + 2, _mm_unpacklo_epi16(rg_hi, ba_hi));
+    _mm_storeu_si128(dst + 3, _mm_unpackhi_epi16(rg_hi, ba_hi));
+}
+
+size_t Sse2Kernel(const uint8_t* y, const uint8_t* cb, const uint8_t* cr, uint8_t* out,
+                  size_t width, PixelFormat format) {
+    const __m128i zero = _mm_setzero_si128();
+    size_t pixel_size = BytesPerPixel(format);
+    size_t x = 0;
+    for (; x + 16 <= width; x += 16) {
+        __m128i yv = _mm_loadu_si128(reinterpret_cast<const __m128i*>(y + x));
+        __m128i cbv = _mm_loadu_si128(reinterpret_cast<const __m128i*>(cb + x));
+        __m128i crv = _mm_loadu_si128(reinterpret_cast<const __m128i*>(cr + x));
+        __m128i r[2], g[2], b[2];
+        ConvertWords(_mm_unpacklo_epi8(yv, zero), _mm_unpacklo_epi8(cbv, zero),
+                     _mm_unpacklo_epi8(crv, zero), r[0], g[0], b[0]);
+        ConvertWords(_mm_unpackhi_epi8(yv, zero), _mm_unpackhi_epi8(cbv, zero),
+                     _mm_unpackhi_epi8(crv, zero), r[1], g[1], b[1]);
+        __m128i rb = _mm_packus_epi16(r[0], r[1]);
+        __m128i gb = _mm_packus_epi16(g[0], g[1]);
+        __m128i bb = _mm_packus_epi16(b[0], b[1]);
+        if (format == PixelFormat::RGBA32) {
+            StoreRgba(rb, gb, bb, out + x * 4);
+            continue;
+        }
+        alignas(16) uint8_t rs[16], gs[16], bs[16];
+        _mm_store_si128(reinterpret_cast<__m128i*>(rs), rb);
+        _mm_store_si128(reinterpret_cast<__m128i*>(gs), gb);
+        _mm_store_si128(reinterpret_cast<__m128i*>(bs), bb);
+        for (int k = 0; k < 16; k++) {
+            StorePixel(out + (x + k) * pixel_size, rs[k], gs[k], bs[k], format);
+        }
+    }
+    return x;
+}
+
+[[gnu::target("avx2")]] size_t Avx2Kernel(const uint8_t* y, const uint8_t* cb, const uint8_t* cr,
+                                          uint8_t* out, size_t width, PixelFormat format) {
+    const __m256i bias = _mm256_set1_epi16(128);
+    const __m256i round = _mm256_set1_epi16(kRound);
+    const __m128i rgb_mask = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+    const __m128i bgr_mask = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+    size_t x = 0;
+    // 24-bit stores write 4 bytes past the last pixel, so leave room for two more pixels.
+    size_t tail = format == PixelFormat::RGBA32 ? 0 : 2;
+    for (; x + 16 + tail <= width; x += 16) {
+        __m256i yv = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(y + x)));
+        __m256i cbv = _mm256_slli_epi16(
+            _mm256_sub_epi16(
+                _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(cb + x))),
+                bias),
+            kChromaShift);
+        __m256i crv = _mm256_slli_epi16(
+            _mm256_sub_epi16(
+                _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(cr + x))),
+                bias),
+            kChromaShift);
+        __m256i rd = _mm256_mulhi_epi16(crv, _mm256_set1_epi16(kCrToR));
+        __m256i gd = _mm256_add_epi16(_mm256_mulhi_epi16(cbv, _mm256_set1_epi16(kCbToG)),
+                                      _mm256_mulhi_epi16(crv, _mm256_set1_epi16(kCrToG)));
+        __m256i bd = _mm256_mulhi_epi16(cbv, _mm256_set1_epi16(kCbToB));
+        __m256i r =
+            _mm256_add_epi16(yv, _mm256_srai_epi16(_mm256_add_epi16(rd, round), kFractionBits));
+        __m256i g =
+            _mm256_sub_epi16(yv, _mm256_srai_epi16(_mm256_add_epi16(gd, round), kFractionBits));
+        __m256i b =
+            _mm256_add_epi16(yv, _mm256_srai_epi16(_mm256_add_epi16(bd, round), kFractionBits));
+        __m128i rb = _mm256_castsi256_si128(
+            _mm256_permute4x64_epi64(_mm256_packus_epi16(r, r), 0xd8));
+        __m128i gb = _mm256_castsi256_si128(
+            _mm256_permute4x64_epi64(_mm256_packus_epi16(g, g), 0xd8));
+        __m128i bb = _mm256_castsi256_si128(
+            _mm256_permute4x64_epi64(_mm256_packus_epi16(b, b), 0xd8));
+        if (format == PixelFormat::RGBA32) {
+            StoreRgba(rb, gb, bb, out + x * 4);
+            continue;
+        }
+        alignas(16) uint8_t rgba[64];
+        StoreRgba(rb, gb, bb, rgba);
+        const __m128i mask = format == PixelFormat::BGR24 ? bgr_mask : rgb_mask;
+        for (int k = 0; k < 4; k++) {
+            __m128i chunk = _mm_load_si128(reinterpret_cast<const __m128i*>(rgba) + k);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + x * 3 + k * 12),
+                             _mm_shuffle_epi8(chunk, mask));
+        }
+    }
+    return x;
+}
+
+#endif
+
+// Replicates each sample `Factor` times; a zero `Factor` takes the factor at run time.
+template <int Factor>
+void Replicate(const uint8_t* near, size_t width, int factor, uint8_t* out) {
+    const int step = Factor ? Factor : factor;
+    for (size_t x = 0; x < width; x++) {
+        for (int k = 0; k < step; k++) {
+            out[x * step + k] = near[x];
+        }
+    }
+}
+
+}  // namespace
+
+ColorConverter::ColorConverter(PixelFormat format, Isa max_isa)
+    : format_(format), kernel_(ScalarKernel) {
+#if defined(__SSE2__)
+    if (max_isa == Isa::Avx2 && __builtin_cpu_supports("avx2")) {
+        kernel_ = Avx2Kernel;
+    } else if (max_isa != Isa::Scalar) {
+        kernel_ = Sse2Kernel;
+    }
+#endif
+}
+
+void ColorConverter::ConvertRow(const uint8_t* y, const uint8_t* cb, const uint8_t* cr,
+                                uint8_t* out, size_t width) const {
+    size_t done = kernel_(y, cb, cr, out, width, format_);
+    size_t pixel_size = BytesPerPixel(format_);
+    ScalarKernel(y + done, cb + done, cr + done, out + done * pixel_size, width - done, format_);
+}
+
+void UpsampleRow(const uint8_t* near, const uint8_t* far, size_t width, int h_factor, bool fancy,
+                 uint8_t* out) {
+    if (!fancy || (h_factor > 2)) {
+        switch (h_factor) {
+            case 1:
+                std::memcpy(out, near, width);
+                break;
+            case 2:
+                Replicate<2>(near, width, h_factor, out);
+                break;
+            case 4:
+                Replicate<4>(near, width, h_factor, out);
+                break;
+            default:
+                Replicate<0>(near, width, h_factor, out);
+        }
+        return;
+    }
+    auto column = [&](size_t x) { return far ? near[x] * 3 + far[x] : near[x] * 4; };
+    if (h_factor == 1) {
+        for (size_t x = 0; x < width; x++) {
+            out[x] = (column(x) + 2) >> 2;
+        }
+        return;
+    }
+    int even_bias = far ? 8 : 4, odd_bias = far ? 7 : 8;
+    int left = column(0), center = left;
+    for (size_t x = 0; x < width; x++) {
+        int right = x + 1 < width ? column(x + 1) : center;
+        out[2 * x] = (center * 3 + left + even_bias) >> 4;
+        out[2 * x + 1] = (center * 3 + right + odd_bias) >> 4;
+        left = center;
+        center = right;
+    }
+}
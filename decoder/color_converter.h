@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include "../image.h"
+
+// Converts rows of full-resolution Y, Cb, Cr samples into an interleaved RGB format with
+// fixed-point JFIF coefficients. The vector kernels produce the same values as the scalar one.
+class ColorConverter {
+public:
+    // Instruction sets of the kernels, narrowest first.
+    enum class Isa { Scalar, Sse2, Avx2 };
+
+    // Uses the widest kernel the CPU has up to `max_isa`, so that tests can check every kernel on
+    // one machine.
+    explicit ColorConverter(PixelFormat format = PixelFormat::RGB24, Isa max_isa = Isa::Avx2);
+
+    void ConvertRow(const uint8_t* y, const uint8_t* cb, const uint8_t* cr, uint8_t* out,
+                    size_t width) const;
+
+private:
+    using Kernel = size_t (*)(const uint8_t* y, const uint8_t* cb, const uint8_t* cr, uint8_t* out,
+                              size_t width, PixelFormat format);
+
+    PixelFormat format_;
+    Kernel kernel_;
+};
+
+// Expands a row of `width` chroma samples by `h_factor` horizontally. With `fancy` set, factor 2
+// uses a triangle filter instead of replication, and a non-null `far` row (the neighbouring
+// chroma row on the output row's side) is blended in 3:1 for vertical interpolation.
+void UpsampleRow(const uint8_t* near, const uint8_t* far, size_t width, int h_factor, bool fancy,
+                 uint8_t* out);
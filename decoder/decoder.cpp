@@ -1,10 +1,315 @@
-#include <fstream>
-#include <iostream>
+#include <algorithm>
+#include <atomic>
 #include "../decoder.h"
 #include "jpeg_decoder.h"
+#include "mapped_file.h"
+#include "thread_pool.h"
 
-Image Decode(const std::filesystem::path& path) {
-    std::ifstream stream(path, std::ios_base::binary);
-    JpegDecoder decoder(stream);
-    return decoder.Decode();
+namespace {
+
+const char* LimitName(DecodeLimit limit) {
+    switch (limit) {
+        case DecodeLimit::Pixels:
+            return "pixels";
+        case DecodeLimit::Memory:
+            return "memory";
+        case DecodeLimit::Markers:
+            return "markers";
+        case DecodeLimit::SegmentBytes:
+            return "segment bytes";
+        case DecodeLimit::ScanBytes:
+            return "scan bytes";
+        default:
+            return "deadline";
+    }
+}
+
+}  // namespace
+
+LimitExceeded::LimitExceeded(DecodeLimit limit)
+    : std::runtime_error(std::string("Decode limit exceeded: ") + LimitName(limit)),
+      limit_(limit) {
+}
+
+JpegInfo ProbeJpeg(const std::filesystem::path& path) {
+    MappedFile file(path);
+    return ProbeJpeg(file.Data());
+}
+
+JpegInfo ProbeJpeg(std::span<const uint8_t> data) {
+    JpegDecoder decoder(data);
+    return decoder.Probe();
+}
+
+size_t EstimateDecodeMemory(const std::filesystem::path& path, const DecodeOptions& options) {
+    MappedFile file(path);
+    return EstimateDecodeMemory(file.Data(), options);
+}
+
+size_t EstimateDecodeMemory(std::span<const uint8_t> data, const DecodeOptions& options) {
+    DecodeOptions quiet = options;
+    quiet.stats = nullptr;
+    JpegDecoder decoder(data, quiet);
+    return decoder.EstimateMemory();
+}
+
+JpegCoefficients ReadCoefficients(const std::filesystem::path& path) {
+    MappedFile file(path);
+    return ReadCoefficients(file.Data());
+}
+
+JpegCoefficients ReadCoefficients(std::span<const uint8_t> data) {
+    JpegDecoder decoder(data);
+    JpegCoefficients coefficients;
+    decoder.ReadCoefficients(coefficients);
+    return coefficients;
+}
+
+Image Decode(const std::filesystem::path& path, const DecodeOptions& options) {
+    Image image;
+    Decode(path, image, options);
+    return image;
+}
+
+Image Decode(std::span<const uint8_t> data, const DecodeOptions& options) {
+    Image image;
+    Decode(data, image, options);
+    return image;
+}
+
+Image Decode(const std::filesystem::path& path, const Rect& roi, DecodeOptions options) {
+    options.region = roi;
+    return Decode(path, options);
+}
+
+Image Decode(std::span<const uint8_t> data, const Rect& roi, DecodeOptions options) {
+    options.region = roi;
+    return Decode(data, options);
+}
+
+void Decode(const std::filesystem::path& path, Image& output, const DecodeOptions& options) {
+    MappedFile file(path);
+    Decode(file.Data(), output, options);
+}
+
+void Decode(std::span<const uint8_t> data, Image& output, const DecodeOptions& options) {
+    JpegDecoder decoder(data, options);
+    decoder.Decode(output);
+}
+
+struct ScanlineDecoder::Impl {
+    Impl(std::unique_ptr<MappedFile> file, std::span<const uint8_t> data,
+         const DecodeOptions& options)
+        : file(std::move(file)), decoder(data, options), format(options.format) {
+        decoder.ReadHeader();
+    }
+
+    std::unique_ptr<MappedFile> file;
+    JpegDecoder decoder;
+    PixelFormat format;
+    Image band;
+    size_t band_pos = 0;
+    size_t next = 0;
+};
+
+ScanlineDecoder::ScanlineDecoder(const std::filesystem::path& path, const DecodeOptions& options) {
+    auto file = std::make_unique<MappedFile>(path);
+    auto data = file->Data();
+    impl_ = std::make_unique<Impl>(std::move(file), data, options);
+}
+
+ScanlineDecoder::ScanlineDecoder(std::span<const uint8_t> data, const DecodeOptions& options)
+    : impl_(std::make_unique<Impl>(nullptr, data, options)) {
+}
+
+ScanlineDecoder::~ScanlineDecoder() = default;
+
+size_t ScanlineDecoder::Width() const {
+    return impl_->decoder.Width();
+}
+
+size_t ScanlineDecoder::Height() const {
+    return impl_->decoder.Height();
+}
+
+size_t ScanlineDecoder::NextScanline() const {
+    return impl_->next;
+}
+
+size_t ScanlineDecoder::ReadScanlines(Image& rows, size_t count) {
+    auto& band = impl_->band;
+    if (rows.Width() != Width() || rows.Format() != impl_->format || rows.Height() < count) {
+        throw std::runtime_error("Invalid scanline buffer");
+    }
+    size_t written = 0;
+    while (written < count && impl_->next < Height()) {
+        if (impl_->band_pos == band.Height()) {
+            band.SetSize(Width(), impl_->decoder.NextRowCount(), impl_->format);
+            impl_->decoder.ReadMcuRow(band, 0);
+            impl_->band_pos = 0;
+        }
+        size_t n = std::min(count - written, band.Height() - impl_->band_pos);
+        for (size_t plane = 0; plane < PlaneCount(impl_->format); plane++) {
+            for (size_t k = 0; k < n; k++) {
+                auto src = band.Row(impl_->band_pos + k, plane);
+                std::copy(src.begin(), src.end(), rows.Row(written + k, plane).begin());
+            }
+        }
+        impl_->band_pos += n;
+        impl_->next += n;
+        written += n;
+    }
+    return written;
+}
+
+void DecodeScanlines(const std::filesystem::path& path, const ScanlineCallback& callback,
+                     const DecodeOptions& options) {
+    MappedFile file(path);
+    DecodeScanlines(file.Data(), callback, options);
+}
+
+void DecodeScanlines(std::span<const uint8_t> data, const ScanlineCallback& callback,
+                     const DecodeOptions& options) {
+    JpegDecoder decoder(data, options);
+    decoder.ReadHeader();
+    Image band;
+    size_t first_row = 0;
+    while (int rows = decoder.NextRowCount()) {
+        band.SetSize(decoder.Width(), rows, options.format);
+        decoder.ReadMcuRow(band, 0);
+        callback(first_row, band);
+        first_row += rows;
+    }
+}
+
+struct IncrementalDecoder::Impl {
+    explicit Impl(const DecodeOptions& options) : decoder({}, options) {
+    }
+
+    JpegDecoder decoder;
+    std::vector<uint8_t> data;
+    Image band;
+    bool closed = false;
+    bool done = false;
+};
+
+IncrementalDecoder::IncrementalDecoder(const DecodeOptions& options)
+    : impl_(std::make_unique<Impl>(options)) {
+}
+
+IncrementalDecoder::~IncrementalDecoder() = default;
+
+void IncrementalDecoder::Feed(std::span<const uint8_t> bytes) {
+    if (impl_->closed) {
+        throw std::runtime_error("Input is closed");
+    }
+    impl_->data.insert(impl_->data.end(), bytes.begin(), bytes.end());
+}
+
+void IncrementalDecoder::Close() {
+    impl_->closed = true;
+}
+
+IncrementalDecoder::Status IncrementalDecoder::Poll(const ScanlineCallback& callback) {
+    auto& data = impl_->data;
+    if (!impl_->done) {
+        // Consumed bytes are dropped once they make up half of the buffer, so that moving the
+        // rest stays cheap.
+        size_t discarded = impl_->decoder.Retained();
+        if (discarded < data.size() / 2) {
+            discarded = 0;
+        }
+        data.erase(data.begin(), data.begin() + discarded);
+        impl_->decoder.Extend(data, discarded);
+        impl_->done = impl_->decoder.Poll(impl_->band, callback, impl_->closed);
+    }
+    return impl_->done ? Status::Done : Status::NeedData;
+}
+
+size_t IncrementalDecoder::Width() const {
+    return impl_->decoder.Width();
+}
+
+size_t IncrementalDecoder::Height() const {
+    return impl_->decoder.Height();
+}
+
+void DecodeProgressive(const std::filesystem::path& path, const ProgressCallback& callback,
+                       const DecodeOptions& options) {
+    MappedFile file(path);
+    DecodeProgressive(file.Data(), callback, options);
+}
+
+void DecodeProgressive(std::span<const uint8_t> data, const ProgressCallback& callback,
+                       const DecodeOptions& options) {
+    JpegDecoder decoder(data, options);
+    Image image;
+    decoder.Decode(image, callback);
+}
+
+struct BatchDecoder::Impl {
+    explicit Impl(const DecodeOptions& options)
+        : pool(ThreadPool::For(options.pool, options.threads)) {
+        DecodeOptions single = options;
+        single.threads = 1;
+        single.stats = nullptr;
+        size_t threads = std::min(ThreadPool::WorkersFor(options.threads) + 1, pool.Size());
+        for (size_t i = 0; i < threads; i++) {
+            contexts.push_back(std::make_unique<JpegDecoder>(std::span<const uint8_t>(), single));
+        }
+    }
+
+    template <class Load>
+    void Run(size_t count, std::span<Image> outputs, std::span<std::exception_ptr> errors,
+             const Load& load) {
+        if (outputs.size() != count || errors.size() != count) {
+            throw std::runtime_error("Batch sizes do not match");
+        }
+        // The decoder contexts belong to one batch at a time.
+        if (busy.exchange(true)) {
+            throw std::runtime_error("BatchDecoder is already decoding");
+        }
+        struct Release {
+            std::atomic<bool>& busy;
+            ~Release() {
+                busy = false;
+            }
+        } release{busy};
+        pool.ParallelFor(count, [&](size_t i, size_t participant) {
+            try {
+                load(i, [&](std::span<const uint8_t> data) {
+                    auto& decoder = *contexts[participant];
+                    decoder.Reset(data);
+                    decoder.Decode(outputs[i]);
+                });
+                errors[i] = nullptr;
+            } catch (...) {
+                errors[i] = std::current_exception();
+            }
+        }, contexts.size());
+    }
+
+    ThreadPool& pool;
+    std::vector<std::unique_ptr<JpegDecoder>> contexts;
+    std::atomic<bool> busy = false;
+};
+
+BatchDecoder::BatchDecoder(const DecodeOptions& options)
+    : impl_(std::make_unique<Impl>(options)) {
+}
+
+BatchDecoder::~BatchDecoder() = default;
+
+void BatchDecoder::Decode(std::span<const std::span<const uint8_t>> inputs,
+                          std::span<Image> outputs, std::span<std::exception_ptr> errors) {
+    impl_->Run(inputs.size(), outputs, errors,
+               [&](size_t i, const auto& decode) { decode(inputs[i]); });
+}
+
+void BatchDecoder::Decode(std::span<const std::filesystem::path> paths, std::span<Image> outputs,
+                          std::span<std::exception_ptr> errors) {
+    impl_->Run(paths.size(), outputs, errors, [&](size_t i, const auto& decode) {
+        MappedFile file(paths[i]);
+        decode(file.Data());
+    });
 }
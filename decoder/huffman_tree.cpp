@@ -1,81 +1,107 @@
+#include <algorithm>
+#include <iterator>
 #include <stdexcept>
-#include <iostream>
 #include "huffman_tree.h"
 
-bool HuffmanTree::AddImpl(int idx, int len, int val) {
+namespace {
+
+int Extend(int bits, int len) {
     if (len == 0) {
-        if (val_[idx] == -1) {
-            val_[idx] = val;
-            return true;
-        }
-        return false;
-    }
-    int left_son = left_[idx];
-    int right_son = right_[idx];
-    if (left_son == -1) {
-        val_.push_back(-1);
-        left_.push_back(-1);
-        right_.push_back(-1);
-        left_son = val_.size() - 1;
-        left_[idx] = left_son;
-    }
-    if (val_[left_son] == -1 && AddImpl(left_son, len - 1, val)) {
-        return true;
-    }
-    if (right_son == -1) {
-        val_.push_back(-1);
-        left_.push_back(-1);
-        right_.push_back(-1);
-        right_son = val_.size() - 1;
-        right_[idx] = right_son;
-    }
-    if (val_[right_son] == -1 && AddImpl(right_son, len - 1, val)) {
-        return true;
+        return 0;
     }
-    return false;
+    return bits < (1 << (len - 1)) ? bits - (1 << len) + 1 : bits;
 }
 
+}  // namespace
+
 bool HuffmanTree::IsEmpty() const {
-    return left_.empty();
+    return symbols_.empty();
+}
+
+void HuffmanTree::Clear() {
+    symbols_.clear();
+    std::fill(std::begin(first_code_), std::end(first_code_), 0);
+    std::fill(std::begin(first_index_), std::end(first_index_), 0);
+    std::fill(std::begin(count_), std::end(count_), 0);
+    std::fill(std::begin(lookup_), std::end(lookup_), LookupEntry{});
+    next_code_ = 0;
+    last_len_ = 0;
 }
 
 void HuffmanTree::Add(int len, int val) {
-    if (IsEmpty()) {
-        val_.push_back(-1);
-        left_.push_back(-1);
-        right_.push_back(-1);
+    if (len < 1 || len > kMaxLength || len < last_len_) {
+        throw std::runtime_error("Invalid Huffman table");
+    }
+    next_code_ <<= len - last_len_;
+    last_len_ = len;
+    if (next_code_ >= (1 << len)) {
+        throw std::runtime_error("Invalid Huffman table");
     }
-    if (!AddImpl(0, len, val)) {
-        throw std::runtime_error("Pizdec exception");
+    if (count_[len] == 0) {
+        first_code_[len] = next_code_;
+        first_index_[len] = symbols_.size();
     }
+    ++count_[len];
+    symbols_.push_back(val);
+    if (len <= kLookupBits) {
+        FillLookup(next_code_, len, val);
+    }
+    ++next_code_;
 }
 
-HuffmanTree::Iterator HuffmanTree::Begin() const {
-    return HuffmanTree::Iterator(val_, left_, right_);
+void HuffmanTree::FillLookup(int code, int len, int val) {
+    int free_bits = kLookupBits - len;
+    int size = val % 16;
+    for (int suffix = 0; suffix < (1 << free_bits); suffix++) {
+        auto& entry = lookup_[(code << free_bits) | suffix];
+        entry.length = len;
+        entry.symbol = val;
+        if (len + size <= kLookupBits) {
+            int extra = (suffix >> (free_bits - size)) & ((1 << size) - 1);
+            entry.total_length = len + size;
+            entry.value = Extend(extra, size);
+        }
+    }
 }
 
-HuffmanTree::Iterator::Iterator(const std::vector<int>& val, const std::vector<int>& left,
-                                const std::vector<int>& right)
-    : val_(val), left_(left), right_(right) {
-    if (val_.empty()) {
-        throw std::runtime_error("Huffman decoding failed 0");
+int HuffmanTree::ReadLongSymbol(BitReader& reader) const {
+    for (int len = kLookupBits + 1; len <= kMaxLength; len++) {
+        int offset = reader.Peek(len) - first_code_[len];
+        if (offset >= 0 && offset < count_[len]) {
+            reader.Skip(len);
+            return symbols_[first_index_[len] + offset];
+        }
     }
+    throw std::runtime_error("Huffman decoding failed");
 }
 
-void HuffmanTree::Iterator::Increment(bool bit) {
-    int next_idx;
-    if (bit == 0) {
-        next_idx = left_[pos_];
-    } else {
-        next_idx = right_[pos_];
+int HuffmanTree::ReadSymbol(BitReader& reader) const {
+    if (IsEmpty()) {
+        throw std::runtime_error("Huffman decoding failed");
     }
-    if (next_idx == -1) {
-        throw std::runtime_error("Huffman decoding failed " + std::to_string(pos_) + " " +
-                                 std::to_string(val_.size()));
+    const auto& entry = lookup_[reader.Peek(kLookupBits)];
+    if (entry.length == 0) {
+        return ReadLongSymbol(reader);
     }
-    pos_ = next_idx;
+    reader.Skip(entry.length);
+    return entry.symbol;
 }
 
-int HuffmanTree::Iterator::GetValue() {
-    return val_[pos_];
+HuffmanTree::Coefficient HuffmanTree::ReadCoefficient(BitReader& reader) const {
+    if (IsEmpty()) {
+        throw std::runtime_error("Huffman decoding failed");
+    }
+    const auto& entry = lookup_[reader.Peek(kLookupBits)];
+    if (entry.total_length != 0) {
+        reader.Skip(entry.total_length);
+        return {entry.symbol, entry.value};
+    }
+    int symbol;
+    if (entry.length == 0) {
+        symbol = ReadLongSymbol(reader);
+    } else {
+        reader.Skip(entry.length);
+        symbol = entry.symbol;
+    }
+    return {symbol, reader.ReadSigned(symbol % 16)};
 }
@@ -1,32 +1,50 @@
 #pragma once
 
+#include <cstdint>
 #include <vector>
+#include "bit_reader.h"
 
 struct HuffmanTree {
-    struct Iterator {
-        void Increment(bool bit);
-        int GetValue();
+    static constexpr int kLookupBits = 9;
+    static constexpr int kMaxLength = 16;
 
-    private:
-        Iterator(const std::vector<int>& val, const std::vector<int>& left,
-                 const std::vector<int>& right);
-
-        const std::vector<int>& val_;
-        const std::vector<int>& left_;
-        const std::vector<int>& right_;
-        int pos_ = 0;
-
-        friend HuffmanTree;
+    struct Coefficient {
+        int symbol;
+        int value;
     };
 
     bool IsEmpty() const;
+    // Forgets all codes but keeps the symbol storage for the next table.
+    void Clear();
     void Add(int len, int val);
-    Iterator Begin() const;
+    int ReadSymbol(BitReader& reader) const;
+    Coefficient ReadCoefficient(BitReader& reader) const;
+
+    // The table as defined in the file: codes per length and the symbols in code order.
+    int Count(int len) const {
+        return count_[len];
+    }
+
+    const std::vector<int>& Symbols() const {
+        return symbols_;
+    }
+
+private:
+    struct LookupEntry {
+        uint8_t length = 0;
+        uint8_t total_length = 0;
+        uint8_t symbol = 0;
+        int16_t value = 0;
+    };
 
-public:  // todo
-    bool AddImpl(int idx, int len, int val);
+    int ReadLongSymbol(BitReader& reader) const;
+    void FillLookup(int code, int len, int val);
 
-    std::vector<int> val_;
-    std::vector<int> left_;
-    std::vector<int> right_;
+    std::vector<int> symbols_;
+    int first_code_[kMaxLength + 1] = {};
+    int first_index_[kMaxLength + 1] = {};
+    int count_[kMaxLength + 1] = {};
+    int next_code_ = 0;
+    int last_len_ = 0;
+    LookupEntry lookup_[1 << kLookupBits];
 };
@@ -0,0 +1,475 @@
+#include <algorithm>
+#include <cmath>
+#include <numbers>
+#include "idct.h"
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+namespace {
+
+constexpr int kConstBits = 13;
+constexpr int kPass1Bits = 2;
+
+constexpr int32_t kFix0298631336 = 2446;
+constexpr int32_t kFix0390180644 = 3196;
+constexpr int32_t kFix0541196100 = 4433;
+constexpr int32_t kFix0765366865 = 6270;
+constexpr int32_t kFix0899976223 = 7373;
+constexpr int32_t kFix1175875602 = 9633;
+constexpr int32_t kFix1501321110 = 12299;
+constexpr int32_t kFix1847759065 = 15137;
+constexpr int32_t kFix1961570560 = 16069;
+constexpr int32_t kFix2053119869 = 16819;
+constexpr int32_t kFix2562915447 = 20995;
+constexpr int32_t kFix3072711026 = 25172;
+
+constexpr int32_t kFix0211164243 = 1730;
+constexpr int32_t kFix0509795579 = 4176;
+constexpr int32_t kFix0601344887 = 4926;
+constexpr int32_t kFix0720959822 = 5906;
+constexpr int32_t kFix0850430095 = 6967;
+constexpr int32_t kFix1061594337 = 8697;
+constexpr int32_t kFix1272758580 = 10426;
+constexpr int32_t kFix1451774981 = 11893;
+constexpr int32_t kFix2172734803 = 17799;
+constexpr int32_t kFix3624509785 = 29692;
+
+int64_t Descale(int64_t x, int n) {
+    return (x + (int64_t{1} << (n - 1))) >> n;
+}
+
+uint8_t Clamp(int64_t x) {
+    return static_cast<uint8_t>(std::min<int64_t>(std::max<int64_t>(x, 0), 255));
+}
+
+// Zigzag positions 0 to 9 all lie in the top-left 4x4 quarter of the block.
+constexpr int kQuarterLast = 9;
+
+// Output of a block whose only nonzero coefficient is DC, as each full-size kernel computes it.
+// The reduced kernels all agree with the integer one.
+uint8_t IntegerDc(int dc, const IdctTable& table) {
+    return Clamp(Descale(int64_t{dc} * table.integer[0], 3) + 128);
+}
+
+// Clamps before converting, since corrupt coefficients take floats beyond the range of int.
+uint8_t ClampRounded(float x) {
+    return static_cast<uint8_t>(std::clamp(std::floor(x + 128.5f), 0.f, 255.f));
+}
+
+uint8_t FloatDc(int dc, const IdctTable& table) {
+    return ClampRounded(dc * table.scaled[0]);
+}
+
+// Accurate integer transform with 13-bit constants, as in the IJG "islow" method. Products are
+// taken in 64 bits like libjpeg-turbo's JLONG: coefficients of corrupt data dequantized by 16-bit
+// tables overflow 32 bits.
+template <int Shift>
+void IntegerPass(int64_t v0, int64_t v1, int64_t v2, int64_t v3, int64_t v4, int64_t v5,
+                 int64_t v6, int64_t v7, int64_t (&out)[8]) {
+    int64_t z1 = (v2 + v6) * kFix0541196100;
+    int64_t tmp2 = z1 - v6 * kFix1847759065;
+    int64_t tmp3 = z1 + v2 * kFix0765366865;
+    int64_t tmp0 = (v0 + v4) * (1 << kConstBits);
+    int64_t tmp1 = (v0 - v4) * (1 << kConstBits);
+    int64_t tmp10 = tmp0 + tmp3;
+    int64_t tmp13 = tmp0 - tmp3;
+    int64_t tmp11 = tmp1 + tmp2;
+    int64_t tmp12 = tmp1 - tmp2;
+
+    tmp0 = v7;
+    tmp1 = v5;
+    tmp2 = v3;
+    tmp3 = v1;
+    z1 = tmp0 + tmp3;
+    int64_t z2 = tmp1 + tmp2;
+    int64_t z3 = tmp0 + tmp2;
+    int64_t z4 = tmp1 + tmp3;
+    int64_t z5 = (z3 + z4) * kFix1175875602;
+    tmp0 *= kFix0298631336;
+    tmp1 *= kFix2053119869;
+    tmp2 *= kFix3072711026;
+    tmp3 *= kFix1501321110;
+    z1 *= -kFix0899976223;
+    z2 *= -kFix2562915447;
+    z3 = z3 * -kFix1961570560 + z5;
+    z4 = z4 * -kFix0390180644 + z5;
+    tmp0 += z1 + z3;
+    tmp1 += z2 + z4;
+    tmp2 += z2 + z3;
+    tmp3 += z1 + z4;
+
+    out[0] = Descale(tmp10 + tmp3, Shift);
+    out[7] = Descale(tmp10 - tmp3, Shift);
+    out[1] = Descale(tmp11 + tmp2, Shift);
+    out[6] = Descale(tmp11 - tmp2, Shift);
+    out[2] = Descale(tmp12 + tmp1, Shift);
+    out[5] = Descale(tmp12 - tmp1, Shift);
+    out[3] = Descale(tmp13 + tmp0, Shift);
+    out[4] = Descale(tmp13 - tmp0, Shift);
+}
+
+// With `Quarter` set, only the top-left 4x4 coefficients are read and the rest are taken as zero.
+template <bool Quarter>
+void IntegerSlowKernel(const int16_t* coef, const IdctTable& table, uint8_t* out, size_t stride) {
+    const int32_t* q = table.integer;
+    int64_t workspace[64];
+    constexpr int kColumns = Quarter ? 4 : 8;
+    for (int col = 0; col < kColumns; col++) {
+        const int16_t* in = coef + col;
+        auto deq = [&](int row) {
+            return Quarter && row >= 4 ? 0 : int64_t{in[row * 8]} * q[row * 8 + col];
+        };
+        if (!in[8] && !in[16] && !in[24] &&
+            (Quarter || (!in[32] && !in[40] && !in[48] && !in[56]))) {
+            int64_t dc = deq(0) * (1 << kPass1Bits);
+            for (int row = 0; row < 8; row++) {
+                workspace[row * 8 + col] = dc;
+            }
+            continue;
+        }
+        int64_t result[8];
+        IntegerPass<kConstBits - kPass1Bits>(deq(0), deq(1), deq(2), deq(3), deq(4), deq(5),
+                                             deq(6), deq(7), result);
+        for (int row = 0; row < 8; row++) {
+            workspace[row * 8 + col] = result[row];
+        }
+    }
+    for (int row = 0; row < 8; row++) {
+        const int64_t* ws = workspace + row * 8;
+        auto at = [&](int col) { return Quarter && col >= 4 ? 0 : ws[col]; };
+        int64_t result[8];
+        IntegerPass<kConstBits + kPass1Bits + 3>(at(0), at(1), at(2), at(3), at(4), at(5), at(6),
+                                                 at(7), result);
+        for (int col = 0; col < 8; col++) {
+            out[row * stride + col] = Clamp(result[col] + 128);
+        }
+    }
+}
+
+// Reduced transforms producing 4x4, 2x2 and 1x1 outputs from the low-frequency coefficients,
+// as in the IJG jidctred.c routines.
+template <int Shift>
+void Reduced4Pass(int64_t v0, int64_t v1, int64_t v2, int64_t v3, int64_t v5, int64_t v6,
+                  int64_t v7, int64_t (&out)[4]) {
+    int64_t tmp0 = v0 * (1 << (kConstBits + 1));
+    int64_t tmp2 = v2 * kFix1847759065 - v6 * kFix0765366865;
+    int64_t tmp10 = tmp0 + tmp2;
+    int64_t tmp12 = tmp0 - tmp2;
+    tmp0 = -v7 * kFix0211164243 + v5 * kFix1451774981 - v3 * kFix2172734803 +
+           v1 * kFix1061594337;
+    tmp2 = -v7 * kFix0509795579 - v5 * kFix0601344887 + v3 * kFix0899976223 +
+           v1 * kFix2562915447;
+    out[0] = Descale(tmp10 + tmp2, Shift);
+    out[3] = Descale(tmp10 - tmp2, Shift);
+    out[1] = Descale(tmp12 + tmp0, Shift);
+    out[2] = Descale(tmp12 - tmp0, Shift);
+}
+
+void Reduced4Kernel(const int16_t* coef, const IdctTable& table, uint8_t* out, size_t stride) {
+    const int32_t* q = table.integer;
+    int64_t workspace[32];
+    for (int col = 0; col < 8; col++) {
+        if (col == 4) {
+            continue;
+        }
+        const int16_t* in = coef + col;
+        auto deq = [&](int row) { return int64_t{in[row * 8]} * q[row * 8 + col]; };
+        int64_t result[4];
+        if (!in[8] && !in[16] && !in[24] && !in[40] && !in[48] && !in[56]) {
+            std::fill_n(result, 4, deq(0) * (1 << kPass1Bits));
+        } else {
+            Reduced4Pass<kConstBits - kPass1Bits + 1>(deq(0), deq(1), deq(2), deq(3), deq(5),
+                                                      deq(6), deq(7), result);
+        }
+        for (int row = 0; row < 4; row++) {
+            workspace[row * 8 + col] = result[row];
+        }
+    }
+    for (int row = 0; row < 4; row++) {
+        const int64_t* ws = workspace + row * 8;
+        int64_t result[4];
+        Reduced4Pass<kConstBits + kPass1Bits + 3 + 1>(ws[0], ws[1], ws[2], ws[3], ws[5], ws[6],
+                                                      ws[7], result);
+        for (int col = 0; col < 4; col++) {
+            out[row * stride + col] = Clamp(result[col] + 128);
+        }
+    }
+}
+
+template <int Shift>
+void Reduced2Pass(int64_t v0, int64_t v1, int64_t v3, int64_t v5, int64_t v7,
+                  int64_t (&out)[2]) {
+    int64_t tmp10 = v0 * (1 << (kConstBits + 2));
+    int64_t tmp0 = -v7 * kFix0720959822 + v5 * kFix0850430095 - v3 * kFix1272758580 +
+                   v1 * kFix3624509785;
+    out[0] = Descale(tmp10 + tmp0, Shift);
+    out[1] = Descale(tmp10 - tmp0, Shift);
+}
+
+void Reduced2Kernel(const int16_t* coef, const IdctTable& table, uint8_t* out, size_t stride) {
+    const int32_t* q = table.integer;
+    int64_t workspace[16];
+    for (int col = 0; col < 8; col++) {
+        if (col == 2 || col == 4 || col == 6) {
+            continue;
+        }
+        const int16_t* in = coef + col;
+        auto deq = [&](int row) { return int64_t{in[row * 8]} * q[row * 8 + col]; };
+        int64_t result[2];
+        if (!in[8] && !in[24] && !in[40] && !in[56]) {
+            std::fill_n(result, 2, deq(0) * (1 << kPass1Bits));
+        } else {
+            Reduced2Pass<kConstBits - kPass1Bits + 2>(deq(0), deq(1), deq(3), deq(5), deq(7),
+                                                      result);
+        }
+        workspace[col] = result[0];
+        workspace[8 + col] = result[1];
+    }
+    for (int row = 0; row < 2; row++) {
+        const int64_t* ws = workspace + row * 8;
+        int64_t result[2];
+        Reduced2Pass<kConstBits + kPass1Bits + 3 + 2>(ws[0], ws[1], ws[3], ws[5], ws[7], result);
+        out[row * stride] = Clamp(result[0] + 128);
+        out[row * stride + 1] = Clamp(result[1] + 128);
+    }
+}
+
+void Reduced1Kernel(const int16_t* coef, const IdctTable& table, uint8_t* out, size_t) {
+    out[0] = Clamp(Descale(int64_t{coef[0]} * table.integer[0], 3) + 128);
+}
+
+// One-dimensional AAN butterfly, shared by the scalar and vector kernels. With vector types each
+// lane carries an independent column.
+template <class T>
+[[gnu::always_inline]] inline void AanPass(T (&v)[8]) {
+    T tmp10 = v[0] + v[4];
+    T tmp11 = v[0] - v[4];
+    T tmp13 = v[2] + v[6];
+    T tmp12 = (v[2] - v[6]) * 1.414213562f - tmp13;
+    T tmp0 = tmp10 + tmp13;
+    T tmp3 = tmp10 - tmp13;
+    T tmp1 = tmp11 + tmp12;
+    T tmp2 = tmp11 - tmp12;
+
+    T z13 = v[5] + v[3];
+    T z10 = v[5] - v[3];
+    T z11 = v[1] + v[7];
+    T z12 = v[1] - v[7];
+    T tmp7 = z11 + z13;
+    tmp11 = (z11 - z13) * 1.414213562f;
+    T z5 = (z10 + z12) * 1.847759065f;
+    tmp10 = z12 * 1.082392200f - z5;
+    tmp12 = z10 * -2.613125930f + z5;
+    T tmp6 = tmp12 - tmp7;
+    T tmp5 = tmp11 - tmp6;
+    T tmp4 = tmp10 + tmp5;
+
+    v[0] = tmp0 + tmp7;
+    v[7] = tmp0 - tmp7;
+    v[1] = tmp1 + tmp6;
+    v[6] = tmp1 - tmp6;
+    v[2] = tmp2 + tmp5;
+    v[5] = tmp2 - tmp5;
+    v[4] = tmp3 + tmp4;
+    v[3] = tmp3 - tmp4;
+}
+
+template <bool Quarter>
+void FloatAanKernel(const int16_t* coef, const IdctTable& table, uint8_t* out, size_t stride) {
+    float workspace[64];
+    constexpr int kColumns = Quarter ? 4 : 8;
+    for (int col = 0; col < kColumns; col++) {
+        float v[8];
+        for (int row = 0; row < 8; row++) {
+            v[row] = Quarter && row >= 4 ? 0.f : coef[row * 8 + col] * table.scaled[row * 8 + col];
+        }
+        AanPass(v);
+        for (int row = 0; row < 8; row++) {
+            workspace[row * 8 + col] = v[row];
+        }
+    }
+    for (int row = 0; row < 8; row++) {
+        float v[8];
+        for (int col = 0; col < 8; col++) {
+            v[col] = Quarter && col >= 4 ? 0.f : workspace[row * 8 + col];
+        }
+        AanPass(v);
+        for (int col = 0; col < 8; col++) {
+            out[row * stride + col] = ClampRounded(v[col]);
+        }
+    }
+}
+
+#if defined(__SSE2__)
+
+// Matches the vector kernels, which round to nearest even when converting back to integers.
+uint8_t SimdDc(int dc, const IdctTable& table) {
+    return Clamp(_mm_cvtss_si32(_mm_set_ss(dc * table.scaled[0] + 128.f)));
+}
+
+template <bool Quarter>
+void Sse2Kernel(const int16_t* coef, const IdctTable& table, uint8_t* out, size_t stride) {
+    __m128 left[8], right[8];
+    for (int row = 0; row < 8; row++) {
+        if (Quarter && row >= 4) {
+            left[row] = right[row] = _mm_setzero_ps();
+            continue;
+        }
+        // Sign-extends the eight int16 coefficients of a row into two vectors of int32.
+        __m128i words = _mm_loadu_si128(reinterpret_cast<const __m128i*>(coef + row * 8));
+        __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(words, words), 16);
+        __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(words, words), 16);
+        left[row] = _mm_mul_ps(_mm_cvtepi32_ps(lo), _mm_loadu_ps(table.scaled + row * 8));
+        right[row] = Quarter ? _mm_setzero_ps()
+                             : _mm_mul_ps(_mm_cvtepi32_ps(hi),
+                                          _mm_loadu_ps(table.scaled + row * 8 + 4));
+    }
+    AanPass(left);
+    if (!Quarter) {
+        AanPass(right);
+    }
+    for (int pass = 0; pass < 2; pass++) {
+        _MM_TRANSPOSE4_PS(left[0], left[1], left[2], left[3]);
+        _MM_TRANSPOSE4_PS(left[4], left[5], left[6], left[7]);
+        _MM_TRANSPOSE4_PS(right[0], right[1], right[2], right[3]);
+        _MM_TRANSPOSE4_PS(right[4], right[5], right[6], right[7]);
+        for (int k = 0; k < 4; k++) {
+            std::swap(left[4 + k], right[k]);
+        }
+        if (pass == 0) {
+            AanPass(left);
+            AanPass(right);
+        }
+    }
+    const __m128 bias = _mm_set1_ps(128.f);
+    for (int row = 0; row < 8; row++) {
+        __m128i lo = _mm_cvtps_epi32(_mm_add_ps(left[row], bias));
+        __m128i hi = _mm_cvtps_epi32(_mm_add_ps(right[row], bias));
+        __m128i words = _mm_packs_epi32(lo, hi);
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(out + row * stride),
+                         _mm_packus_epi16(words, words));
+    }
+}
+
+template <bool Quarter>
+[[gnu::target("avx2")]] void Avx2Kernel(const int16_t* coef, const IdctTable& table, uint8_t* out,
+                                         size_t stride) {
+    __m256 v[8];
+    for (int row = 0; row < 8; row++) {
+        if (Quarter && row >= 4) {
+            v[row] = _mm256_setzero_ps();
+            continue;
+        }
+        __m256i in = _mm256_cvtepi16_epi32(
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(coef + row * 8)));
+        v[row] = _mm256_mul_ps(_mm256_cvtepi32_ps(in), _mm256_loadu_ps(table.scaled + row * 8));
+    }
+    for (int pass = 0; pass < 2; pass++) {
+        AanPass(v);
+        __m256 t[8];
+        for (int k = 0; k < 8; k += 2) {
+            t[k] = _mm256_unpacklo_ps(v[k], v[k + 1]);
+            t[k + 1] = _mm256_unpackhi_ps(v[k], v[k + 1]);
+        }
+        __m256 s[8];
+        for (int k = 0; k < 8; k += 4) {
+            for (int m = 0; m < 2; m++) {
+                s[k + m * 2] = _mm256_shuffle_ps(t[k + m], t[k + m + 2], 0x44);
+                s[k + m * 2 + 1] = _mm256_shuffle_ps(t[k + m], t[k + m + 2], 0xee);
+            }
+        }
+        for (int k = 0; k < 4; k++) {
+            v[k] = _mm256_permute2f128_ps(s[k], s[k + 4], 0x20);
+            v[k + 4] = _mm256_permute2f128_ps(s[k], s[k + 4], 0x31);
+        }
+    }
+    const __m256 bias = _mm256_set1_ps(128.f);
+    for (int row = 0; row < 8; row++) {
+        __m256i ints = _mm256_cvtps_epi32(_mm256_add_ps(v[row], bias));
+        __m128i words = _mm_packs_epi32(_mm256_castsi256_si128(ints),
+                                        _mm256_extracti128_si256(ints, 1));
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(out + row * stride),
+                         _mm_packus_epi16(words, words));
+    }
+}
+
+#endif
+
+}  // namespace
+
+Idct::Idct(IdctMethod method, bool allow_avx2) : method_(method) {
+    if (method_ == IdctMethod::Auto) {
+#if defined(__SSE2__)
+        method_ = IdctMethod::Simd;
+#else
+        method_ = IdctMethod::IntegerSlow;
+#endif
+    }
+    switch (method_) {
+        case IdctMethod::IntegerSlow:
+            kernel_ = IntegerSlowKernel<false>;
+            quarter_kernel_ = IntegerSlowKernel<true>;
+            dc_ = IntegerDc;
+            break;
+        case IdctMethod::Simd:
+#if defined(__SSE2__)
+            if (allow_avx2 && __builtin_cpu_supports("avx2")) {
+                kernel_ = Avx2Kernel<false>;
+                quarter_kernel_ = Avx2Kernel<true>;
+            } else {
+                kernel_ = Sse2Kernel<false>;
+                quarter_kernel_ = Sse2Kernel<true>;
+            }
+            dc_ = SimdDc;
+            break;
+#endif
+        default:
+            method_ = IdctMethod::FloatAan;
+            kernel_ = FloatAanKernel<false>;
+            quarter_kernel_ = FloatAanKernel<true>;
+            dc_ = FloatDc;
+    }
+}
+
+IdctMethod Idct::Method() const {
+    return method_;
+}
+
+void Idct::BuildTable(const int (&quant)[8][8], IdctTable* table) const {
+    double scale[8] = {1.0};
+    for (int k = 1; k < 8; k++) {
+        scale[k] = std::cos(k * std::numbers::pi / 16) * std::sqrt(2.0);
+    }
+    for (int i = 0; i < 8; i++) {
+        for (int j = 0; j < 8; j++) {
+            table->integer[i * 8 + j] = quant[i][j];
+            table->scaled[i * 8 + j] = quant[i][j] * scale[i] * scale[j] / 8;
+        }
+    }
+}
+
+void Idct::Transform(const int16_t* coef, const IdctTable& table, uint8_t* out, size_t stride,
+                     int size, int last) const {
+    if (last == 0) {
+        uint8_t value = size == 8 ? dc_(coef[0], table) : IntegerDc(coef[0], table);
+        for (int row = 0; row < size; row++) {
+            std::fill_n(out + row * stride, size, value);
+        }
+        return;
+    }
+    switch (size) {
+        case 4:
+            Reduced4Kernel(coef, table, out, stride);
+            break;
+        case 2:
+            Reduced2Kernel(coef, table, out, stride);
+            break;
+        case 1:
+            Reduced1Kernel(coef, table, out, stride);
+            break;
+        default:
+            (last <= kQuarterLast ? quarter_kernel_ : kernel_)(coef, table, out, stride);
+    }
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include "../decoder.h"
+
+struct IdctTable {
+    int32_t integer[64];
+    float scaled[64];
+};
+
+class Idct {
+public:
+    // Simd uses AVX2 when the CPU has it; `allow_avx2` = false keeps it on SSE2, so that tests can
+    // check both kernels on one machine.
+    explicit Idct(IdctMethod method = IdctMethod::Auto, bool allow_avx2 = true);
+
+    IdctMethod Method() const;
+    void BuildTable(const int (&quant)[8][8], IdctTable* table) const;
+    // Writes a `size` x `size` block; sizes 4, 2 and 1 use reduced transforms for scaled output.
+    // `last` is the zigzag index of the last nonzero coefficient: DC-only blocks are filled with
+    // one value and blocks that end early skip the zero rows and columns.
+    // `coef` holds the 64 quantized coefficients in row-major order.
+    void Transform(const int16_t* coef, const IdctTable& table, uint8_t* out, size_t stride,
+                   int size = 8, int last = 63) const;
+
+private:
+    using Kernel = void (*)(const int16_t* coef, const IdctTable& table, uint8_t* out, size_t stride);
+    using DcKernel = uint8_t (*)(int dc, const IdctTable& table);
+
+    IdctMethod method_;
+    Kernel kernel_;
+    Kernel quarter_kernel_;
+    DcKernel dc_;
+};
@@ -1,30 +1,141 @@
+#include <atomic>
 #include <cstdint>
-#include <fftw3.h>
-#include <cmath>
-#include <iostream>
+#include <cstring>
+#include <utility>
+#include <algorithm>
 #include "jpeg_decoder.h"
+#include "thread_pool.h"
 #include "zigzag_writer.h"
 
-Sector JpegDecoder::ParseMarker() {
-    char bytes[2];
-    is_.read(bytes, 2);
-    if (is_.gcount() < 2) {
-        throw std::runtime_error("Unexpected EOF");
+namespace {
+
+// A pipelined decode starts a worker for every this many MCU rows at most, so that small images
+// are not split between more threads than it pays to start.
+constexpr int kRowsPerWorker = 4;
+
+// Returns the position of the 0xFF starting the next marker at or after `pos`, skipping stuffed
+// zero bytes and fill bytes, or the data size if there is none.
+size_t FindMarker(std::span<const uint8_t> data, size_t pos) {
+    while (pos + 1 < data.size()) {
+        const void* found = std::memchr(data.data() + pos, 0xff, data.size() - pos - 1);
+        if (!found) {
+            break;
+        }
+        pos = static_cast<const uint8_t*>(found) - data.data();
+        if (data[pos + 1] != 0 && data[pos + 1] != 0xff) {
+            return pos;
+        }
+        pos += data[pos + 1] == 0 ? 2 : 1;
+    }
+    return data.size();
+}
+
+// Returns the position of the marker that ends the scan data at or after `pos`, stepping over
+// restart markers, or the data size if it is not there yet.
+size_t FindScanEnd(std::span<const uint8_t> data, size_t pos) {
+    pos = FindMarker(data, pos);
+    while (pos + 1 < data.size() && data[pos + 1] >= 0xd0 && data[pos + 1] <= 0xd7) {
+        pos = FindMarker(data, pos + 2);
+    }
+    return pos;
+}
+
+// Returns the orientation tag of an EXIF APP1 payload, or 1 if it has none.
+int ParseExifOrientation(std::span<const uint8_t> payload) {
+    static constexpr uint8_t kExif[] = {'E', 'x', 'i', 'f', 0, 0};
+    if (payload.size() < 14 || !std::equal(kExif, kExif + 6, payload.begin())) {
+        return 1;
+    }
+    auto tiff = payload.subspan(6);
+    bool big_endian = tiff[0] == 'M';
+    if (tiff[0] != tiff[1] || (tiff[0] != 'I' && tiff[0] != 'M')) {
+        return 1;
+    }
+    auto read = [&](size_t pos, int bytes) {
+        uint32_t value = 0;
+        for (int i = 0; i < bytes; i++) {
+            int shift = big_endian ? 8 * (bytes - 1 - i) : 8 * i;
+            value |= uint32_t{tiff[pos + i]} << shift;
+        }
+        return value;
+    };
+    size_t ifd = read(4, 4);
+    if (read(2, 2) != 42 || ifd > tiff.size() - 2) {
+        return 1;
+    }
+    size_t entries = read(ifd, 2);
+    for (size_t i = 0; i < entries && ifd + 2 + 12 * (i + 1) <= tiff.size(); i++) {
+        size_t entry = ifd + 2 + 12 * i;
+        // A single SHORT, stored in the first bytes of the value field.
+        if (read(entry, 2) == 0x0112 && read(entry + 2, 2) == 3 && read(entry + 4, 4) == 1) {
+            int orientation = read(entry + 8, 2);
+            return orientation >= 1 && orientation <= 8 ? orientation : 1;
+        }
+    }
+    return 1;
+}
+
+// Orientations as in the TIFF tag: 2 mirrors, 3 rotates by 180 degrees, 4 flips, 5 transposes,
+// 6 rotates clockwise, 7 transposes across the other diagonal and 8 rotates counterclockwise.
+bool Mirrors(int orientation) {
+    return orientation == 2 || orientation == 3 || orientation == 7 || orientation == 8;
+}
+
+// Stores row `y` of a `height` rows tall image turned by orientation 2, 3 or 4.
+template <size_t Bytes>
+void StoreFlipped(const uint8_t* pixels, int width, int height, int y, int orientation,
+                  Image& image, int plane) {
+    bool mirror = Mirrors(orientation), flip = orientation == 3 || orientation == 4;
+    uint8_t* out = image.Row(flip ? height - 1 - y : y, plane).data();
+    if (!mirror) {
+        std::memcpy(out, pixels, width * Bytes);
+        return;
+    }
+    for (int x = 0; x < width; x++) {
+        std::memcpy(out + (width - 1 - x) * Bytes, pixels + x * Bytes, Bytes);
+    }
+}
+
+// Stores `rows` rows starting at row `y` of a `height` rows tall image, `stride` bytes apart in
+// `band`, turned by orientation 5 to 8. Each column of the band becomes a run of pixels in one
+// output row.
+template <size_t Bytes>
+void StoreTransposed(const uint8_t* band, size_t stride, int width, int height, int y, int rows,
+                     int orientation, Image& image, int plane) {
+    bool mirror = Mirrors(orientation), reverse = orientation == 6 || orientation == 7;
+    int column = reverse ? height - y - rows : y;
+    for (int x = 0; x < width; x++) {
+        uint8_t* out = image.Row(mirror ? width - 1 - x : x, plane).data() + column * Bytes;
+        for (int k = 0; k < rows; k++) {
+            const uint8_t* pixel = band + (reverse ? rows - 1 - k : k) * stride + x * Bytes;
+            std::memcpy(out + k * Bytes, pixel, Bytes);
+        }
     }
-    if (static_cast<unsigned char>(bytes[0]) != 0xff) {
+}
+
+}  // namespace
+
+Sector JpegDecoder::ParseMarker() {
+    auto bytes = ParseBytes(2);
+    if (bytes[0] != 0xff) {
         return Sector::UNDEF;
     }
-    switch (static_cast<unsigned char>(bytes[1])) {
+    marker_ = bytes[1];
+    switch (bytes[1]) {
         case 0x00:
             return Sector::SKIP;
         case 0xd8:
             return Sector::SOI;
         case 0xc0:
             return Sector::SOF0;
+        case 0xc2:
+            return Sector::SOF2;
         case 0xc4:
             return Sector::DHT;
         case 0xdb:
             return Sector::DQT;
+        case 0xdd:
+            return Sector::DRI;
         case 0xda:
             return Sector::SOS;
         case 0xe0:
@@ -53,22 +164,22 @@ Sector JpegDecoder::ParseMarker() {
     }
 }
 
-int JpegDecoder::Parse1Byte() {
-    char bytes[1];
-    is_.read(bytes, 1);
-    if (is_.gcount() == 0) {
-        throw std::runtime_error("Unexpected EOF");
+std::span<const uint8_t> JpegDecoder::ParseBytes(size_t count) {
+    if (data_.size() - pos_ < count) {
+        throw UnexpectedEof();
     }
-    return static_cast<uint8_t>(bytes[0]);
+    auto bytes = data_.subspan(pos_, count);
+    pos_ += count;
+    return bytes;
+}
+
+int JpegDecoder::Parse1Byte() {
+    return ParseBytes(1)[0];
 }
 
 int JpegDecoder::Parse2Bytes() {
-    char bytes[2];
-    is_.read(bytes, 2);
-    if (is_.gcount() < 2) {
-        throw std::runtime_error("Unexpected EOF");
-    }
-    return static_cast<uint8_t>(bytes[0]) * 256 + static_cast<uint8_t>(bytes[1]);
+    auto bytes = ParseBytes(2);
+    return bytes[0] * 256 + bytes[1];
 }
 
 int JpegDecoder::ParseLength() {
@@ -81,19 +192,10 @@ int JpegDecoder::ParseLength() {
 }
 
 void JpegDecoder::ParseCOM() {
-    int length = ParseLength();
-    std::string comm;
-    char buffer[128];
-    while (length > 0) {
-        int cnt = std::min(128, length);
-        is_.read(buffer, cnt);
-        if (is_.gcount() < cnt) {
-            throw std::runtime_error("Unexpected EOF");
-        }
-        comm.insert(comm.size(), buffer, cnt);
-        length -= cnt;
-    }
-    result_.SetComment(comm);
+    size_t length = ParseLength();
+    info_.comment = SegmentLocation{marker_, discarded_ + pos_, length};
+    auto bytes = ParseBytes(length);
+    comment_.assign(bytes.begin(), bytes.end());
 }
 
 void JpegDecoder::ParseSOF0() {
@@ -104,6 +206,15 @@ void JpegDecoder::ParseSOF0() {
     }
     height_ = Parse2Bytes();
     width_ = Parse2Bytes();
+    uint64_t max_pixels = options_.limits.max_pixels;
+    if (max_pixels && uint64_t(width_) * height_ > max_pixels) {
+        throw LimitExceeded(DecodeLimit::Pixels);
+    }
+    info_.precision = precision;
+    info_.progressive = progressive_;
+    info_.height = height_;
+    info_.width = width_;
+    info_.components.clear();
     int channels = Parse1Byte();
     if (length != (channels == 3 ? 15 : 9)) {
         throw std::runtime_error("Unsupported format 2");
@@ -111,7 +222,7 @@ void JpegDecoder::ParseSOF0() {
     if (channels != 3 && channels != 1) {
         throw std::runtime_error("Unsupported format 3");
     }
-    int max_h = 1, max_v = 1;
+    int max_h = 1, max_v = 1, blocks = 0;
     for (int i = 0; i < channels; i++) {
         int id = Parse1Byte();
         if (id != i + 1) {
@@ -122,40 +233,39 @@ void JpegDecoder::ParseSOF0() {
         if (table_id > 1) {
             throw std::runtime_error("Unsupported format 5");
         }
-        max_h = std::max(max_h, hv / 16);
-        max_v = std::max(max_v, hv % 16);
-        channels_[i] = {hv / 16, hv % 16, table_id};
-    }
-    for (int i = 0; i < channels; i++) {
-        channels_[i].horizontal_ = max_h / channels_[i].horizontal_;
-        channels_[i].vertical_ = max_v / channels_[i].vertical_;
+        int h = hv / 16, v = hv % 16;
+        if (h < 1 || h > 4 || v < 1 || v > 4) {
+            throw std::runtime_error("Unsupported format 6");
+        }
+        info_.components.push_back({id, h, v, table_id});
+        max_h = std::max(max_h, h);
+        max_v = std::max(max_v, v);
+        blocks += h * v;
+        channels_[i] = {h, v, table_id};
     }
     monochrome_ = (channels == 1);
     if (monochrome_) {
+        // A single-component scan is not interleaved: its MCU is one block whatever the factors.
+        channels_[0].horizontal_ = channels_[0].vertical_ = 1;
         mcu_height_ = 8;
         mcu_width_ = 8;
-    } else {
-        if (channels_[1].horizontal_ != channels_[2].horizontal_) {
-            throw std::runtime_error("Unsupported format 6");
-        }
-        if (channels_[1].horizontal_ == 1) {
-            mcu_width_ = 8;
-        } else if (channels_[1].horizontal_ == 2) {
-            mcu_width_ = 16;
-        } else {
-            throw std::runtime_error("Unsupported format 7");
-        }
-        if (channels_[1].vertical_ != channels_[2].vertical_) {
-            throw std::runtime_error("Unsupported format 8");
-        }
-        if (channels_[1].vertical_ == 1) {
-            mcu_height_ = 8;
-        } else if (channels_[1].vertical_ == 2) {
-            mcu_height_ = 16;
-        } else {
-            throw std::runtime_error("Unsupported format 9");
-        }
+        return;
+    }
+    if (blocks > 10) {
+        throw std::runtime_error("Unsupported format 7");
+    }
+    // Luma is stored at full resolution and both chroma components are upsampled alike by
+    // whole factors.
+    if (channels_[0].horizontal_ != max_h || channels_[0].vertical_ != max_v) {
+        throw std::runtime_error("Unsupported format 8");
+    }
+    if (channels_[1].horizontal_ != channels_[2].horizontal_ ||
+        channels_[1].vertical_ != channels_[2].vertical_ ||
+        max_h % channels_[1].horizontal_ != 0 || max_v % channels_[1].vertical_ != 0) {
+        throw std::runtime_error("Unsupported format 9");
     }
+    mcu_width_ = 8 * max_h;
+    mcu_height_ = 8 * max_v;
 }
 
 void JpegDecoder::ParseDQT() {
@@ -204,8 +314,12 @@ void JpegDecoder::ParseDHT() {
         if (id > 1 || type > 1) {
             throw std::runtime_error("Unsupported format 12");
         }
+        // Progressive images may redefine tables between scans.
         if (!dht_[type][id].IsEmpty()) {
-            throw std::runtime_error("Wrong DHT id");
+            if (!progressive_) {
+                throw std::runtime_error("Wrong DHT id");
+            }
+            dht_[type][id].Clear();
         }
         if (length < 16) {
             throw std::runtime_error("Unsupported format 13");
@@ -241,150 +355,700 @@ void JpegDecoder::ParseSOS() {
     if (mcu_height_ == -1) {
         throw std::runtime_error("No SOF0 was parsed");
     }
+    int channels = monochrome_ ? 1 : 3;
     int length = ParseLength();
-    if (length != (monochrome_ ? 6 : 10)) {
+    if (!progressive_ && length != 4 + 2 * channels) {
         throw std::runtime_error("Unsupported format 14");
     }
+    // A baseline scan holds every component; a progressive one may hold any of them in frame
+    // order.
     int cnt = Parse1Byte();
-    if (cnt != (monochrome_ ? 1 : 3)) {
+    if (progressive_ ? cnt < 1 || cnt > channels : cnt != channels) {
         throw std::runtime_error("Unsupported format 15");
     }
-    int dc_idx[3];
-    int ac_idx[3];
-    for (int k = 0; k < (monochrome_ ? 1 : 3); k++) {
+    if (length != 4 + 2 * cnt) {
+        throw std::runtime_error("Unsupported format 14");
+    }
+    for (int k = 0; k < cnt; k++) {
         int num = Parse1Byte();
-        if (num != k + 1) {
+        int previous = k > 0 ? scan_components_[k - 1] + 1 : 0;
+        if (progressive_ ? num <= previous || num > channels : num != k + 1) {
             throw std::runtime_error("Unsupported format 16");
         }
+        int c = num - 1;
+        scan_components_[k] = c;
         int info = Parse1Byte();
-        dc_idx[k] = info / 16;
-        ac_idx[k] = info % 16;
-        if (dc_idx[k] > 1 || ac_idx[k] > 1) {
+        dc_idx_[c] = info / 16;
+        ac_idx_[c] = info % 16;
+        if (dc_idx_[c] > 1 || ac_idx_[c] > 1) {
             throw std::runtime_error("Wrong AC/DC table id");
         }
     }
+    scan_count_ = cnt;
     int b1 = Parse1Byte();
     int b2 = Parse1Byte();
     int b3 = Parse1Byte();
-    if (b1 != 0 || b2 != 63 || b3 != 0) {
-        throw std::runtime_error("Unsupported format");
-    }
-    int i = 0, j = 0;
-    int blocks_in_line = (width_ + mcu_width_ - 1) / mcu_width_;
-    int blocks_in_col = (height_ + mcu_height_ - 1) / mcu_height_;
-    int v_blocks = (mcu_height_ / 8), h_blocks = (mcu_width_ / 8);
-    y_img_.resize(blocks_in_col * v_blocks, std::vector<Block>(blocks_in_line * h_blocks));
-    if (!monochrome_) {
-        cb_img_.resize(blocks_in_col, std::vector<Block>(blocks_in_line));
-        cr_img_.resize(blocks_in_col, std::vector<Block>(blocks_in_line));
-    }
-    BitReader reader(is_);
-    int last_dc_y = 0, last_dc_cb = 0, last_dc_cr = 0;
-    while (i < blocks_in_col) {
-        int temp_i = i * v_blocks, temp_j = j * h_blocks;
-        ParseMatrix(reader, y_img_[temp_i][temp_j].table_, dc_idx[0], ac_idx[0]);
-        y_img_[temp_i][temp_j].table_[0][0] += last_dc_y;
-        last_dc_y = y_img_[temp_i][temp_j].table_[0][0];
-        if (h_blocks == 2) {
-            ParseMatrix(reader, y_img_[temp_i][temp_j + 1].table_, dc_idx[0], ac_idx[0]);
-            y_img_[temp_i][temp_j + 1].table_[0][0] += last_dc_y;
-            last_dc_y = y_img_[temp_i][temp_j + 1].table_[0][0];
-        }
-        if (v_blocks == 2) {
-            ParseMatrix(reader, y_img_[temp_i + 1][temp_j].table_, dc_idx[0], ac_idx[0]);
-            y_img_[temp_i + 1][temp_j].table_[0][0] += last_dc_y;
-            last_dc_y = y_img_[temp_i + 1][temp_j].table_[0][0];
-        }
-        if (h_blocks * v_blocks == 4) {
-            ParseMatrix(reader, y_img_[temp_i + 1][temp_j + 1].table_, dc_idx[0], ac_idx[0]);
-            y_img_[temp_i + 1][temp_j + 1].table_[0][0] += last_dc_y;
-            last_dc_y = y_img_[temp_i + 1][temp_j + 1].table_[0][0];
-        }
-        if (!monochrome_) {
-            ParseMatrix(reader, cb_img_[i][j].table_, dc_idx[1], ac_idx[1]);
-            cb_img_[i][j].table_[0][0] += last_dc_cb;
-            last_dc_cb = cb_img_[i][j].table_[0][0];
-            ParseMatrix(reader, cr_img_[i][j].table_, dc_idx[2], ac_idx[2]);
-            cr_img_[i][j].table_[0][0] += last_dc_cr;
-            last_dc_cr = cr_img_[i][j].table_[0][0];
-        }
-        j++;
-        if (j == blocks_in_line) {
-            j = 0;
-            i++;
-        }
-    }
-}
-
-JpegDecoder::JpegDecoder(std::istream& is) : is_(is) {
-}
-
-void JpegDecoder::ParseMatrix(BitReader& reader, int (&matrix)[8][8], int dc_idx, int ac_idx) {
-    int dc = 0;
-    auto start = dht_[0][dc_idx].Begin();
-    while (start.GetValue() == -1) {
-        start.Increment(reader.Read());
-    }
-    if (start.GetValue() != 0) {
-        dc = reader.ReadN(start.GetValue());
-    }
-    ZigZagWriter writer(matrix);
-    writer.Write(dc);
-    int idx = 1;
-    while (idx < 64) {
-        auto it = dht_[1][ac_idx].Begin();
-        while (it.GetValue() == -1) {
-            it.Increment(reader.Read());
-        }
-        int zero_cnt = 64 - idx;
-        int ac = -1;
-        if (it.GetValue() != 0) {
-            zero_cnt = it.GetValue() / 16;
-            int coef_len = it.GetValue() % 16;
-            ac = reader.ReadN(coef_len);
-        }
-        for (int k = 0; k < zero_cnt; k++) {
-            writer.Write(0);
-            idx++;
-        }
-        if (idx != 64) {
-            writer.Write(ac);
-            idx++;
+    if (!progressive_) {
+        if (b1 != 0 || b2 != 63 || b3 != 0) {
+            throw std::runtime_error("Unsupported format");
+        }
+        return;
+    }
+    spectral_start_ = b1;
+    spectral_end_ = b2;
+    approx_high_ = b3 / 16;
+    approx_low_ = b3 % 16;
+    // DC and AC coefficients never share a scan, and AC scans hold a single component.
+    if (b1 > b2 || b2 > 63 || (b1 == 0 && b2 != 0) || (b1 > 0 && cnt != 1) ||
+        approx_high_ > 13 || approx_low_ > 13) {
+        throw std::runtime_error("Invalid progressive scan");
+    }
+    // The first scan is set up by InitScan.
+    if (reader_) {
+        reader_.emplace(data_, pos_);
+        scan_start_ = discarded_ + pos_;
+    }
+}
+
+void JpegDecoder::InitScan() {
+    StageTimer timer(options_.stats, &DecodeStats::setup_time);
+    mcus_in_line_ = (width_ + mcu_width_ - 1) / mcu_width_;
+    mcus_in_col_ = (height_ + mcu_height_ - 1) / mcu_height_;
+    int v_blocks = mcu_height_ / 8, h_blocks = mcu_width_ / 8;
+    int out_mcu_width = h_blocks * block_size_, out_mcu_height = v_blocks * block_size_;
+    int scaled_width = (width_ * block_size_ + 7) / 8;
+    int scaled_height = (height_ * block_size_ + 7) / 8;
+    Rect region = options_.region.value_or(Rect{0, 0, size_t(scaled_width), size_t(scaled_height)});
+    if (region.width == 0 || region.height == 0 || region.x + region.width > size_t(scaled_width) ||
+        region.y + region.height > size_t(scaled_height)) {
+        throw std::runtime_error("Invalid region");
+    }
+    region_x_ = region.x;
+    region_y_ = region.y;
+    out_width_ = region.width;
+    out_height_ = region.height;
+    luma_only_ = monochrome_ || options_.format == PixelFormat::Gray8;
+    // As in libjpeg, DC-only blocks are replicated rather than interpolated.
+    fancy_ = options_.fancy_upsampling && block_size_ > 1 && !luma_only_;
+    chroma_block_size_ = block_size_;
+    // Chroma that is not reconstructed takes no blocks.
+    int chroma_h = luma_only_ ? 0 : channels_[1].horizontal_;
+    int chroma_v = luma_only_ ? 0 : channels_[1].vertical_;
+    h_factor_ = luma_only_ ? 1 : h_blocks / chroma_h;
+    v_factor_ = luma_only_ ? 1 : v_blocks / chroma_v;
+    // Same rule as libjpeg: double the chroma IDCT size while both factors stay integral.
+    while (chroma_block_size_ * 2 <= (fancy_ ? 8 : 4) && h_factor_ % 2 == 0 &&
+           v_factor_ % 2 == 0) {
+        chroma_block_size_ *= 2;
+        h_factor_ /= 2;
+        v_factor_ /= 2;
+    }
+    // Like libjpeg, larger factors are always replicated.
+    fancy_ = fancy_ && h_factor_ <= 2 && v_factor_ <= 2;
+    // Only MCU columns and rows under the region are stored, plus one more on each side for
+    // the upsampling filters.
+    int margin = fancy_ ? 1 : 0;
+    first_mcu_col_ = std::max(region_x_ / out_mcu_width - margin, 0);
+    mcu_cols_ = std::min((region_x_ + out_width_ - 1) / out_mcu_width + 1 + margin,
+                         mcus_in_line_) - first_mcu_col_;
+    // Any later scan may refine any block, so a progressive image keeps all of them.
+    if (progressive_) {
+        first_mcu_col_ = 0;
+        mcu_cols_ = mcus_in_line_;
+    }
+    plane_x_ = region_x_ - first_mcu_col_ * out_mcu_width;
+    first_mcu_row_ = region_y_ / out_mcu_height;
+    last_mcu_row_ = (region_y_ + out_height_ - 1) / out_mcu_height + 1;
+    if (!luma_only_) {
+        int h_scale = 8 * h_blocks / chroma_h, v_scale = 8 * v_blocks / chroma_v;
+        int chroma_width = (width_ * chroma_block_size_ + h_scale - 1) / h_scale;
+        int mcu_chroma_width = chroma_h * chroma_block_size_;
+        chroma_width_ = std::min(chroma_width - first_mcu_col_ * mcu_chroma_width,
+                                 mcu_cols_ * mcu_chroma_width);
+        chroma_height_ = (height_ * chroma_block_size_ + v_scale - 1) / v_scale;
+        fancy_ = fancy_ && chroma_width > 2;
+    }
+    bool fancy_vertical = fancy_ && !luma_only_ && v_factor_ == 2;
+    // The shared pool has a worker per core besides the caller; it is only started below, once
+    // a threaded path is taken.
+    size_t pool_workers = options_.pool ? options_.pool->Size() - 1 : ThreadPool::WorkersFor(0);
+    size_t workers = std::min(ThreadPool::WorkersFor(options_.threads), pool_workers);
+    parallel_ = whole_image_ && !progressive_ && restart_interval_ > 0 &&
+                mcus_in_line_ * mcus_in_col_ > restart_interval_ && workers > 0;
+    workers = std::min<size_t>(workers, (last_mcu_row_ - first_mcu_row_) / kRowsPerWorker);
+    pipelined_ = whole_image_ && !progressive_ && !parallel_ && !keep_coefficients_ && workers > 0;
+    bool all_rows = parallel_ || progressive_ || keep_coefficients_;
+    banded_ = whole_image_ && all_rows && !keep_coefficients_ && workers > 0;
+    slots_ = all_rows ? mcus_in_col_ : fancy_vertical ? 2 : 1;
+    if (pipelined_) {
+        // Room for a row in the hands of every worker and as many decoded ahead of them.
+        slots_ = std::min<int>(mcus_in_col_, 2 * workers + 4);
+    }
+    size_t reconstructions = pipelined_ || banded_ ? workers + 1 : 1;
+    ring_bands_ = fancy_vertical ? 3 : 1;
+    size_t chroma_lines = luma_only_ ? 0 : slots_;
+    CoefficientArena::Extent chroma = {chroma_lines * chroma_v, size_t(mcu_cols_ * chroma_h)};
+    CoefficientArena::Extent extents[] = {
+        {size_t(slots_ * v_blocks), size_t(mcu_cols_ * h_blocks)}, chroma, chroma};
+    // Peak memory: the coefficients, the sample planes, upsampled chroma rows and turned bands
+    // of every thread reconstructing rows, the restart interval offsets and the output. Decode
+    // writes the whole image, the scanline interface one MCU row, and ReadCoefficients copies
+    // out every block.
+    size_t coefficient_bytes = CoefficientArena::BytesFor(extents);
+    size_t luma_stride = size_t(mcu_cols_) * out_mcu_width;
+    size_t sample_bytes = luma_stride * (out_mcu_height + 2);
+    if (!luma_only_) {
+        size_t chroma_width = mcu_cols_ * chroma_h * chroma_block_size_;
+        sample_bytes += 2 * chroma_width * ring_bands_ * chroma_v * chroma_block_size_;
+    }
+    if (options_.apply_orientation && info_.orientation != 1) {
+        sample_bytes += size_t(out_width_) * BytesPerPixel(options_.format) * out_mcu_height *
+                        PlaneCount(options_.format);
+    }
+    sample_bytes *= reconstructions;
+    size_t interval_bytes = 0;
+    if (parallel_) {
+        size_t mcus = size_t(mcus_in_line_) * mcus_in_col_;
+        interval_bytes = (mcus + restart_interval_ - 1) / restart_interval_ * sizeof(size_t);
+    }
+    PixelFormat format = options_.format;
+    size_t row_bytes = (out_width_ * BytesPerPixel(format) + Image::kAlignment - 1) /
+                       Image::kAlignment * Image::kAlignment;
+    size_t output_rows = whole_image_ ? out_height_ : std::min(out_mcu_height, out_height_);
+    size_t output_bytes = row_bytes * output_rows * PlaneCount(format);
+    if (keep_coefficients_) {
+        output_bytes = coefficient_bytes;
+    }
+    memory_estimate_ = sizeof(JpegDecoder) + coefficient_bytes + sample_bytes + interval_bytes +
+                       output_bytes;
+    if (options_.limits.max_memory && memory_estimate_ > options_.limits.max_memory) {
+        throw LimitExceeded(DecodeLimit::Memory);
+    }
+    if (estimate_only_) {
+        return;
+    }
+    pool_ = parallel_ || pipelined_ || banded_ ? &ThreadPool::For(options_.pool, options_.threads)
+                                               : nullptr;
+    coefficients_.Init(extents);
+    if (progressive_) {
+        coefficients_.Clear();
+    }
+    contexts_.resize(reconstructions);
+    for (Reconstruction& context : contexts_) {
+        Plane* planes = context.planes_;
+        InitPlane(planes[0], mcu_cols_ * out_mcu_width, out_mcu_height);
+        if (!luma_only_) {
+            int width = chroma_h * chroma_block_size_, height = chroma_v * chroma_block_size_;
+            InitPlane(planes[1], mcu_cols_ * width, ring_bands_ * height);
+            InitPlane(planes[2], mcu_cols_ * width, ring_bands_ * height);
+            context.cb_row_.resize(planes[0].stride_);
+            context.cr_row_.resize(planes[0].stride_);
+        } else {
+            context.cb_row_.assign(planes[0].stride_, 128);
+            context.cr_row_.assign(planes[0].stride_, 128);
+        }
+        std::fill_n(context.chroma_rows_, 3, -1);
+        // Threads add their timings up apart from each other until the image is done.
+        bool threaded = pipelined_ || banded_;
+        context.stats_ = threaded && options_.stats ? &context.timings_ : options_.stats;
+    }
+    decode_mcus_ = &JpegDecoder::DecodeMcus<0, 0, 0, 0>;
+    if (monochrome_) {
+        decode_mcus_ = &JpegDecoder::DecodeMcus<1, 1, 0, 0>;
+    } else if (channels_[1].horizontal_ == 1 && channels_[1].vertical_ == 1) {
+        if (h_blocks == 1 && v_blocks == 1) {
+            decode_mcus_ = &JpegDecoder::DecodeMcus<1, 1, 1, 1>;
+        } else if (h_blocks == 2 && v_blocks == 1) {
+            decode_mcus_ = &JpegDecoder::DecodeMcus<2, 1, 1, 1>;
+        } else if (h_blocks == 2 && v_blocks == 2) {
+            decode_mcus_ = &JpegDecoder::DecodeMcus<2, 2, 1, 1>;
+        }
+    }
+    for (int k = 0; k < (luma_only_ ? 1 : 3); k++) {
+        idct_.BuildTable(qtables_[channels_[k].table_id_], &idct_tables_[k]);
+        last_dc_[k] = 0;
+    }
+    mcu_row_ = first_mcu_row_;
+    decoded_rows_ = 0;
+    coefficients_ready_ = progressive_;
+    reader_.emplace(data_, pos_);
+    scan_start_ = discarded_ + pos_;
+    CountMemory();
+}
+
+void JpegDecoder::ParseDRI() {
+    if (ParseLength() != 2) {
+        throw std::runtime_error("Invalid length");
+    }
+    restart_interval_ = Parse2Bytes();
+    info_.restart_interval = restart_interval_;
+}
+
+template <int LumaH, int LumaV, int ChromaH, int ChromaV>
+void JpegDecoder::DecodeMcus(BitReader& reader, int first, int last, int (&last_dc)[3],
+                             ScanCounters& counters) {
+    // Zero luma factors select the generic loop, which takes every factor from the frame header.
+    constexpr bool kGeneric = LumaH == 0;
+    const int components = kGeneric ? (monochrome_ ? 1 : 3) : (ChromaH ? 3 : 1);
+    const int factors[2][2] = {
+        {kGeneric ? channels_[0].horizontal_ : LumaH, kGeneric ? channels_[0].vertical_ : LumaV},
+        {kGeneric ? channels_[1].horizontal_ : ChromaH,
+         kGeneric ? channels_[1].vertical_ : ChromaV}};
+    for (int mcu = first; mcu < last; mcu++) {
+        counters.CountMcu();
+        int row = mcu / mcus_in_line_, j = mcu % mcus_in_line_ - first_mcu_col_;
+        int slot = row % slots_;
+        // Blocks outside the region only advance the DC predictors. The row above the region
+        // is kept for vertical upsampling. Chroma that is not reconstructed is only
+        // entropy-decoded to stay in sync with the bitstream.
+        bool stored = j >= 0 && j < mcu_cols_ && row + 1 >= first_mcu_row_ && row <= last_mcu_row_;
+        for (int c = 0; c < components; c++) {
+            auto [h, v] = factors[c > 0];
+            if (!stored || (c > 0 && luma_only_)) {
+                for (int k = 0; k < h * v; k++) {
+                    last_dc[c] += SkipMatrix(reader, dc_idx_[c], ac_idx_[c], counters);
+                }
+                continue;
+            }
+            for (int bi = 0; bi < v; bi++) {
+                for (int bj = 0; bj < h; bj++) {
+                    int line = slot * v + bi, column = j * h + bj;
+                    int16_t* coef = coefficients_.Block(c, line, column);
+                    ParseMatrix(reader, coef, coefficients_.Last(c, line, column), dc_idx_[c],
+                                ac_idx_[c], counters);
+                    last_dc[c] += coef[0];
+                    coef[0] = last_dc[c];
+                }
+            }
+        }
+    }
+}
+
+void JpegDecoder::DecodeMcuRow(int row) {
+    StageTimer timer(options_.stats, &DecodeStats::entropy_time);
+    ScanCounters counters;
+    // When the data runs out in the middle of the row, the row is decoded again from its start
+    // once more data arrives.
+    BitReader reader = *reader_;
+    int last_dc[3] = {last_dc_[0], last_dc_[1], last_dc_[2]};
+    int end = (row + 1) * mcus_in_line_;
+    try {
+        for (int mcu = row * mcus_in_line_; mcu < end;) {
+            int next = end;
+            if (restart_interval_ > 0) {
+                if (mcu > 0 && mcu % restart_interval_ == 0) {
+                    Restart(mcu / restart_interval_ - 1);
+                }
+                next = std::min(end, (mcu / restart_interval_ + 1) * restart_interval_);
+            }
+            (this->*decode_mcus_)(*reader_, mcu, next, last_dc_, counters);
+            mcu = next;
+        }
+        CheckLimits(reader_->Position());
+    } catch (const UnexpectedEof&) {
+        reader_ = reader;
+        std::copy_n(last_dc, 3, last_dc_);
+        throw;
+    }
+    counters.AddTo(options_.stats);
+}
+
+void JpegDecoder::Restart(int index) {
+    size_t pos = FindMarker(data_, reader_->Finish());
+    if (pos == data_.size()) {
+        throw UnexpectedEof();
+    }
+    if (data_[pos + 1] != 0xd0 + index % 8) {
+        throw std::runtime_error("Invalid restart marker");
+    }
+    reader_.emplace(data_, pos + 2);
+    std::fill(last_dc_, last_dc_ + 3, 0);
+    eobrun_ = 0;
+}
+
+// Locates every RSTn up front and decodes the intervals concurrently, each with its own reader
+// and DC predictors, into coefficient slots that cover the whole image.
+void JpegDecoder::DecodeIntervals() {
+    StageTimer timer(options_.stats, &DecodeStats::entropy_time);
+    int total = mcus_in_line_ * mcus_in_col_;
+    int intervals = (total + restart_interval_ - 1) / restart_interval_;
+    std::vector<size_t> starts(intervals, pos_);
+    for (int i = 1; i < intervals; i++) {
+        size_t pos = FindMarker(data_, starts[i - 1]);
+        if (pos == data_.size() || data_[pos + 1] != 0xd0 + (i - 1) % 8) {
+            throw std::runtime_error("Invalid restart marker");
+        }
+        starts[i] = pos + 2;
+    }
+    CheckLimits(starts.back());
+    // Intervals that do not touch the stored rows are not decoded at all.
+    int needed_first = std::max(first_mcu_row_ - 1, 0) * mcus_in_line_;
+    int needed_last = std::min(last_mcu_row_ + 1, mcus_in_col_) * mcus_in_line_;
+    size_t participants = ThreadPool::WorkersFor(options_.threads) + 1;
+    pool_->ParallelFor(intervals, [&](size_t i, size_t) {
+        int first = i * restart_interval_;
+        int last = std::min(first + restart_interval_, total);
+        if (last <= needed_first || first >= needed_last) {
+            return;
+        }
+        BitReader reader(data_, starts[i]);
+        int last_dc[3] = {};
+        ScanCounters counters;
+        (this->*decode_mcus_)(reader, first, last, last_dc, counters);
+        counters.AddTo(options_.stats);
+        CheckLimits(starts[i]);
+    }, participants);
+    reader_.emplace(data_, FindMarker(data_, starts.back()));
+    coefficients_ready_ = true;
+}
+
+// A scan of several components is made of MCUs as in baseline; a scan of one component visits
+// its blocks that cover the image in raster order, one block per MCU.
+template <class DecodeBlock>
+void JpegDecoder::ForEachScanBlock(ScanCounters& counters, const DecodeBlock& decode_block) {
+    int rows = mcus_in_col_, columns = mcus_in_line_;
+    if (scan_count_ == 1) {
+        const ChannelInfo& channel = channels_[scan_components_[0]];
+        int max_h = mcu_width_ / 8, max_v = mcu_height_ / 8;
+        int width = (width_ * channel.horizontal_ + max_h - 1) / max_h;
+        int height = (height_ * channel.vertical_ + max_v - 1) / max_v;
+        columns = (width + 7) / 8;
+        rows = (height + 7) / 8;
+    }
+    eobrun_ = 0;
+    std::fill(last_dc_, last_dc_ + 3, 0);
+    for (int mcu = 0; mcu < rows * columns; mcu++) {
+        if (restart_interval_ > 0 && mcu > 0 && mcu % restart_interval_ == 0) {
+            Restart(mcu / restart_interval_ - 1);
+        }
+        counters.CountMcu();
+        int row = mcu / columns, column = mcu % columns;
+        if (column == 0) {
+            CheckLimits(reader_->Position());
+        }
+        if (scan_count_ == 1) {
+            decode_block(*reader_, scan_components_[0], row, column);
+            continue;
+        }
+        for (int k = 0; k < scan_count_; k++) {
+            int c = scan_components_[k];
+            int h = channels_[c].horizontal_, v = channels_[c].vertical_;
+            for (int bi = 0; bi < v; bi++) {
+                for (int bj = 0; bj < h; bj++) {
+                    decode_block(*reader_, c, row * v + bi, column * h + bj);
+                }
+            }
         }
     }
 }
 
+bool JpegDecoder::DecodeScan() {
+    StageTimer timer(options_.stats, &DecodeStats::entropy_time);
+    // Chroma that is not reconstructed is still needed to follow interleaved DC scans.
+    bool needed = !(options_.dc_only && spectral_start_ > 0) &&
+                  (scan_count_ > 1 || scan_components_[0] == 0 || !luma_only_);
+    if (!needed) {
+        pos_ = FindScanEnd(data_, pos_);
+    } else {
+        ScanCounters counters;
+        int low = approx_low_;
+        if (spectral_start_ == 0) {
+            ForEachScanBlock(counters, [&](BitReader& reader, int c, int line, int column) {
+                counters.CountBlock();
+                bool stored = c == 0 || !luma_only_;
+                if (approx_high_ == 0) {
+                    counters.CountDc();
+                    last_dc_[c] += dht_[0][dc_idx_[c]].ReadCoefficient(reader).value;
+                    if (stored) {
+                        coefficients_.Block(c, line, column)[0] = last_dc_[c] * (1 << low);
+                    }
+                } else if (reader.ReadBits(1) && stored) {
+                    coefficients_.Block(c, line, column)[0] |= 1 << low;
+                }
+            });
+        } else if (approx_high_ == 0) {
+            ForEachScanBlock(counters, [&](BitReader& reader, int c, int line, int column) {
+                counters.CountBlock();
+                if (eobrun_ > 0) {
+                    eobrun_--;
+                    return;
+                }
+                int16_t* coef = coefficients_.Block(c, line, column);
+                uint8_t& last = coefficients_.Last(c, line, column);
+                const auto& ac_table = dht_[1][ac_idx_[c]];
+                for (int k = spectral_start_; k <= spectral_end_; k++) {
+                    auto [symbol, value] = ac_table.ReadCoefficient(reader);
+                    counters.CountAc(symbol);
+                    int run = symbol / 16;
+                    if (symbol % 16 == 0) {
+                        if (run < 15) {
+                            eobrun_ = (1 << run) + reader.ReadBits(run) - 1;
+                            break;
+                        }
+                        k += 15;
+                        continue;
+                    }
+                    k += run;
+                    if (k > spectral_end_) {
+                        throw std::runtime_error("Huffman decoding failed");
+                    }
+                    coef[kZigZagOrder[k]] = value * (1 << low);
+                    last = std::max<int>(last, k);
+                }
+            });
+        } else {
+            // Successive approximation of AC coefficients, as in G.1.2.3 of the specification:
+            // nonzero coefficients get a correction bit, and new ones of magnitude one are placed
+            // after skipping the given number of zero coefficients.
+            int plus = 1 << low, minus = -plus;
+            ForEachScanBlock(counters, [&](BitReader& reader, int c, int line, int column) {
+                counters.CountBlock();
+                int16_t* coef = coefficients_.Block(c, line, column);
+                uint8_t& last = coefficients_.Last(c, line, column);
+                auto refine = [&](int16_t& value) {
+                    if (reader.ReadBits(1) && (value & plus) == 0) {
+                        value += value >= 0 ? plus : minus;
+                    }
+                };
+                int k = spectral_start_;
+                if (eobrun_ == 0) {
+                    const auto& ac_table = dht_[1][ac_idx_[c]];
+                    for (; k <= spectral_end_; k++) {
+                        auto [symbol, sign] = ac_table.ReadCoefficient(reader);
+                        counters.CountAc(symbol);
+                        int run = symbol / 16, size = symbol % 16, value = 0;
+                        if (size > 1) {
+                            throw std::runtime_error("Huffman decoding failed");
+                        }
+                        if (size == 1) {
+                            value = sign > 0 ? plus : minus;
+                        } else if (run < 15) {
+                            eobrun_ = (1 << run) + reader.ReadBits(run);
+                            break;
+                        }
+                        for (; k <= spectral_end_; k++) {
+                            int16_t& current = coef[kZigZagOrder[k]];
+                            if (current != 0) {
+                                refine(current);
+                            } else if (--run < 0) {
+                                break;
+                            }
+                        }
+                        if (value != 0) {
+                            if (k > spectral_end_) {
+                                throw std::runtime_error("Huffman decoding failed");
+                            }
+                            coef[kZigZagOrder[k]] = value;
+                            last = std::max<int>(last, k);
+                        }
+                    }
+                }
+                if (eobrun_ > 0) {
+                    for (; k <= spectral_end_; k++) {
+                        int16_t& current = coef[kZigZagOrder[k]];
+                        if (current != 0) {
+                            refine(current);
+                        }
+                    }
+                    eobrun_--;
+                }
+            });
+        }
+        counters.AddTo(options_.stats);
+        pos_ = reader_->Finish();
+    }
+    CountScan();
+    return needed;
+}
+
+JpegDecoder::JpegDecoder(std::span<const uint8_t> data, const DecodeOptions& options)
+    : data_(data), options_(options), idct_(options.idct_method), converter_(options.format) {
+    if (options.scale != 1 && options.scale != 2 && options.scale != 4 && options.scale != 8) {
+        throw std::runtime_error("Unsupported scale");
+    }
+    block_size_ = 8 / options.scale;
+}
+
+void JpegDecoder::Reset(std::span<const uint8_t> data) {
+    data_ = data;
+    pos_ = 0;
+    height_ = width_ = mcu_height_ = mcu_width_ = -1;
+    mcus_in_line_ = mcus_in_col_ = 0;
+    monochrome_ = false;
+    progressive_ = false;
+    q_id_ = 0;
+    restart_interval_ = 0;
+    whole_image_ = false;
+    keep_coefficients_ = estimate_only_ = false;
+    markers_ = segment_bytes_ = scan_bytes_ = 0;
+    parallel_ = pipelined_ = banded_ = false;
+    coefficients_ready_ = false;
+    for (auto& tables : dht_) {
+        for (auto& table : tables) {
+            table.Clear();
+        }
+    }
+    reader_.reset();
+    incremental_ = scans_done_ = false;
+    discarded_ = search_pos_ = retry_size_ = 0;
+    comment_.clear();
+    orientation_ = 1;
+    marker_ = 0;
+    probe_ = false;
+    info_.width = info_.height = info_.precision = info_.restart_interval = 0;
+    info_.progressive = false;
+    info_.orientation = 1;
+    info_.components.clear();
+    info_.app_segments.clear();
+    info_.comment.reset();
+}
+
+void JpegDecoder::ParseMatrix(BitReader& reader, int16_t* coef, uint8_t& last_index,
+                              int dc_idx, int ac_idx, ScanCounters& counters) {
+    counters.CountBlock();
+    counters.CountDc();
+    // Only coefficients up to the previous last index can be nonzero, so clearing those is enough.
+    // Until this block is complete, all of it counts as possibly nonzero.
+    for (int k = 0; k <= last_index; k++) {
+        coef[kZigZagOrder[k]] = 0;
+    }
+    last_index = 63;
+    coef[0] = dht_[0][dc_idx].ReadCoefficient(reader).value;
+    const auto& ac_table = dht_[1][ac_idx];
+    int last = 0;
+    for (int idx = 1; idx < 64; idx++) {
+        auto [symbol, ac] = ac_table.ReadCoefficient(reader);
+        counters.CountAc(symbol);
+        if (symbol == 0) {
+            break;
+        }
+        idx += symbol / 16;
+        if (idx > 64) {
+            throw std::runtime_error("Huffman decoding failed");
+        }
+        if (idx < 64 && ac != 0) {
+            coef[kZigZagOrder[idx]] = ac;
+            last = idx;
+        }
+    }
+    last_index = last;
+}
+
+int JpegDecoder::SkipMatrix(BitReader& reader, int dc_idx, int ac_idx,
+                            ScanCounters& counters) {
+    counters.CountBlock();
+    counters.CountDc();
+    int dc = dht_[0][dc_idx].ReadCoefficient(reader).value;
+    const auto& ac_table = dht_[1][ac_idx];
+    for (int idx = 1; idx < 64;) {
+        int symbol = ac_table.ReadCoefficient(reader).symbol;
+        counters.CountAc(symbol);
+        if (symbol == 0) {
+            break;
+        }
+        if (idx + symbol / 16 > 64) {
+            throw std::runtime_error("Huffman decoding failed");
+        }
+        idx += symbol / 16 + 1;
+    }
+    return dc;
+}
+
 void JpegDecoder::ParseAPP() {
-    int length = ParseLength();
-    char buffer[128];
-    while (length > 0) {
-        int cnt = std::min(128, length);
-        is_.read(buffer, cnt);
-        if (is_.gcount() < cnt) {
-            throw std::runtime_error("Unexpected EOF");
+    size_t length = ParseLength();
+    info_.app_segments.push_back({marker_, discarded_ + pos_, length});
+    auto payload = ParseBytes(length);
+    if (marker_ == 0xe1 && info_.orientation == 1) {
+        info_.orientation = ParseExifOrientation(payload);
+    }
+}
+
+void JpegDecoder::CountMarker(size_t start) {
+    const DecodeLimits& limits = options_.limits;
+    markers_++;
+    segment_bytes_ += pos_ - start;
+    if (limits.max_markers && markers_ > limits.max_markers) {
+        throw LimitExceeded(DecodeLimit::Markers);
+    }
+    if (limits.max_segment_bytes && segment_bytes_ > limits.max_segment_bytes) {
+        throw LimitExceeded(DecodeLimit::SegmentBytes);
+    }
+    if constexpr (kCollectStats) {
+        if (options_.stats) {
+            options_.stats->marker_bytes[marker_] += pos_ - start;
         }
-        length -= cnt;
     }
 }
 
-void JpegDecoder::Parse() {
-    Sector sect = ParseMarker();
-    if (sect != Sector::SOI) {
-        throw std::runtime_error("Unsupported format 17");
+void JpegDecoder::CheckLimits(size_t pos) const {
+    const DecodeLimits& limits = options_.limits;
+    size_t bytes = scan_bytes_ + discarded_ + pos - scan_start_;
+    if (limits.max_scan_bytes && bytes > limits.max_scan_bytes) {
+        throw LimitExceeded(DecodeLimit::ScanBytes);
     }
-    bool sof0 = false;
+    if (limits.deadline != std::chrono::steady_clock::time_point::max() &&
+        std::chrono::steady_clock::now() > limits.deadline) {
+        throw LimitExceeded(DecodeLimit::Deadline);
+    }
+}
+
+void JpegDecoder::CountScan() {
+    CheckLimits(pos_);
+    size_t bytes = discarded_ + pos_ - scan_start_;
+    scan_bytes_ += bytes;
+    if constexpr (kCollectStats) {
+        if (options_.stats) {
+            options_.stats->entropy_bytes += bytes;
+        }
+    }
+}
+
+void JpegDecoder::CountMemory() {
+    if constexpr (kCollectStats) {
+        if (DecodeStats* stats = options_.stats) {
+            size_t coefficients = coefficients_.Bytes();
+            size_t samples = 0;
+            for (const Reconstruction& context : contexts_) {
+                samples += context.cb_row_.capacity() + context.cr_row_.capacity();
+                for (const auto& plane : context.planes_) {
+                    samples += plane.data_.capacity();
+                }
+            }
+            stats->peak_coefficient_bytes = std::max(stats->peak_coefficient_bytes, coefficients);
+            stats->peak_sample_bytes = std::max(stats->peak_sample_bytes, samples);
+        }
+    }
+}
+
+bool JpegDecoder::ParseMarkers() {
+    bool first_scan = !reader_;
+    {
+        StageTimer timer(options_.stats, &DecodeStats::marker_time);
+        if (!ParseSegments()) {
+            return false;
+        }
+    }
+    // Setting up the first scan allocates the decoder's buffers, which is timed apart.
+    if (first_scan && !probe_) {
+        InitScan();
+    }
+    return true;
+}
+
+bool JpegDecoder::ParseSegments() {
     while (true) {
-        bool end = false;
-        sect = ParseMarker();
+        size_t start = pos_;
+        Sector sect = ParseMarker();
         switch (sect) {
             case Sector::SOI:
                 throw std::runtime_error("Unexpected marker");
             case Sector::SOF0:
-                if (sof0) {
+            case Sector::SOF2:
+                if (mcu_height_ != -1) {
                     throw std::runtime_error("Unexpected marker");
                 }
+                progressive_ = sect == Sector::SOF2;
                 ParseSOF0();
-                sof0 = true;
                 break;
             case Sector::DHT:
                 ParseDHT();
@@ -392,6 +1056,9 @@ void JpegDecoder::Parse() {
             case Sector::DQT:
                 ParseDQT();
                 break;
+            case Sector::DRI:
+                ParseDRI();
+                break;
             case Sector::APP:
                 ParseAPP();
                 break;
@@ -399,107 +1066,611 @@ void JpegDecoder::Parse() {
                 ParseCOM();
                 break;
             case Sector::SOS:
+                if (reader_ && !progressive_) {
+                    throw std::runtime_error("Unexpected marker");
+                }
+                if (probe_) {
+                    return true;
+                }
+                if (q_id_ != (monochrome_ ? 1 : 3)) {
+                    throw std::runtime_error("No sectors");
+                }
                 ParseSOS();
-                break;
+                CountMarker(start);
+                return true;
             case Sector::EOI:
-                end = true;
-                break;
+                CountMarker(start);
+                return false;
             case Sector::SKIP:
                 break;
             case Sector::UNDEF:
                 throw std::runtime_error("Unexpected marker");
         }
-        if (end) {
-            break;
-        }
+        CountMarker(start);
     }
-    if (!sof0) {
-        throw std::runtime_error("No sectors");
+}
+
+void JpegDecoder::ParseHeader() {
+    if (ParseMarker() != Sector::SOI) {
+        throw std::runtime_error("Unsupported format 17");
     }
-    if (monochrome_ && q_id_ != 1) {
+    CountMarker(0);
+    if (!ParseMarkers()) {
         throw std::runtime_error("No sectors");
     }
-    if (!monochrome_ && q_id_ != 3) {
-        throw std::runtime_error("No sectors");
+}
+
+void JpegDecoder::ReadHeader() {
+    ParseHeader();
+    if (progressive_ && !probe_) {
+        do {
+            DecodeScan();
+        } while (ParseMarkers());
+    } else if (parallel_) {
+        DecodeIntervals();
+    }
+}
+
+const JpegInfo& JpegDecoder::Probe() {
+    probe_ = true;
+    ReadHeader();
+    if (mcu_height_ == -1) {
+        throw std::runtime_error("No SOF0 was parsed");
     }
+    return info_;
 }
 
-void JpegDecoder::Calculate() {
-    for (auto& v : y_img_) {
-        for (auto& matrix : v) {
-            ProcessMatrix(matrix.table_, qtables_[channels_[0].table_id_]);
+int JpegDecoder::Width() const {
+    return out_width_;
+}
+
+int JpegDecoder::Height() const {
+    return out_height_;
+}
+
+int JpegDecoder::NextRowCount() const {
+    return mcu_row_ == last_mcu_row_ ? 0 : RowCount(mcu_row_);
+}
+
+int JpegDecoder::RowCount(int row) const {
+    int rows = mcu_height_ / 8 * block_size_;
+    return std::min((row + 1) * rows, region_y_ + out_height_) - std::max(row * rows, region_y_);
+}
+
+int JpegDecoder::OutputRow(int row) const {
+    return std::max(row * (mcu_height_ / 8 * block_size_) - region_y_, 0);
+}
+
+int JpegDecoder::ReadMcuRow(Image& image, int first_row) {
+    int rows = NextRowCount();
+    if (rows == 0) {
+        return 0;
+    }
+    Reconstruction& context = contexts_[0];
+    // Vertical fancy upsampling needs the chroma of the next MCU row as well.
+    int last_needed = std::min(mcu_row_ + (ring_bands_ > 1 ? 2 : 1), mcus_in_col_);
+    for (; decoded_rows_ < last_needed; decoded_rows_++) {
+        if (!coefficients_ready_) {
+            DecodeMcuRow(decoded_rows_);
         }
+        // The row's slot may be taken over before its chroma is needed for the last time.
+        if (!luma_only_ && decoded_rows_ + 1 >= mcu_row_) {
+            ProcessChroma(context, decoded_rows_);
+        }
+    }
+    ReconstructRow(context, image, mcu_row_, first_row);
+    // A progressive image's scans have all been parsed already, and incremental decoding waits
+    // for the markers to arrive.
+    if (++mcu_row_ == mcus_in_col_ && !progressive_ && !incremental_) {
+        EndScan();
+    }
+    return rows;
+}
+
+void JpegDecoder::ReconstructRow(Reconstruction& context, Image& image, int row, int first_row) {
+    if (!luma_only_) {
+        int margin = ring_bands_ > 1 ? 1 : 0;
+        for (int k = std::max(row - margin, 0); k <= std::min(row + margin, mcus_in_col_ - 1);
+             k++) {
+            ProcessChroma(context, k);
+        }
+    }
+    int v_blocks = mcu_height_ / 8;
+    ProcessPlane(context, 0, (row % slots_) * v_blocks, v_blocks, block_size_, 0);
+    Calculate(context, image, row, first_row, RowCount(row));
+}
+
+void JpegDecoder::ProcessChroma(Reconstruction& context, int row) {
+    int band = row % ring_bands_;
+    if (context.chroma_rows_[band] == row) {
+        return;
+    }
+    int size = chroma_block_size_, lines = channels_[1].vertical_;
+    for (int c = 1; c < 3; c++) {
+        ProcessPlane(context, c, (row % slots_) * lines, lines, size, band * lines * size);
+    }
+    context.chroma_rows_[band] = row;
+}
+
+void JpegDecoder::EndScan() {
+    pos_ = reader_->Finish();
+    CountScan();
+    if (ParseMarkers()) {
+        throw std::runtime_error("Unexpected marker");
+    }
+}
+
+void JpegDecoder::Extend(std::span<const uint8_t> data, size_t discarded) {
+    data_ = data;
+    // While a baseline scan is entropy-decoded pos_ still points at its start, which may be gone.
+    pos_ -= std::min(pos_, discarded);
+    search_pos_ -= std::min(search_pos_, discarded);
+    retry_size_ -= std::min(retry_size_, discarded);
+    discarded_ += discarded;
+    if (reader_) {
+        reader_->Resume(data, discarded);
+    }
+}
+
+size_t JpegDecoder::Retained() const {
+    if (!reader_) {
+        return 0;
+    }
+    // Progressive scans are decoded once all of their data is there.
+    return progressive_ ? pos_ : reader_->Position();
+}
+
+bool JpegDecoder::MarkersAvailable(size_t pos) const {
+    while (data_.size() - pos >= 2) {
+        int marker = data_[pos + 1];
+        pos += 2;
+        // Anything else than a marker is left for the parser to reject.
+        if (data_[pos - 2] != 0xff || marker == 0xd9) {
+            return true;
+        }
+        if (marker == 0xd8 || marker == 0x00) {
+            continue;
+        }
+        if (data_.size() - pos < 2) {
+            return false;
+        }
+        pos += data_[pos] * 256 + data_[pos + 1];
+        if (pos > data_.size()) {
+            return false;
+        }
+        if (marker == 0xda) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool JpegDecoder::ScanAvailable() {
+    size_t end = FindScanEnd(data_, std::max(pos_, search_pos_));
+    if (end == data_.size()) {
+        // The last byte may start a marker.
+        search_pos_ = std::max(data_.size(), size_t{1}) - 1;
+        return false;
     }
+    search_pos_ = end;
+    return MarkersAvailable(end);
+}
 
-    if (!monochrome_) {
-        for (auto& v : cb_img_) {
-            for (auto& matrix : v) {
-                ProcessMatrix(matrix.table_, qtables_[channels_[1].table_id_]);
+bool JpegDecoder::Poll(Image& band, const ScanlineCallback& callback, bool last) {
+    incremental_ = true;
+    if (!last && data_.size() < retry_size_) {
+        return false;
+    }
+    try {
+        if (!reader_) {
+            // Segments are parsed only once complete, so none is left half parsed.
+            if (!last && !MarkersAvailable(0)) {
+                return false;
+            }
+            ParseHeader();
+        }
+        while (progressive_ && !scans_done_) {
+            if (!last && !ScanAvailable()) {
+                return false;
+            }
+            // Refinement scans cannot be decoded twice, so a scan that has all its data is never
+            // left unfinished.
+            try {
+                DecodeScan();
+            } catch (const UnexpectedEof&) {
+                throw std::runtime_error("Unexpected EOF");
+            }
+            search_pos_ = 0;
+            scans_done_ = !ParseMarkers();
+        }
+        while (int rows = NextRowCount()) {
+            int first_row = OutputRow(mcu_row_);
+            band.SetSize(out_width_, rows, options_.format);
+            size_t start = reader_->Position();
+            try {
+                ReadMcuRow(band, 0);
+            } catch (const UnexpectedEof&) {
+                // Decoding the row again is put off until the data past its start has grown
+                // by half, which bounds the repeated work.
+                retry_size_ = data_.size() + (data_.size() - std::min(start, data_.size())) / 2;
+                throw;
+            }
+            callback(first_row, band);
+            // The next row is first attempted once as much data as this one took is there.
+            size_t end = reader_->Position();
+            retry_size_ = NextRowCount() ? end + (end - std::min(start, end)) : 0;
+            if (!last && data_.size() < retry_size_) {
+                return false;
+            }
+        }
+        // Decoding stops after the last row of a region; a whole image must be followed by EOI.
+        if (!progressive_ && mcu_row_ == mcus_in_col_) {
+            if (!last && !MarkersAvailable(reader_->Finish())) {
+                return false;
             }
+            EndScan();
+        }
+        return true;
+    } catch (const UnexpectedEof&) {
+        if (last) {
+            throw;
         }
+        return false;
+    }
+}
 
-        for (auto& v : cr_img_) {
-            for (auto& matrix : v) {
-                ProcessMatrix(matrix.table_, qtables_[channels_[2].table_id_]);
+void JpegDecoder::Calculate(Reconstruction& context, Image& image, int row, int first_row,
+                            int rows) {
+    StageTimer timer(context.stats_, &DecodeStats::color_time);
+    PixelFormat format = options_.format;
+    const Plane* planes = context.planes_;
+    int band_start = row * (mcu_height_ / 8 * block_size_);
+    int skipped = std::max(region_y_ - band_start, 0);
+    int ring_rows = luma_only_ ? 0 : ring_bands_ * channels_[1].vertical_ * chroma_block_size_;
+    const uint8_t* cb_row = context.cb_row_.data() + plane_x_;
+    const uint8_t* cr_row = context.cr_row_.data() + plane_x_;
+    for (int y = 0; y < rows; y++) {
+        int plane_row = skipped + y;
+        const uint8_t* y_row = &planes[0].data_[plane_row * planes[0].stride_ + plane_x_];
+        if (!luma_only_) {
+            int pos = band_start + plane_row;
+            int near = pos / v_factor_;
+            int far = std::clamp(pos % 2 == 0 ? near - 1 : near + 1, 0, chroma_height_ - 1);
+            for (int c = 1; c < 3; c++) {
+                const Plane& plane = planes[c];
+                const uint8_t* near_row = &plane.data_[(near % ring_rows) * plane.stride_];
+                const uint8_t* far_row =
+                    ring_bands_ > 1 ? &plane.data_[(far % ring_rows) * plane.stride_] : nullptr;
+                UpsampleRow(near_row, far_row, chroma_width_, h_factor_, fancy_,
+                            c == 1 ? context.cb_row_.data() : context.cr_row_.data());
+            }
+        }
+        switch (format) {
+            case PixelFormat::Gray8:
+                StoreRow(context, image, first_row, y, 0, y_row);
+                break;
+            case PixelFormat::YCbCrPlanar:
+                StoreRow(context, image, first_row, y, 0, y_row);
+                StoreRow(context, image, first_row, y, 1, cb_row);
+                StoreRow(context, image, first_row, y, 2, cr_row);
+                break;
+            default:
+                if (orientation_ == 1) {
+                    converter_.ConvertRow(y_row, cb_row, cr_row, image.Row(first_row + y).data(),
+                                          out_width_);
+                } else {
+                    uint8_t* out = BandRow(context, 0, y);
+                    converter_.ConvertRow(y_row, cb_row, cr_row, out, out_width_);
+                    StoreRow(context, image, first_row, y, 0, out);
+                }
+        }
+    }
+    if (orientation_ >= 5) {
+        for (int plane = 0; plane < int(PlaneCount(format)); plane++) {
+            const uint8_t* band = BandRow(context, plane, 0);
+            size_t stride = oriented_stride_;
+            switch (plane == 0 ? BytesPerPixel(format) : 1) {
+                case 1:
+                    StoreTransposed<1>(band, stride, out_width_, out_height_, first_row, rows,
+                                       orientation_, image, plane);
+                    break;
+                case 3:
+                    StoreTransposed<3>(band, stride, out_width_, out_height_, first_row, rows,
+                                       orientation_, image, plane);
+                    break;
+                default:
+                    StoreTransposed<4>(band, stride, out_width_, out_height_, first_row, rows,
+                                       orientation_, image, plane);
             }
         }
     }
+}
 
-    result_.SetSize(width_, height_);
-    for (int y = 0; y < height_; y++) {
-        for (int x = 0; x < width_; x++) {
-            int y_val = y_img_[y / 8][x / 8].table_[y % 8][x % 8];
-            int cb_val = 0, cr_val = 0;
-            if (monochrome_) {
-                result_.SetPixel(y, x, {y_val, y_val, y_val});
-                continue;
+uint8_t* JpegDecoder::BandRow(Reconstruction& context, int plane, int y) {
+    size_t row = plane * (mcu_height_ / 8 * block_size_) + y;
+    return &context.oriented_band_[row * oriented_stride_];
+}
+
+void JpegDecoder::StoreRow(Reconstruction& context, Image& image, int first_row, int y, int plane,
+                           const uint8_t* pixels) {
+    int row = first_row + y;
+    size_t bytes = plane == 0 ? BytesPerPixel(options_.format) : 1;
+    if (orientation_ == 1) {
+        std::copy_n(pixels, out_width_ * bytes, image.Row(row, plane).data());
+        return;
+    }
+    // Transposed rows are collected and stored with the rest of their band.
+    if (orientation_ >= 5) {
+        uint8_t* slot = BandRow(context, plane, y);
+        if (slot != pixels) {
+            std::copy_n(pixels, out_width_ * bytes, slot);
+        }
+        return;
+    }
+    switch (bytes) {
+        case 1:
+            StoreFlipped<1>(pixels, out_width_, out_height_, row, orientation_, image, plane);
+            break;
+        case 3:
+            StoreFlipped<3>(pixels, out_width_, out_height_, row, orientation_, image, plane);
+            break;
+        default:
+            StoreFlipped<4>(pixels, out_width_, out_height_, row, orientation_, image, plane);
+    }
+}
+
+void JpegDecoder::InitPlane(Plane& plane, size_t stride, size_t rows) {
+    plane.stride_ = stride;
+    plane.data_.resize(stride * rows);
+}
+
+void JpegDecoder::ProcessPlane(Reconstruction& context, int component, int first, int count,
+                               int size, int plane_row) {
+    StageTimer timer(context.stats_, &DecodeStats::idct_time);
+    const CoefficientArena& blocks = coefficients_;
+    const IdctTable& table = idct_tables_[component];
+    Plane& plane = context.planes_[component];
+    size_t columns = blocks.Columns(component);
+    for (int i = 0; i < count; i++) {
+        uint8_t* out = &plane.data_[(plane_row + i * size) * plane.stride_];
+        for (size_t j = 0; j < columns; j++) {
+            idct_.Transform(blocks.Block(component, first + i, j), table, out + j * size,
+                            plane.stride_, size, blocks.Last(component, first + i, j));
+        }
+    }
+}
+
+void JpegDecoder::Decode(Image& image) {
+    whole_image_ = true;
+    ReadHeader();
+    Render(image);
+}
+
+void JpegDecoder::Decode(Image& image, const ProgressCallback& callback) {
+    whole_image_ = true;
+    ParseHeader();
+    if (!progressive_) {
+        if (parallel_) {
+            DecodeIntervals();
+        }
+        Render(image);
+        callback(1, image);
+        return;
+    }
+    for (int scans = 1;; scans++) {
+        if (DecodeScan()) {
+            Render(image);
+            if (!callback(scans, image)) {
+                return;
             }
-            int new_y = y / channels_[1].vertical_, new_x = x / channels_[1].horizontal_;
-            cb_val = cb_img_[new_y / 8][new_x / 8].table_[new_y % 8][new_x % 8];
-            cr_val = cr_img_[new_y / 8][new_x / 8].table_[new_y % 8][new_x % 8];
-            int r = std::lround(y_val + 1.402 * (cr_val - 128));
-            int g = std::lround(y_val - 0.34414 * (cb_val - 128) - 0.71414 * (cr_val - 128));
-            int b = std::lround(y_val + 1.772 * (cb_val - 128));
-            r = std::min(std::max(r, 0), 255);
-            g = std::min(std::max(g, 0), 255);
-            b = std::min(std::max(b, 0), 255);
-            result_.SetPixel(y, x, {r, g, b});
+        }
+        if (!ParseMarkers()) {
+            return;
         }
     }
 }
 
-void JpegDecoder::ProcessMatrix(int (&matrix)[8][8], const int (&q_matrix)[8][8]) {
-    double input_matrix[8][8];
-    for (int i = 0; i < 8; i++) {
-        for (int j = 0; j < 8; j++) {
-            matrix[i][j] *= q_matrix[i][j];
-            input_matrix[i][j] = matrix[i][j];
+// Rows start over from the top, so a progressive image can be rendered after every scan.
+void JpegDecoder::Render(Image& image) {
+    orientation_ = options_.apply_orientation ? info_.orientation : 1;
+    if (orientation_ <= 4) {
+        image.SetSize(out_width_, out_height_, options_.format);
+    } else {
+        image.SetSize(out_height_, out_width_, options_.format);
+    }
+    oriented_stride_ = out_width_ * BytesPerPixel(options_.format);
+    for (Reconstruction& context : contexts_) {
+        if (orientation_ != 1) {
+            size_t rows = mcu_height_ / 8 * block_size_;
+            context.oriented_band_.resize(PlaneCount(options_.format) * rows * oriented_stride_);
+        }
+        std::fill_n(context.chroma_rows_, 3, -1);
+    }
+    mcu_row_ = first_mcu_row_;
+    decoded_rows_ = 0;
+    if (pipelined_) {
+        RenderPipelined(image);
+    } else if (banded_) {
+        RenderBands(image);
+    } else {
+        int row = 0;
+        while (int rows = ReadMcuRow(image, row)) {
+            row += rows;
         }
     }
+    image.SetComment(comment_);
+}
 
-    for (int i = 0; i < 8; i++) {
-        input_matrix[i][0] *= 1.41421356;
+// Every MCU row's coefficients are in the arena already, so rows are independent: each thread
+// starts on its own contiguous band of rows, reusing the chroma it transformed for the row
+// before, and takes over part of another band once its own is done.
+void JpegDecoder::RenderBands(Image& image) {
+    pool_->ParallelFor(last_mcu_row_ - first_mcu_row_, [&](size_t i, size_t participant) {
+        int row = first_mcu_row_ + i;
+        ReconstructRow(contexts_[participant], image, row, OutputRow(row));
+    }, contexts_.size());
+    mcu_row_ = last_mcu_row_;
+    decoded_rows_ = std::min(last_mcu_row_ + (ring_bands_ > 1 ? 1 : 0), mcus_in_col_);
+    AddTimings();
+    // A progressive image's scans have all been parsed already.
+    if (last_mcu_row_ == mcus_in_col_ && !progressive_) {
+        EndScan();
     }
+}
 
-    for (int j = 0; j < 8; j++) {
-        input_matrix[0][j] *= 1.41421356;
+void JpegDecoder::AddTimings() {
+    if constexpr (kCollectStats) {
+        if (DecodeStats* stats = options_.stats) {
+            for (Reconstruction& context : contexts_) {
+                stats->idct_time += std::exchange(context.timings_.idct_time, {});
+                stats->color_time += std::exchange(context.timings_.color_time, {});
+            }
+        }
     }
+}
 
-    double output_matrix[8][8];
-    fftw_plan plan = fftw_plan_r2r_2d(8, 8, &input_matrix[0][0], &output_matrix[0][0], FFTW_REDFT01,
-                                      FFTW_REDFT01, 0);
-    fftw_execute(plan);
-    fftw_destroy_plan(plan);
-    for (int i = 0; i < 8; i++) {
-        for (int j = 0; j < 8; j++) {
-            matrix[i][j] = std::lround(output_matrix[i][j] / 16.);
-            matrix[i][j] = std::min(std::max(0, matrix[i][j] + 128), 255);
+// The calling thread entropy-decodes MCU rows into a ring of slots_ coefficient slots and
+// publishes how many are done; each worker takes the next output row, waits until it and the
+// rows around it are published, and reconstructs it with its own buffers. A slot is only
+// decoded into again once every row that reads the row it held is finished. Workers of a shared
+// pool may be busy elsewhere, so rather than wait for a row nobody has taken, the decoding thread
+// reconstructs it itself.
+void JpegDecoder::RenderPipelined(Image& image) {
+    int margin = ring_bands_ > 1 ? 1 : 0;
+    int last_needed = std::min(last_mcu_row_ + margin, mcus_in_col_);
+    // Rows decoded so far, or -1 once decoding has failed; the next output row to hand out, and
+    // the finished ones with a count that changes whenever one finishes.
+    std::atomic<int> decoded = 0;
+    std::atomic<int> next = first_mcu_row_;
+    auto done = std::make_unique<std::atomic<bool>[]>(mcus_in_col_);
+    std::atomic<int> finished = 0;
+    std::atomic<bool> failed = false;
+    auto finish = [&](Reconstruction& context, int row) {
+        ReconstructRow(context, image, row, OutputRow(row));
+        done[row].store(true, std::memory_order_release);
+        finished.fetch_add(1, std::memory_order_release);
+        finished.notify_one();
+    };
+    auto reconstruct = [&](Reconstruction& context) {
+        for (int row; (row = next.fetch_add(1, std::memory_order_relaxed)) < last_mcu_row_;) {
+            int needed = std::min(row + 1 + margin, mcus_in_col_);
+            for (int seen; (seen = decoded.load(std::memory_order_acquire)) < needed;) {
+                if (seen < 0) {
+                    return;
+                }
+                decoded.wait(seen, std::memory_order_acquire);
+            }
+            finish(context, row);
+        }
+    };
+    auto decode = [&](Reconstruction& context) {
+        int released = first_mcu_row_;
+        for (int row = 0; row < last_needed; row++) {
+            // The slot last held row - slots_, which output rows up to the one after it read.
+            // Those are all decoded, as a ring holds at least four rows whenever it is reused.
+            int needed = row < slots_ ? 0 : std::min(row - slots_ + 2, last_mcu_row_);
+            while (released < needed) {
+                int seen = finished.load(std::memory_order_acquire);
+                int untaken = next.load(std::memory_order_relaxed);
+                if (done[released].load(std::memory_order_acquire)) {
+                    released++;
+                } else if (failed.load(std::memory_order_relaxed)) {
+                    return;
+                } else if (untaken < needed) {
+                    if (next.compare_exchange_strong(untaken, untaken + 1,
+                                                     std::memory_order_relaxed)) {
+                        finish(context, untaken);
+                    }
+                } else {
+                    finished.wait(seen, std::memory_order_acquire);
+                }
+            }
+            DecodeMcuRow(row);
+            decoded.store(row + 1, std::memory_order_release);
+            decoded.notify_all();
         }
+        if (last_mcu_row_ == mcus_in_col_) {
+            EndScan();
+        }
+        reconstruct(context);
+    };
+    // Every participant starts on its own index, so the caller takes the decoding and keeps it
+    // going whether or not any worker joins.
+    pool_->ParallelFor(contexts_.size(), [&](size_t i, size_t) {
+        try {
+            if (i == 0) {
+                decode(contexts_[0]);
+            } else {
+                reconstruct(contexts_[i]);
+            }
+        } catch (...) {
+            failed.store(true, std::memory_order_relaxed);
+            decoded.store(-1, std::memory_order_release);
+            decoded.notify_all();
+            finished.fetch_add(1, std::memory_order_release);
+            finished.notify_all();
+            throw;
+        }
+    }, contexts_.size());
+    mcu_row_ = last_mcu_row_;
+    decoded_rows_ = last_needed;
+    AddTimings();
+}
+
+size_t JpegDecoder::EstimateMemory() {
+    whole_image_ = estimate_only_ = true;
+    ParseHeader();
+    return memory_estimate_;
+}
+
+void JpegDecoder::ReadCoefficients(JpegCoefficients& result) {
+    whole_image_ = keep_coefficients_ = true;
+    ReadHeader();
+    if (!progressive_) {
+        if (!parallel_) {
+            for (int row = 0; row < mcus_in_col_; row++) {
+                DecodeMcuRow(row);
+            }
+        }
+        EndScan();
+    }
+    result.info = info_;
+    result.quant_tables.assign(monochrome_ ? 1 : 2, {});
+    for (size_t id = 0; id < result.quant_tables.size(); id++) {
+        for (int k = 0; k < 64; k++) {
+            result.quant_tables[id][k] = qtables_[id][k / 8][k % 8];
+        }
+    }
+    result.huffman_tables.clear();
+    for (int type = 0; type < 2; type++) {
+        for (int id = 0; id < 2; id++) {
+            const HuffmanTree& tree = dht_[type][id];
+            if (tree.IsEmpty()) {
+                continue;
+            }
+            HuffmanTable& table = result.huffman_tables.emplace_back();
+            table.table_class = type;
+            table.id = id;
+            for (int len = 1; len <= 16; len++) {
+                table.counts[len - 1] = tree.Count(len);
+            }
+            table.symbols.assign(tree.Symbols().begin(), tree.Symbols().end());
+        }
+    }
+    result.components.resize(info_.components.size());
+    for (size_t c = 0; c < result.components.size(); c++) {
+        ComponentCoefficients& component = result.components[c];
+        component.info = info_.components[c];
+        component.width_in_blocks = mcus_in_line_ * channels_[c].horizontal_;
+        component.height_in_blocks = mcus_in_col_ * channels_[c].vertical_;
+        const int16_t* blocks = coefficients_.Block(c, 0, 0);
+        component.coefficients.assign(
+            blocks, blocks + component.width_in_blocks * component.height_in_blocks * 64);
     }
 }
 
 Image JpegDecoder::Decode() {
-    Parse();
-    Calculate();
-    return result_;
+    Image image;
+    Decode(image);
+    return image;
 }
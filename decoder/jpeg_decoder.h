@@ -1,14 +1,21 @@
 #pragma once
 
-#include <istream>
 #include <memory>
+#include <optional>
+#include <span>
+#include <string>
 #include <vector>
 #include "bit_reader.h"
+#include "coefficient_arena.h"
+#include "color_converter.h"
 #include "huffman_tree.h"
-#include "../image.h"
+#include "idct.h"
+#include "stats.h"
+#include "../decoder.h"
 
-enum class Sector { SOI, SOF0, DHT, DQT, APP, COM, SOS, EOI, SKIP, UNDEF };
+enum class Sector { SOI, SOF0, SOF2, DHT, DQT, DRI, APP, COM, SOS, EOI, SKIP, UNDEF };
 
+// Sampling factors, that is blocks per MCU, and quantization table of a component.
 struct ChannelInfo {
     int horizontal_;
     int vertical_;
@@ -17,17 +24,70 @@ struct ChannelInfo {
 
 using Table = int[8][8];
 
-struct Block {
-    int table_[8][8];
+struct Plane {
+    std::vector<uint8_t> data_;
+    size_t stride_ = 0;
+};
+
+// Sample planes and row buffers that turn coefficient rows into output rows. Each thread that
+// reconstructs rows has its own.
+struct Reconstruction {
+    Plane planes_[3];
+    std::vector<uint8_t> cb_row_, cr_row_;
+    // Rows of the current band on their way to a turned output.
+    std::vector<uint8_t> oriented_band_;
+    // Coefficient row whose chroma each band of the chroma ring holds, -1 for none.
+    int chroma_rows_[3] = {-1, -1, -1};
+    // Where the stage timings go; worker threads collect theirs in `timings_` first.
+    DecodeStats* stats_ = nullptr;
+    DecodeStats timings_;
 };
 
 class JpegDecoder {
 public:
+    // `data` must outlive the decoder.
+    JpegDecoder(std::span<const uint8_t> data, const DecodeOptions& options = {});
+
+    // Parses the markers before the first scan only.
+    const JpegInfo& Probe();
+
+    // Starts over on new data, keeping the buffers of the previous image for reuse.
+    void Reset(std::span<const uint8_t> data);
+
     Image Decode();
+    void Decode(Image& image);
+    // Renders `image` after every decoded scan of a progressive image and hands it to
+    // `callback`, or once for a baseline image.
+    void Decode(Image& image, const ProgressCallback& callback);
+
+    void ReadCoefficients(JpegCoefficients& result);
+    // Parses the markers before the first scan and returns the peak memory Decode would take.
+    size_t EstimateMemory();
+
+    // Row-by-row decoding: ReadHeader parses everything up to the scan, then each ReadMcuRow
+    // call decodes one MCU row into image rows starting at `first_row`.
+    void ReadHeader();
+    int Width() const;
+    int Height() const;
+    int NextRowCount() const;
+    int ReadMcuRow(Image& image, int first_row);
+
+    // Incremental decoding of data that arrives in pieces. Extend points the decoder at the data
+    // received so far, which continues the previous data without its first `discarded` bytes.
+    void Extend(std::span<const uint8_t> data, size_t discarded);
+    // Bytes before this offset in the data are not read again and may be discarded.
+    size_t Retained() const;
+    // Decodes as far as the data allows and hands each finished band of rows to `callback`;
+    // returns whether the image is complete. Whatever ran out of data is left undone and taken
+    // up again on the next call. With `last` set no more data follows and running out throws.
+    bool Poll(Image& band, const ScanlineCallback& callback, bool last);
 
 private:
-    void Parse();
+    void ParseHeader();
+    bool ParseMarkers();
+    bool ParseSegments();
     Sector ParseMarker();
+    std::span<const uint8_t> ParseBytes(size_t count);
     int Parse1Byte();
     int Parse2Bytes();
     int ParseLength();
@@ -36,25 +96,170 @@ private:
     void ParseDQT();
     void ParseDHT();
     void ParseSOS();
+    void InitScan();
+    void ParseDRI();
     void ParseAPP();
-    void ParseMatrix(BitReader& reader, int (&matrix)[8][8], int dc_idx, int ac_idx);
-    void Calculate();
-    void ProcessMatrix(int (&matrix)[8][8], const int (&q_matrix)[8][8]);
-
-public:
-    JpegDecoder(std::istream& is);
+    // `last_index` is the zigzag index of the block's last nonzero coefficient; everything after
+    // it is zero.
+    void ParseMatrix(BitReader& reader, int16_t* coef, uint8_t& last_index, int dc_idx,
+                     int ac_idx, ScanCounters& counters);
+    int SkipMatrix(BitReader& reader, int dc_idx, int ac_idx, ScanCounters& counters);
+    // Decodes MCUs [first, last), which lie within one restart interval. Common layouts are
+    // compiled with their blocks per MCU fixed.
+    template <int LumaH, int LumaV, int ChromaH, int ChromaV>
+    void DecodeMcus(BitReader& reader, int first, int last, int (&last_dc)[3],
+                    ScanCounters& counters);
+    void DecodeMcuRow(int row);
+    void Restart(int index);
+    // Parses the markers after a baseline scan, which must end the image.
+    void EndScan();
+    // Whether every marker segment from `pos` up to the next SOS or EOI is in the data.
+    bool MarkersAvailable(size_t pos) const;
+    // Whether the rest of the current progressive scan and the markers after it are in the data.
+    bool ScanAvailable();
+    // Counts the marker segment that started at `start` against the limits and into the stats.
+    void CountMarker(size_t start);
+    void CountMemory();
+    // Checks the entropy-coded bytes up to `pos` in the current scan and the deadline.
+    void CheckLimits(size_t pos) const;
+    // Counts the current scan, which ends at pos_.
+    void CountScan();
+    void DecodeIntervals();
+    // Entropy-decodes the progressive scan whose header was just parsed into the coefficient
+    // arena, or steps over it when none of its coefficients are needed. Returns whether it was
+    // decoded.
+    bool DecodeScan();
+    template <class DecodeBlock>
+    void ForEachScanBlock(ScanCounters& counters, const DecodeBlock& decode_block);
+    void Render(Image& image);
+    // Entropy-decodes MCU rows on the calling thread into a ring of coefficient slots while
+    // workers reconstruct the rows already decoded.
+    void RenderPipelined(Image& image);
+    // Reconstructs the rows of an image whose coefficients are all decoded on every thread.
+    void RenderBands(Image& image);
+    // Adds the timings threads collected apart to the stats.
+    void AddTimings();
+    // Output rows of MCU row `row` and the first of them.
+    int RowCount(int row) const;
+    int OutputRow(int row) const;
+    // Turns MCU row `row`, whose coefficients and those of its neighbours are decoded, into
+    // output rows starting at `first_row`.
+    void ReconstructRow(Reconstruction& context, Image& image, int row, int first_row);
+    // Transforms the chroma of MCU row `row` into the chroma ring unless it is there already.
+    void ProcessChroma(Reconstruction& context, int row);
+    void Calculate(Reconstruction& context, Image& image, int row, int first_row, int rows);
+    // Writes `pixels`, row `y` of the band starting at `first_row` of the image as stored, into
+    // `image` turned by orientation_.
+    void StoreRow(Reconstruction& context, Image& image, int first_row, int y, int plane,
+                  const uint8_t* pixels);
+    // Row `y` of the band in `plane` as buffered for a turned output.
+    uint8_t* BandRow(Reconstruction& context, int plane, int y);
+    void InitPlane(Plane& plane, size_t stride, size_t rows);
+    // Transforms `count` block rows of `component` starting at block row `first` of the
+    // coefficients into its plane at `plane_row`.
+    void ProcessPlane(Reconstruction& context, int component, int first, int count, int size,
+                      int plane_row);
 
-private:
-    std::istream& is_;
+    std::span<const uint8_t> data_;
+    size_t pos_ = 0;
+    DecodeOptions options_;
     int height_ = -1;
     int width_ = -1;
     int mcu_height_ = -1;
     int mcu_width_ = -1;
+    int mcus_in_line_ = 0;
+    int mcus_in_col_ = 0;
+    // Side of an IDCT output block and output dimensions after scaling and cropping.
+    int block_size_ = 8;
+    int out_width_ = 0;
+    int out_height_ = 0;
+    int region_x_ = 0;
+    int region_y_ = 0;
+    // Stored MCU columns and the rows that produce output, and where the region starts in the
+    // stored planes.
+    int first_mcu_col_ = 0;
+    int mcu_cols_ = 0;
+    int first_mcu_row_ = 0;
+    int last_mcu_row_ = 0;
+    int plane_x_ = 0;
+    // Subsampled chroma is scaled up by a larger IDCT where possible, leaving less upsampling.
+    int chroma_block_size_ = 8;
+    int h_factor_ = 1;
+    int v_factor_ = 1;
+    // Stored chroma samples actually covered by the image, so that filters replicate edges
+    // rather than reading block padding.
+    int chroma_width_ = 0;
+    int chroma_height_ = 0;
+    bool fancy_ = false;
     bool monochrome_ = false;
+    bool progressive_ = false;
+    // Only the Y plane is reconstructed: the image is grayscale or Gray8 output was requested.
+    bool luma_only_ = false;
     ChannelInfo channels_[3];
     Table qtables_[2];
     int q_id_ = 0;
+    int restart_interval_ = 0;
+    // Components, spectral band and successive approximation bits of the current progressive
+    // scan, and the number of blocks left in its current end-of-band run.
+    int scan_components_[3];
+    int scan_count_ = 0;
+    int spectral_start_ = 0;
+    int spectral_end_ = 63;
+    int approx_high_ = 0;
+    int approx_low_ = 0;
+    int eobrun_ = 0;
+    int marker_ = 0;
+    bool probe_ = false;
+    JpegInfo info_;
+    // Set by Decode: the whole scan may be buffered, so restart intervals can run in parallel.
+    bool whole_image_ = false;
+    // Set by ReadCoefficients: every block of the image is kept.
+    bool keep_coefficients_ = false;
+    // Set by EstimateMemory: the first scan only gets its layout, without allocating anything.
+    bool estimate_only_ = false;
+    size_t memory_estimate_ = 0;
+    // Marker segments, their bytes and the entropy-coded bytes of finished scans so far.
+    size_t markers_ = 0;
+    size_t segment_bytes_ = 0;
+    size_t scan_bytes_ = 0;
+    bool parallel_ = false;
+    // Set when a whole image without restart intervals is large enough to reconstruct its rows
+    // on other threads while it is entropy-decoded.
+    bool pipelined_ = false;
+    // Set when a whole image's coefficients are all decoded before its rows are reconstructed,
+    // so that bands of rows can be reconstructed in parallel.
+    bool banded_ = false;
+    // Where the threads of parallel_, pipelined_ and banded_ decoding come from; null otherwise.
+    ThreadPool* pool_ = nullptr;
+    bool coefficients_ready_ = false;
     HuffmanTree dht_[2][2];
-    std::vector<std::vector<Block>> y_img_, cb_img_, cr_img_;
-    Image result_;
-};
\ No newline at end of file
+    int dc_idx_[3];
+    int ac_idx_[3];
+    std::optional<BitReader> reader_;
+    // Offset of the current scan's data from the start of the file.
+    size_t scan_start_ = 0;
+    // Incremental decoding: whether a progressive image's scans are all decoded, bytes dropped
+    // from the front of the data, where the search for the end of the current scan goes on, and
+    // the data size before which a partial MCU row is not attempted again.
+    bool incremental_ = false;
+    bool scans_done_ = false;
+    size_t discarded_ = 0;
+    size_t search_pos_ = 0;
+    size_t retry_size_ = 0;
+    int last_dc_[3];
+    int mcu_row_ = 0;
+    int decoded_rows_ = 0;
+    int slots_ = 1;
+    int ring_bands_ = 1;
+    void (JpegDecoder::*decode_mcus_)(BitReader&, int, int, int (&)[3], ScanCounters&) = nullptr;
+    CoefficientArena coefficients_;
+    Idct idct_;
+    IdctTable idct_tables_[3];
+    ColorConverter converter_;
+    // The first one reconstructs rows on the calling thread, or all of them belong to workers.
+    std::vector<Reconstruction> contexts_;
+    // EXIF orientation applied by Render and the row size of the buffered bands.
+    int orientation_ = 1;
+    size_t oriented_stride_ = 0;
+    std::string comment_;
+};
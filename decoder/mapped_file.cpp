@@ -0,0 +1,52 @@
+#include <fstream>
+#include <stdexcept>
+#include "mapped_file.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define JPEG_DECODER_HAS_MMAP
+#endif
+
+MappedFile::MappedFile(const std::filesystem::path& path) {
+#ifdef JPEG_DECODER_HAS_MMAP
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd >= 0) {
+        struct stat info;
+        if (fstat(fd, &info) == 0 && info.st_size > 0) {
+            void* data = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data != MAP_FAILED) {
+                madvise(data, info.st_size, MADV_SEQUENTIAL);
+                data_ = static_cast<const uint8_t*>(data);
+                size_ = info.st_size;
+                mapped_ = true;
+            }
+        }
+        close(fd);
+    }
+    if (mapped_) {
+        return;
+    }
+#endif
+    std::ifstream stream(path, std::ios_base::binary);
+    if (!stream) {
+        throw std::runtime_error("Cannot open file");
+    }
+    buffer_.assign(std::istreambuf_iterator<char>(stream), std::istreambuf_iterator<char>());
+    data_ = buffer_.data();
+    size_ = buffer_.size();
+}
+
+MappedFile::~MappedFile() {
+#ifdef JPEG_DECODER_HAS_MMAP
+    if (mapped_) {
+        munmap(const_cast<uint8_t*>(data_), size_);
+    }
+#endif
+}
+
+std::span<const uint8_t> MappedFile::Data() const {
+    return {data_, size_};
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include "../decoder.h"
+
+#ifndef JPEG_DECODER_STATS
+#define JPEG_DECODER_STATS 0
+#endif
+
+inline constexpr bool kCollectStats = JPEG_DECODER_STATS;
+
+// Adds the time until destruction to one of the stage timings. The disabled policy is empty, so
+// timers cost nothing in a normal build.
+template <bool Enabled>
+class BasicStageTimer {
+public:
+    BasicStageTimer(DecodeStats*, std::chrono::nanoseconds DecodeStats::*) {
+    }
+};
+
+template <>
+class BasicStageTimer<true> {
+public:
+    BasicStageTimer(DecodeStats* stats, std::chrono::nanoseconds DecodeStats::*stage)
+        : stats_(stats), stage_(stage) {
+        if (stats_) {
+            start_ = std::chrono::steady_clock::now();
+        }
+    }
+
+    ~BasicStageTimer() {
+        if (stats_) {
+            stats_->*stage_ += std::chrono::steady_clock::now() - start_;
+        }
+    }
+
+    BasicStageTimer(const BasicStageTimer&) = delete;
+    BasicStageTimer& operator=(const BasicStageTimer&) = delete;
+
+private:
+    DecodeStats* stats_;
+    std::chrono::nanoseconds DecodeStats::*stage_;
+    std::chrono::steady_clock::time_point start_;
+};
+
+// Entropy decoding counters kept by each thread and added to the shared stats once per batch of
+// MCUs, so concurrent restart intervals do not contend on them.
+template <bool Enabled>
+struct BasicScanCounters {
+    void CountMcu() {
+    }
+    void CountBlock() {
+    }
+    void CountDc() {
+    }
+    void CountAc(int) {
+    }
+    void AddTo(DecodeStats*) const {
+    }
+};
+
+template <>
+struct BasicScanCounters<true> {
+    void CountMcu() {
+        ++mcus_;
+    }
+    void CountBlock() {
+        ++blocks_;
+    }
+    void CountDc() {
+        ++symbols_;
+    }
+    // A symbol of size 0 ends the block, or with run 1 to 14 a run of blocks in progressive
+    // scans, unless it is ZRL.
+    void CountAc(int symbol) {
+        ++symbols_;
+        if (symbol % 16 == 0 && symbol != 0xf0) {
+            ++eobs_;
+        } else if (symbol >= 16) {
+            ++zero_runs_;
+        }
+    }
+    void AddTo(DecodeStats* stats) const {
+        if (!stats) {
+            return;
+        }
+        std::atomic_ref(stats->mcus).fetch_add(mcus_, std::memory_order_relaxed);
+        std::atomic_ref(stats->blocks).fetch_add(blocks_, std::memory_order_relaxed);
+        std::atomic_ref(stats->huffman_symbols).fetch_add(symbols_, std::memory_order_relaxed);
+        std::atomic_ref(stats->zero_runs).fetch_add(zero_runs_, std::memory_order_relaxed);
+        std::atomic_ref(stats->eobs).fetch_add(eobs_, std::memory_order_relaxed);
+    }
+
+    uint64_t mcus_ = 0;
+    uint64_t blocks_ = 0;
+    uint64_t symbols_ = 0;
+    uint64_t zero_runs_ = 0;
+    uint64_t eobs_ = 0;
+};
+
+using StageTimer = BasicStageTimer<kCollectStats>;
+using ScanCounters = BasicScanCounters<kCollectStats>;
@@ -0,0 +1,159 @@
+#include <algorithm>
+#include "thread_pool.h"
+
+namespace {
+
+uint64_t Pack(uint64_t begin, uint64_t end) {
+    return begin | end << 32;
+}
+
+}  // namespace
+
+ThreadPool::ThreadPool(size_t workers) {
+    threads_.reserve(workers);
+    for (size_t i = 0; i < workers; i++) {
+        threads_.emplace_back([this] { WorkerLoop(); });
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard lock(mutex_);
+        stop_ = true;
+    }
+    wake_.notify_all();
+    for (auto& thread : threads_) {
+        thread.join();
+    }
+}
+
+size_t ThreadPool::Size() const {
+    return threads_.size() + 1;
+}
+
+size_t ThreadPool::WorkersFor(int threads) {
+    size_t count = threads > 0 ? threads : std::thread::hardware_concurrency();
+    return std::max<size_t>(count, 1) - 1;
+}
+
+ThreadPool& ThreadPool::Shared() {
+    static ThreadPool pool(WorkersFor(0));
+    return pool;
+}
+
+ThreadPool& ThreadPool::For(ThreadPool* pool, int threads) {
+    static ThreadPool inline_pool(0);
+    return pool ? *pool : WorkersFor(threads) > 0 ? Shared() : inline_pool;
+}
+
+void ThreadPool::ParallelFor(size_t count, const std::function<void(size_t, size_t)>& body,
+                             size_t participants) {
+    Job job;
+    job.body = &body;
+    job.participants = std::max<size_t>(std::min({participants, Size(), count}), 1);
+    job.shares.reset(new Share[job.participants]);
+    for (size_t i = 0; i < job.participants; i++) {
+        job.shares[i].bounds.store(Pack(count * i / job.participants,
+                                        count * (i + 1) / job.participants),
+                                   std::memory_order_relaxed);
+    }
+    if (job.participants > 1) {
+        {
+            std::lock_guard lock(mutex_);
+            open_.push_back(&job);
+        }
+        wake_.notify_all();
+    }
+    RunTasks(job, 0);
+    std::unique_lock lock(mutex_);
+    // Workers that have not joined yet would find nothing left to do.
+    if (auto it = std::find(open_.begin(), open_.end(), &job); it != open_.end()) {
+        open_.erase(it);
+    }
+    job.active--;
+    done_.wait(lock, [&] { return job.active == 0; });
+    if (job.error) {
+        std::rethrow_exception(job.error);
+    }
+}
+
+void ThreadPool::WorkerLoop() {
+    while (true) {
+        Job* job;
+        size_t participant;
+        {
+            std::unique_lock lock(mutex_);
+            wake_.wait(lock, [&] { return stop_ || !open_.empty(); });
+            if (stop_) {
+                return;
+            }
+            job = open_.front();
+            participant = job->joined++;
+            job->active++;
+            if (job->joined == job->participants) {
+                open_.pop_front();
+            }
+        }
+        RunTasks(*job, participant);
+        std::lock_guard lock(mutex_);
+        if (--job->active == 0) {
+            done_.notify_all();
+        }
+    }
+}
+
+void ThreadPool::RunTasks(Job& job, size_t participant) {
+    size_t index;
+    while (!job.failed.load(std::memory_order_relaxed) &&
+           (TakeFront(job, participant, index) || Steal(job, participant, index))) {
+        try {
+            (*job.body)(index, participant);
+        } catch (...) {
+            std::lock_guard lock(mutex_);
+            if (!job.error) {
+                job.error = std::current_exception();
+            }
+            job.failed.store(true, std::memory_order_relaxed);
+        }
+    }
+}
+
+bool ThreadPool::TakeFront(Job& job, size_t participant, size_t& index) {
+    auto& bounds = job.shares[participant].bounds;
+    uint64_t current = bounds.load(std::memory_order_acquire);
+    while (true) {
+        uint64_t begin = current & 0xffffffff, end = current >> 32;
+        if (begin >= end) {
+            return false;
+        }
+        if (bounds.compare_exchange_weak(current, Pack(begin + 1, end),
+                                         std::memory_order_acq_rel)) {
+            index = begin;
+            return true;
+        }
+    }
+}
+
+bool ThreadPool::Steal(Job& job, size_t participant, size_t& index) {
+    size_t size = job.participants;
+    for (size_t k = 1; k < size; k++) {
+        auto& bounds = job.shares[(participant + k) % size].bounds;
+        uint64_t current = bounds.load(std::memory_order_acquire);
+        while (true) {
+            uint64_t begin = current & 0xffffffff, end = current >> 32;
+            if (begin >= end) {
+                break;
+            }
+            uint64_t middle = begin + (end - begin) / 2;
+            if (bounds.compare_exchange_weak(current, Pack(begin, middle),
+                                             std::memory_order_acq_rel)) {
+                // Only thieves look at an empty share, and they leave it alone.
+                job.shares[participant].bounds.store(Pack(middle + 1, end),
+                                                     std::memory_order_release);
+                index = middle;
+                return true;
+            }
+        }
+    }
+    return false;
+}
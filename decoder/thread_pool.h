@@ -0,0 +1,80 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads shared by any number of concurrent ParallelFor calls. The calling
+// thread always takes part in its own loop and idle workers join it, so a loop finishes even when
+// every worker is busy elsewhere, and a pool with zero workers runs everything inline. Each
+// participant starts on its own contiguous share of the indices and steals half of another share
+// once its own runs out.
+class ThreadPool {
+public:
+    explicit ThreadPool(size_t workers);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // Number of threads that can take part in one ParallelFor, the caller included.
+    size_t Size() const;
+
+    // Calls `body(i, participant)` for every i in [0, count) on at most `participants` threads
+    // and returns once all calls have finished; `participant` is below that bound and Size(), and
+    // no two concurrent calls of the loop share it. The first exception thrown by a call is
+    // rethrown here; the remaining indices are skipped.
+    void ParallelFor(size_t count, const std::function<void(size_t, size_t)>& body,
+                     size_t participants = std::numeric_limits<size_t>::max());
+
+    // Worker count for `threads` requested threads; 0 means one per hardware thread.
+    static size_t WorkersFor(int threads);
+
+    // Process-wide pool with a worker per hardware thread besides the caller, started on first
+    // use.
+    static ThreadPool& Shared();
+
+    // `pool` if given, else the shared pool when `threads` asks for workers and a pool without
+    // any otherwise, so that single-threaded decodes start no threads.
+    static ThreadPool& For(ThreadPool* pool, int threads);
+
+private:
+    // Half-open index range packed as begin | end << 32, padded to its own cache line.
+    struct alignas(64) Share {
+        std::atomic<uint64_t> bounds;
+    };
+
+    // One ParallelFor call, living on its caller's stack. Guarded by the pool's mutex except for
+    // the shares and `failed`.
+    struct Job {
+        const std::function<void(size_t, size_t)>* body;
+        std::unique_ptr<Share[]> shares;
+        size_t participants;
+        size_t joined = 1;
+        size_t active = 1;
+        std::atomic<bool> failed = false;
+        std::exception_ptr error;
+    };
+
+    void WorkerLoop();
+    void RunTasks(Job& job, size_t participant);
+    bool TakeFront(Job& job, size_t participant, size_t& index);
+    bool Steal(Job& job, size_t participant, size_t& index);
+
+    std::vector<std::thread> threads_;
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::condition_variable done_;
+    // Jobs that still have room for workers, oldest first.
+    std::deque<Job*> open_;
+    bool stop_ = false;
+};
@@ -1,12 +1,19 @@
 #pragma once
 
+// Row-major position of each coefficient in zigzag order.
+inline constexpr int kZigZagOrder[64] = {
+    0,  1,  8,  16, 9,  2,  3,  10, 17, 24, 32, 25, 18, 11, 4,  5,  12, 19, 26, 33, 40, 48,
+    41, 34, 27, 20, 13, 6,  7,  14, 21, 28, 35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23,
+    30, 37, 44, 51, 58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63};
+
 struct ZigZagWriter {
     ZigZagWriter(int (&matrix)[8][8]);
-    void Write(int val);
+
+    void Write(int val) {
+        matrix_[kZigZagOrder[index_++]] = val;
+    }
 
 private:
-    int (&matrix_)[8][8];
-    int i_ = 0, j_ = 0;
-    int mode_ = 0;
-    bool reverse_ = false;
+    int* matrix_;
+    int index_ = 0;
 };
@@ -1,41 +1,197 @@
 #pragma once
 
-#include <vector>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <span>
+#include <stdexcept>
 #include <string>
+#include <utility>
+
+enum class PixelFormat { RGB24, RGBA32, BGR24, Gray8, YCbCrPlanar };
 
 struct RGB {
     int r, g, b;
 };
 
+inline size_t BytesPerPixel(PixelFormat format) {
+    switch (format) {
+        case PixelFormat::RGB24:
+        case PixelFormat::BGR24:
+            return 3;
+        case PixelFormat::RGBA32:
+            return 4;
+        default:
+            return 1;
+    }
+}
+
+inline size_t PlaneCount(PixelFormat format) {
+    return format == PixelFormat::YCbCrPlanar ? 3 : 1;
+}
+
+// Pixels live in one 64-byte aligned buffer, rows `Stride()` bytes apart. YCbCrPlanar keeps three
+// full-resolution planes one after another; GetPixel/SetPixel then carry Y, Cb, Cr in r, g, b.
 class Image {
 public:
+    static constexpr size_t kAlignment = 64;
+
     Image() = default;
-    Image(size_t width, size_t height) {
-        SetSize(width, height);
+    Image(size_t width, size_t height, PixelFormat format = PixelFormat::RGB24) {
+        SetSize(width, height, format);
+    }
+
+    // Wraps caller-owned memory; the buffer must outlive the image.
+    Image(uint8_t* data, size_t width, size_t height, size_t stride,
+          PixelFormat format = PixelFormat::RGB24)
+        : data_(data), capacity_(stride * height * PlaneCount(format)), external_(true) {
+        if (stride < width * BytesPerPixel(format)) {
+            throw std::runtime_error("Image stride is too small");
+        }
+        width_ = width;
+        height_ = height;
+        stride_ = stride;
+        format_ = format;
+    }
+
+    Image(const Image& other) {
+        *this = other;
+    }
+
+    Image(Image&& other) noexcept {
+        *this = std::move(other);
+    }
+
+    Image& operator=(const Image& other) {
+        if (this != &other) {
+            SetSize(other.width_, other.height_, other.format_);
+            for (size_t plane = 0; plane < PlaneCount(format_); plane++) {
+                for (size_t y = 0; y < height_; y++) {
+                    auto row = other.Row(y, plane);
+                    std::copy(row.begin(), row.end(), Row(y, plane).begin());
+                }
+            }
+            comment_ = other.comment_;
+        }
+        return *this;
+    }
+
+    Image& operator=(Image&& other) noexcept {
+        if (this != &other) {
+            Release();
+            data_ = std::exchange(other.data_, nullptr);
+            capacity_ = std::exchange(other.capacity_, 0);
+            external_ = std::exchange(other.external_, false);
+            width_ = std::exchange(other.width_, 0);
+            height_ = std::exchange(other.height_, 0);
+            stride_ = std::exchange(other.stride_, 0);
+            format_ = other.format_;
+            comment_ = std::move(other.comment_);
+        }
+        return *this;
+    }
+
+    ~Image() {
+        Release();
     }
 
-    void SetSize(size_t width, size_t height) {
-        data_.assign(height, std::vector<RGB>(width));
+    // Reuses the current buffer when it is large enough. Contents are left uninitialized.
+    void SetSize(size_t width, size_t height, PixelFormat format = PixelFormat::RGB24) {
+        size_t stride = width * BytesPerPixel(format);
+        if (external_) {
+            if (stride > stride_ || stride_ * height * PlaneCount(format) > capacity_) {
+                throw std::runtime_error("Image buffer is too small");
+            }
+        } else {
+            stride = (stride + kAlignment - 1) / kAlignment * kAlignment;
+            size_t size = stride * height * PlaneCount(format);
+            if (size > capacity_) {
+                Release();
+                data_ = static_cast<uint8_t*>(::operator new(size, std::align_val_t{kAlignment}));
+                capacity_ = size;
+            }
+            stride_ = stride;
+        }
+        width_ = width;
+        height_ = height;
+        format_ = format;
     }
 
     size_t Width() const {
-        return data_.empty() ? 0 : data_[0].size();
+        return width_;
     }
 
     size_t Height() const {
-        return data_.size();
+        return height_;
     }
 
-    void SetPixel(size_t y, size_t x, const RGB& pixel) {
-        data_[y][x] = pixel;
+    size_t Stride() const {
+        return stride_;
     }
 
-    RGB GetPixel(size_t y, size_t x) const {
-        return data_[y][x];
+    PixelFormat Format() const {
+        return format_;
+    }
+
+    uint8_t* Data() {
+        return data_;
+    }
+
+    const uint8_t* Data() const {
+        return data_;
+    }
+
+    std::span<uint8_t> Row(size_t y, size_t plane = 0) {
+        return {data_ + (plane * height_ + y) * stride_, width_ * BytesPerPixel(format_)};
     }
 
-    RGB& GetPixel(size_t y, size_t x) {
-        return data_[y][x];
+    std::span<const uint8_t> Row(size_t y, size_t plane = 0) const {
+        return {data_ + (plane * height_ + y) * stride_, width_ * BytesPerPixel(format_)};
+    }
+
+    void SetPixel(size_t y, size_t x, const RGB& pixel) {
+        uint8_t* p = Row(y).data() + x * BytesPerPixel(format_);
+        switch (format_) {
+            case PixelFormat::RGB24:
+                p[0] = pixel.r;
+                p[1] = pixel.g;
+                p[2] = pixel.b;
+                break;
+            case PixelFormat::RGBA32:
+                p[0] = pixel.r;
+                p[1] = pixel.g;
+                p[2] = pixel.b;
+                p[3] = 255;
+                break;
+            case PixelFormat::BGR24:
+                p[0] = pixel.b;
+                p[1] = pixel.g;
+                p[2] = pixel.r;
+                break;
+            case PixelFormat::Gray8:
+                p[0] = pixel.r;
+                break;
+            case PixelFormat::YCbCrPlanar:
+                p[0] = pixel.r;
+                Row(y, 1)[x] = pixel.g;
+                Row(y, 2)[x] = pixel.b;
+                break;
+        }
+    }
+
+    RGB GetPixel(size_t y, size_t x) const {
+        const uint8_t* p = Row(y).data() + x * BytesPerPixel(format_);
+        switch (format_) {
+            case PixelFormat::BGR24:
+                return {p[2], p[1], p[0]};
+            case PixelFormat::Gray8:
+                return {p[0], p[0], p[0]};
+            case PixelFormat::YCbCrPlanar:
+                return {p[0], Row(y, 1)[x], Row(y, 2)[x]};
+            default:
+                return {p[0], p[1], p[2]};
+        }
     }
 
     void SetComment(std::string comment) {
@@ -47,6 +203,21 @@ public:
     }
 
 private:
-    std::vector<std::vector<RGB>> data_;
+    void Release() {
+        if (!external_ && data_) {
+            ::operator delete(data_, std::align_val_t{kAlignment});
+        }
+        data_ = nullptr;
+        capacity_ = 0;
+        external_ = false;
+    }
+
+    uint8_t* data_ = nullptr;
+    size_t capacity_ = 0;
+    bool external_ = false;
+    size_t width_ = 0;
+    size_t height_ = 0;
+    size_t stride_ = 0;
+    PixelFormat format_ = PixelFormat::RGB24;
     std::string comment_;
 };
@@ -0,0 +1,110 @@
+#include "decoder.h"
+#include "decoder/idct.h"
+#include "test_jpeg.h"
+#include "test_util.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+constexpr int kZigZag[64] = {0,  1,  8,  16, 9,  2,  3,  10, 17, 24, 32, 25, 18, 11, 4,  5,
+                             12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13, 6,  7,  14, 21, 28,
+                             35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+                             58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63};
+
+// Zigzag positions of the nonzero AC coefficients of each kind of block. Runs of 16 zeros or more
+// are coded with ZRL, after which the block's last coefficient must still be recorded right.
+const std::vector<std::vector<int>> kBlockEnds = {
+    {},                       // DC only
+    {1},                      // ends at once
+    {2, 5, 9},                // ends on the last position of the top-left quarter
+    {9},                      // a run up to it
+    {10},                     // just past the quarter
+    {3, 10},
+    {17},                     // ZRL, then the value
+    {1, 18},                  // ZRL from position 2
+    {1, 34},                  // two ZRLs
+    {63},                     // three ZRLs and a run of 14
+    {5, 22, 63},
+    {2, 3, 4, 5, 6, 7, 8, 9, 26},
+    {1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18, 19, 20, 40, 41, 62, 63},
+};
+
+// A grayscale image block-aligned to 64x64 whose blocks cycle through kBlockEnds.
+JpegCoefficients MakeImage() {
+    const Sampling gray[] = {{1, 1}};
+    auto image = MakeCoefficients(64, 64, gray);
+    std::mt19937 rng(3);
+    auto& blocks = image.components[0].coefficients;
+    for (size_t b = 0; b < blocks.size() / 64; b++) {
+        int16_t* block = &blocks[b * 64];
+        std::fill_n(block + 1, 63, 0);
+        for (int k : kBlockEnds[b % kBlockEnds.size()]) {
+            int value = 1 + static_cast<int>(rng() % 40);
+            block[kZigZag[k]] = static_cast<int16_t>(rng() % 2 ? value : -value);
+        }
+    }
+    return image;
+}
+
+// Transforms every block with its full kernel, whatever the block's end.
+Image FullTransform(const JpegCoefficients& image, IdctMethod method) {
+    const auto& component = image.components[0];
+    Idct idct(method);
+    int quant[8][8];
+    for (int k = 0; k < 64; k++) {
+        quant[k / 8][k % 8] = image.quant_tables[0][k];
+    }
+    IdctTable table;
+    idct.BuildTable(quant, &table);
+    Image out(image.info.width, image.info.height, PixelFormat::Gray8);
+    for (size_t row = 0; row < component.height_in_blocks; row++) {
+        for (size_t column = 0; column < component.width_in_blocks; column++) {
+            idct.Transform(component.Block(row, column).data(), table,
+                           out.Row(row * 8).data() + column * 8, out.Stride());
+        }
+    }
+    return out;
+}
+
+class BlockEnd : public ::testing::TestWithParam<IdctMethod> {};
+
+TEST_P(BlockEnd, BaselineMatchesFullTransform) {
+    auto image = MakeImage();
+    DecodeOptions options;
+    options.idct_method = GetParam();
+    options.format = PixelFormat::Gray8;
+    EXPECT_TRUE(SameImage(Decode(WriteBaseline(image), options), FullTransform(image, GetParam())));
+}
+
+TEST_P(BlockEnd, ProgressiveMatchesFullTransform) {
+    auto image = MakeImage();
+    DecodeOptions options;
+    options.idct_method = GetParam();
+    options.format = PixelFormat::Gray8;
+    auto jpeg = WriteProgressive(image, StandardProgressiveScript(1));
+    EXPECT_TRUE(SameImage(Decode(jpeg, options), FullTransform(image, GetParam())));
+}
+
+std::string MethodName(const ::testing::TestParamInfo<IdctMethod>& info) {
+    switch (info.param) {
+    case IdctMethod::IntegerSlow:
+        return "IntegerSlow";
+    case IdctMethod::FloatAan:
+        return "FloatAan";
+    default:
+        return "Simd";
+    }
+}
+
+INSTANTIATE_TEST_SUITE_P(Methods, BlockEnd,
+                         ::testing::Values(IdctMethod::IntegerSlow, IdctMethod::FloatAan,
+                                           IdctMethod::Simd),
+                         MethodName);
+
+}  // namespace
@@ -0,0 +1,137 @@
+#include "decoder/color_converter.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+struct Isa {
+    std::string name;
+    ColorConverter::Isa isa;
+};
+
+std::vector<Isa> VectorIsas() {
+    std::vector<Isa> isas;
+#if defined(__SSE2__)
+    isas.push_back({"Sse2", ColorConverter::Isa::Sse2});
+    if (__builtin_cpu_supports("avx2")) {
+        isas.push_back({"Avx2", ColorConverter::Isa::Avx2});
+    }
+#endif
+    return isas;
+}
+
+std::vector<uint8_t> RandomRow(size_t width, std::mt19937& rng) {
+    std::uniform_int_distribution<int> sample(0, 255);
+    std::vector<uint8_t> row(width);
+    for (auto& value : row) {
+        value = sample(rng);
+    }
+    return row;
+}
+
+// Widths around the 16 pixels of one vector step and the two spare pixels of 24-bit AVX2 stores,
+// so that every kernel leaves a tail to the scalar one.
+TEST(ColorConverter, VectorKernelsMatchScalar) {
+    std::mt19937 rng(7);
+    for (const Isa& isa : VectorIsas()) {
+        for (auto format : {PixelFormat::RGB24, PixelFormat::BGR24, PixelFormat::RGBA32}) {
+            ColorConverter scalar(format, ColorConverter::Isa::Scalar);
+            ColorConverter vector(format, isa.isa);
+            size_t pixel_size = BytesPerPixel(format);
+            for (size_t width : {1, 15, 17, 18, 31, 33, 34, 47, 50, 99, 255}) {
+                auto y = RandomRow(width, rng);
+                auto cb = RandomRow(width, rng);
+                auto cr = RandomRow(width, rng);
+                std::vector<uint8_t> expected(width * pixel_size), actual(width * pixel_size);
+                scalar.ConvertRow(y.data(), cb.data(), cr.data(), expected.data(), width);
+                vector.ConvertRow(y.data(), cb.data(), cr.data(), actual.data(), width);
+                EXPECT_EQ(actual, expected) << isa.name << " " << int(format) << " " << width;
+            }
+        }
+    }
+}
+
+// Extreme chroma saturates every channel in both directions.
+TEST(ColorConverter, VectorKernelsMatchScalarWhenClamping) {
+    std::vector<uint8_t> y, cb, cr;
+    for (int a : {0, 1, 16, 128, 235, 254, 255}) {
+        for (int b : {0, 1, 127, 128, 255}) {
+            for (int c : {0, 1, 128, 254, 255}) {
+                y.push_back(a);
+                cb.push_back(b);
+                cr.push_back(c);
+            }
+        }
+    }
+    size_t width = y.size();
+    for (const Isa& isa : VectorIsas()) {
+        for (auto format : {PixelFormat::RGB24, PixelFormat::BGR24, PixelFormat::RGBA32}) {
+            std::vector<uint8_t> expected(width * BytesPerPixel(format)), actual(expected.size());
+            ColorConverter(format, ColorConverter::Isa::Scalar)
+                .ConvertRow(y.data(), cb.data(), cr.data(), expected.data(), width);
+            ColorConverter(format, isa.isa)
+                .ConvertRow(y.data(), cb.data(), cr.data(), actual.data(), width);
+            EXPECT_EQ(actual, expected) << isa.name << " " << int(format);
+        }
+    }
+}
+
+// Triangle filter of libjpeg's fancy upsampling: each output sample weighs its own chroma column
+// 3/4 and the nearer neighbour 1/4, horizontally and, with a far row, vertically too. Edge columns
+// stand in for their missing neighbours.
+uint8_t Triangle(const std::vector<uint8_t>& near, const std::vector<uint8_t>* far, size_t x) {
+    auto column = [&](size_t i) { return far ? 3 * near[i] + (*far)[i] : 4 * near[i]; };
+    size_t width = near.size(), center = x / 2;
+    size_t neighbour = x % 2 ? std::min(center + 1, width - 1) : center ? center - 1 : 0;
+    int sum = 3 * column(center) + column(neighbour);
+    // Rounding alternates between neighbours as in libjpeg, so that it does not drift one way.
+    int bias = far ? (x % 2 ? 7 : 8) : (x % 2 ? 8 : 4);
+    return static_cast<uint8_t>((sum + bias) / 16);
+}
+
+TEST(UpsampleRow, FancyH2IsTriangleFilter) {
+    std::mt19937 rng(11);
+    for (size_t width : {1, 2, 3, 8, 17}) {
+        auto near = RandomRow(width, rng);
+        auto far = RandomRow(width, rng);
+        std::vector<uint8_t> out(2 * width);
+        UpsampleRow(near.data(), nullptr, width, 2, true, out.data());
+        for (size_t x = 0; x < out.size(); x++) {
+            ASSERT_EQ(out[x], Triangle(near, nullptr, x)) << width << " " << x;
+        }
+        UpsampleRow(near.data(), far.data(), width, 2, true, out.data());
+        for (size_t x = 0; x < out.size(); x++) {
+            ASSERT_EQ(out[x], Triangle(near, &far, x)) << width << " " << x;
+        }
+    }
+}
+
+TEST(UpsampleRow, FancyV2BlendsRows) {
+    std::mt19937 rng(13);
+    auto near = RandomRow(37, rng);
+    auto far = RandomRow(37, rng);
+    std::vector<uint8_t> out(37);
+    UpsampleRow(near.data(), far.data(), 37, 1, true, out.data());
+    for (size_t x = 0; x < out.size(); x++) {
+        EXPECT_EQ(out[x], (3 * near[x] + far[x] + 2) / 4) << x;
+    }
+}
+
+TEST(UpsampleRow, ReplicatesWithoutFancy) {
+    std::mt19937 rng(17);
+    auto near = RandomRow(13, rng);
+    for (int factor : {1, 2, 3, 4}) {
+        std::vector<uint8_t> out(13 * factor);
+        UpsampleRow(near.data(), nullptr, 13, factor, false, out.data());
+        for (size_t x = 0; x < out.size(); x++) {
+            ASSERT_EQ(out[x], near[x / factor]) << factor << " " << x;
+        }
+    }
+}
+
+}  // namespace
@@ -0,0 +1,56 @@
+#include "decoder.h"
+#include "synthetic_jpeg.h"
+#include "test_util.h"
+
+#include <gtest/gtest.h>
+
+#include <vector>
+
+namespace {
+
+const Subsampling kLayouts[] = {Subsampling::Gray, Subsampling::S444, Subsampling::S422,
+                                Subsampling::S420, Subsampling::S440, Subsampling::S411};
+
+TEST(Decode, HasFrameSizeForEveryLayout) {
+    for (auto layout : kLayouts) {
+        auto jpeg = MakeSyntheticJpeg({.width = 75, .height = 41, .subsampling = layout});
+        auto image = Decode(jpeg);
+        EXPECT_EQ(image.Width(), 75u);
+        EXPECT_EQ(image.Height(), 41u);
+        EXPECT_EQ(image.Format(), PixelFormat::RGB24);
+    }
+}
+
+TEST(Decode, FormatsCarryTheSamePixels) {
+    auto jpeg = MakeSyntheticJpeg({.width = 50, .height = 30, .subsampling = Subsampling::S420});
+    auto rgb = Decode(jpeg);
+    for (auto format : {PixelFormat::RGBA32, PixelFormat::BGR24}) {
+        DecodeOptions options;
+        options.format = format;
+        auto image = Decode(jpeg, options);
+        for (size_t y = 0; y < rgb.Height(); y++) {
+            for (size_t x = 0; x < rgb.Width(); x++) {
+                auto a = image.GetPixel(y, x);
+                auto b = rgb.GetPixel(y, x);
+                ASSERT_TRUE(a.r == b.r && a.g == b.g && a.b == b.b) << y << "," << x;
+            }
+        }
+    }
+}
+
+TEST(Decode, IntoCallerBufferMatchesNewImage) {
+    auto jpeg = MakeSyntheticJpeg({.width = 33, .height = 17, .subsampling = Subsampling::S422});
+    auto expected = Decode(jpeg);
+    std::vector<uint8_t> buffer(128 * 17);
+    Image wrapped(buffer.data(), 33, 17, 128);
+    Decode(jpeg, wrapped);
+    EXPECT_TRUE(SameImage(wrapped, expected));
+}
+
+TEST(Decode, RejectsTruncatedData) {
+    auto jpeg = MakeSyntheticJpeg({.width = 64, .height = 64});
+    jpeg.resize(jpeg.size() / 2);
+    EXPECT_THROW(Decode(jpeg), std::runtime_error);
+}
+
+}  // namespace
@@ -0,0 +1,125 @@
+#include "decoder.h"
+#include "decoder/mapped_file.h"
+#include "test_jpeg.h"
+#include "test_util.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace {
+
+// Writes the test's JPEG to a file of its own in the temporary directory, removed afterwards.
+class File : public ::testing::Test {
+protected:
+    void SetUp() override {
+        const Sampling sampling[] = {{2, 2}, {1, 1}, {1, 1}};
+        image_ = MakeCoefficients(57, 43, sampling, 3);
+        jpeg_ = WriteProgressive(image_, StandardProgressiveScript(3));
+        jpeg_ = WithSegment(jpeg_, 0xfe, std::vector<uint8_t>{'h', 'i'});
+        std::string name = ::testing::UnitTest::GetInstance()->current_test_info()->name();
+        path_ = std::filesystem::temp_directory_path() / ("jpeg_decoder_" + name + ".jpg");
+        Write(jpeg_);
+    }
+
+    void TearDown() override {
+        std::filesystem::remove(path_);
+    }
+
+    void Write(std::span<const uint8_t> data) {
+        std::ofstream(path_, std::ios_base::binary | std::ios_base::trunc)
+            .write(reinterpret_cast<const char*>(data.data()), data.size());
+    }
+
+    JpegCoefficients image_;
+    std::vector<uint8_t> jpeg_;
+    std::filesystem::path path_;
+};
+
+TEST_F(File, MapsWholeFile) {
+    MappedFile file(path_);
+    auto data = file.Data();
+    EXPECT_TRUE(std::equal(data.begin(), data.end(), jpeg_.begin(), jpeg_.end()));
+}
+
+TEST_F(File, DecodeMatchesSpan) {
+    DecodeOptions options;
+    options.fancy_upsampling = true;
+    EXPECT_TRUE(SameImage(Decode(path_, options), Decode(jpeg_, options)));
+    Rect roi{5, 7, 30, 20};
+    EXPECT_TRUE(SameImage(Decode(path_, roi, options), Decode(jpeg_, roi, options)));
+    Image into;
+    Decode(path_, into, options);
+    EXPECT_TRUE(SameImage(into, Decode(jpeg_, options)));
+    EXPECT_EQ(EstimateDecodeMemory(path_, options), EstimateDecodeMemory(jpeg_, options));
+}
+
+TEST_F(File, ScanlinesMatchSpan) {
+    Image expected = Decode(jpeg_);
+    ScanlineDecoder decoder(path_);
+    Image rows(decoder.Width(), decoder.Height());
+    EXPECT_EQ(decoder.ReadScanlines(rows, rows.Height()), rows.Height());
+    EXPECT_TRUE(SameImage(rows, expected));
+    size_t bands = 0;
+    DecodeScanlines(path_, [&](size_t first_row, const Image& band) {
+        for (size_t y = 0; y < band.Height(); y++) {
+            auto a = band.Row(y);
+            auto b = expected.Row(first_row + y);
+            EXPECT_TRUE(std::equal(a.begin(), a.end(), b.begin())) << first_row + y;
+        }
+        bands++;
+    });
+    EXPECT_GT(bands, 0u);
+}
+
+TEST_F(File, ProbeMatchesSpan) {
+    auto from_file = ProbeJpeg(path_);
+    auto from_span = ProbeJpeg(jpeg_);
+    EXPECT_EQ(from_file.width, from_span.width);
+    EXPECT_EQ(from_file.height, from_span.height);
+    EXPECT_EQ(from_file.progressive, from_span.progressive);
+    EXPECT_EQ(from_file.components.size(), from_span.components.size());
+    EXPECT_EQ(from_file.restart_interval, from_span.restart_interval);
+    ASSERT_TRUE(from_file.comment);
+    EXPECT_EQ(from_file.comment->offset, from_span.comment->offset);
+    EXPECT_EQ(from_file.comment->size, 2u);
+}
+
+TEST_F(File, CoefficientsMatchSpan) {
+    auto from_file = ReadCoefficients(path_);
+    auto from_span = ReadCoefficients(jpeg_);
+    EXPECT_EQ(from_file.quant_tables, from_span.quant_tables);
+    ASSERT_EQ(from_file.components.size(), from_span.components.size());
+    for (size_t c = 0; c < from_file.components.size(); c++) {
+        EXPECT_EQ(from_file.components[c].coefficients, from_span.components[c].coefficients)
+            << c;
+    }
+}
+
+TEST_F(File, MissingFileThrows) {
+    std::filesystem::remove(path_);
+    EXPECT_THROW(MappedFile{path_}, std::runtime_error);
+    EXPECT_THROW(Decode(path_), std::runtime_error);
+    EXPECT_THROW(ProbeJpeg(path_), std::runtime_error);
+    EXPECT_THROW(ReadCoefficients(path_), std::runtime_error);
+    EXPECT_THROW(EstimateDecodeMemory(path_), std::runtime_error);
+    EXPECT_THROW(ScanlineDecoder{path_}, std::runtime_error);
+    EXPECT_THROW(DecodeScanlines(path_, [](size_t, const Image&) {}), std::runtime_error);
+}
+
+// An empty file cannot be mapped; it is read as no data, which is not a JPEG.
+TEST_F(File, EmptyFileThrows) {
+    Write({});
+    EXPECT_TRUE(MappedFile(path_).Data().empty());
+    EXPECT_THROW(Decode(path_), std::runtime_error);
+    EXPECT_THROW(ProbeJpeg(path_), std::runtime_error);
+    EXPECT_THROW(ReadCoefficients(path_), std::runtime_error);
+    EXPECT_THROW(EstimateDecodeMemory(path_), std::runtime_error);
+    EXPECT_THROW(ScanlineDecoder{path_}, std::runtime_error);
+}
+
+}  // namespace
@@ -0,0 +1,367 @@
+#include "decoder/idct.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <numbers>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+struct Block {
+    std::array<int16_t, 64> coef{};
+    int quant[8][8];
+};
+
+double Basis(int u, double x) {
+    double scale = u == 0 ? std::numbers::sqrt2 / 2 : 1.0;
+    return scale * std::cos((2 * x + 1) * u * std::numbers::pi / 16);
+}
+
+// Double-precision inverse DCT of the dequantized block, reduced to `size` x `size` by averaging
+// each group of 8 / size by 8 / size samples as the reduced transforms do, then rounded.
+std::vector<uint8_t> Reference(const Block& block, int size) {
+    double samples[64] = {};
+    for (int y = 0; y < 8; y++) {
+        for (int x = 0; x < 8; x++) {
+            for (int v = 0; v < 8; v++) {
+                for (int u = 0; u < 8; u++) {
+                    samples[y * 8 + x] += block.coef[v * 8 + u] * block.quant[v][u] * Basis(v, y) *
+                                          Basis(u, x) / 4;
+                }
+            }
+        }
+    }
+    int group = 8 / size;
+    std::vector<uint8_t> out(size * size);
+    for (int y = 0; y < size; y++) {
+        for (int x = 0; x < size; x++) {
+            double sum = 0;
+            for (int i = 0; i < group * group; i++) {
+                sum += samples[(y * group + i / group) * 8 + x * group + i % group];
+            }
+            out[y * size + x] = std::clamp(std::lround(sum / (group * group) + 128), 0l, 255l);
+        }
+    }
+    return out;
+}
+
+// Forward DCT of a block of samples, rounded to the nearest coefficient.
+std::array<int16_t, 64> ForwardDct(const int (&samples)[64]) {
+    std::array<int16_t, 64> coef;
+    for (int v = 0; v < 8; v++) {
+        for (int u = 0; u < 8; u++) {
+            double sum = 0;
+            for (int y = 0; y < 8; y++) {
+                for (int x = 0; x < 8; x++) {
+                    sum += samples[y * 8 + x] * Basis(v, y) * Basis(u, x);
+                }
+            }
+            coef[v * 8 + u] = static_cast<int16_t>(std::lround(sum / 4));
+        }
+    }
+    return coef;
+}
+
+void FlatQuant(Block& block, int value) {
+    for (auto& row : block.quant) {
+        std::fill_n(row, 8, value);
+    }
+}
+
+// Blocks of uniformly random samples in [-range, range - 1] through a forward DCT, as in the
+// IEEE 1180 accuracy test.
+std::vector<Block> RandomSampleBlocks(int range, int count, unsigned seed) {
+    std::mt19937 rng(seed);
+    std::vector<Block> blocks(count);
+    for (auto& block : blocks) {
+        int samples[64];
+        for (int& sample : samples) {
+            sample = static_cast<int>(rng() % (2 * range)) - range;
+        }
+        block.coef = ForwardDct(samples);
+        FlatQuant(block, 1);
+    }
+    return blocks;
+}
+
+// Few nonzero coefficients of any size under a typical quantization table, like real blocks.
+std::vector<Block> SparseBlocks(int count, unsigned seed) {
+    std::mt19937 rng(seed);
+    std::vector<Block> blocks(count);
+    for (auto& block : blocks) {
+        for (int v = 0; v < 8; v++) {
+            for (int u = 0; u < 8; u++) {
+                block.quant[v][u] = 2 + 2 * (u + v) + static_cast<int>(rng() % 8);
+            }
+        }
+        int nonzero = 1 + rng() % 8;
+        for (int i = 0; i < nonzero; i++) {
+            int k = rng() % 64;
+            int limit = 2048 / block.quant[k / 8][k % 8];
+            block.coef[k] = static_cast<int16_t>(static_cast<int>(rng() % (2 * limit)) - limit);
+        }
+    }
+    return blocks;
+}
+
+// Blocks at the ends of what an 8-bit encoder produces: the transforms of saturated sample
+// patterns (flat, checkerboards, stripes and a corner), every coefficient at +-1023 with either
+// sign pattern, and single coefficients at the ends of the 12-bit range.
+std::vector<Block> ExtremeBlocks() {
+    std::vector<Block> blocks;
+    auto add_samples = [&](auto pattern) {
+        for (bool invert : {false, true}) {
+            int samples[64];
+            for (int i = 0; i < 64; i++) {
+                samples[i] = pattern(i / 8, i % 8) != invert ? 127 : -128;
+            }
+            Block block;
+            block.coef = ForwardDct(samples);
+            FlatQuant(block, 1);
+            blocks.push_back(block);
+        }
+    };
+    add_samples([](int, int) { return true; });
+    add_samples([](int y, int x) { return (x + y) % 2 == 0; });
+    add_samples([](int y, int x) { return (x / 2 + y / 2) % 2 == 0; });
+    add_samples([](int, int x) { return x % 2 == 0; });
+    add_samples([](int y, int) { return y < 4; });
+    add_samples([](int y, int x) { return x == 0 && y == 0; });
+    for (int value : {-1023, 1023}) {
+        Block all;
+        FlatQuant(all, 1);
+        std::fill(all.coef.begin(), all.coef.end(), static_cast<int16_t>(value));
+        blocks.push_back(all);
+        for (int k = 0; k < 64; k++) {
+            if ((k / 8 + k % 8) % 2) {
+                all.coef[k] = static_cast<int16_t>(-value);
+            }
+        }
+        blocks.push_back(all);
+    }
+    for (int value : {-2048, 2047}) {
+        for (int k = 0; k < 64; k++) {
+            Block block;
+            FlatQuant(block, 1);
+            block.coef[k] = static_cast<int16_t>(value);
+            blocks.push_back(block);
+        }
+    }
+    return blocks;
+}
+
+// Bounds as in IEEE 1180: no pixel off by more than one, the mean error over all pixels below
+// 0.02 and the mean signed error at every position below 0.015. Errors are never larger than one,
+// so the mean absolute error equals the mean squared error that IEEE 1180 bounds.
+constexpr int kMaxError = 1;
+constexpr double kMeanError = 0.02;
+constexpr double kBias = 0.015;
+
+struct Errors {
+    int max = 0;
+    double mean = 0;
+    // Largest mean signed error at a single pixel position.
+    double bias = 0;
+};
+
+Errors Measure(const Idct& idct, const std::vector<Block>& blocks, int size) {
+    Errors errors;
+    std::vector<double> signed_sums(size * size);
+    double sum = 0;
+    for (const auto& block : blocks) {
+        IdctTable table;
+        idct.BuildTable(block.quant, &table);
+        uint8_t out[64];
+        idct.Transform(block.coef.data(), table, out, size, size);
+        auto expected = Reference(block, size);
+        for (int i = 0; i < size * size; i++) {
+            int error = out[i] - expected[i];
+            errors.max = std::max(errors.max, std::abs(error));
+            sum += std::abs(error);
+            signed_sums[i] += error;
+        }
+    }
+    double count = static_cast<double>(blocks.size());
+    errors.mean = sum / count / (size * size);
+    for (double signed_sum : signed_sums) {
+        errors.bias = std::max(errors.bias, std::abs(signed_sum) / count);
+    }
+    return errors;
+}
+
+struct Kernel {
+    std::string name;
+    IdctMethod method;
+    bool avx2;
+};
+
+std::vector<Kernel> Kernels() {
+    std::vector<Kernel> kernels = {{"IntegerSlow", IdctMethod::IntegerSlow, false},
+                                   {"FloatAan", IdctMethod::FloatAan, false}};
+#if defined(__SSE2__)
+    kernels.push_back({"Sse2", IdctMethod::Simd, false});
+    if (__builtin_cpu_supports("avx2")) {
+        kernels.push_back({"Avx2", IdctMethod::Simd, true});
+    }
+#endif
+    return kernels;
+}
+
+class IdctAccuracy : public ::testing::TestWithParam<Kernel> {
+protected:
+    Idct idct_{GetParam().method, GetParam().avx2};
+};
+
+TEST_P(IdctAccuracy, RandomSamples) {
+    ASSERT_EQ(idct_.Method(), GetParam().method);
+    for (int range : {256, 5, 300}) {
+        auto blocks = RandomSampleBlocks(range, 2000, range);
+        for (int sign : {1, -1}) {
+            if (sign < 0) {
+                for (auto& block : blocks) {
+                    for (auto& value : block.coef) {
+                        value = static_cast<int16_t>(-value);
+                    }
+                }
+            }
+            auto errors = Measure(idct_, blocks, 8);
+            EXPECT_LE(errors.max, kMaxError) << range << " " << sign;
+            EXPECT_LE(errors.mean, kMeanError) << range << " " << sign;
+            EXPECT_LE(errors.bias, kBias) << range << " " << sign;
+        }
+    }
+}
+
+TEST_P(IdctAccuracy, SparseBlocks) {
+    auto errors = Measure(idct_, SparseBlocks(4000, 7), 8);
+    EXPECT_LE(errors.max, kMaxError);
+    EXPECT_LE(errors.mean, kMeanError);
+    EXPECT_LE(errors.bias, kBias);
+}
+
+// Too few blocks for a meaningful bias.
+TEST_P(IdctAccuracy, ExtremeBlocks) {
+    auto errors = Measure(idct_, ExtremeBlocks(), 8);
+    EXPECT_LE(errors.max, kMaxError);
+    EXPECT_LE(errors.mean, kMeanError);
+}
+
+// The reduced transforms are shared by every method. A 1x1 block is a single rounded value, so
+// its error is all bias and only bounded like the mean.
+TEST(IdctAccuracy, ReducedSizes) {
+    Idct idct;
+    auto random = RandomSampleBlocks(256, 2000, 11);
+    auto sparse = SparseBlocks(4000, 12);
+    auto extreme = ExtremeBlocks();
+    for (int size : {4, 2, 1}) {
+        for (const auto* blocks : {&random, &sparse, &extreme}) {
+            auto errors = Measure(idct, *blocks, size);
+            EXPECT_LE(errors.max, kMaxError) << size;
+            EXPECT_LE(errors.mean, size == 1 ? 0.03 : kMeanError) << size;
+            if (blocks != &extreme) {
+                EXPECT_LE(errors.bias, size == 1 ? 0.03 : kBias) << size;
+            }
+        }
+    }
+}
+
+// Corrupt but parseable data: coefficients at the ends of int16 dequantized by 8-bit and 16-bit
+// tables, with every sign pattern that lines the products up.
+std::vector<Block> SaturatedBlocks() {
+    std::vector<Block> blocks;
+    std::mt19937 rng(13);
+    for (int quant : {255, 65535}) {
+        for (int pattern = 0; pattern < 4; pattern++) {
+            for (int16_t value : {int16_t{-32768}, int16_t{32767}}) {
+                Block block;
+                FlatQuant(block, quant);
+                for (int k = 0; k < 64; k++) {
+                    int u = k % 8, v = k / 8;
+                    bool negate = pattern == 1   ? (u + v) % 2
+                                  : pattern == 2 ? u % 2
+                                  : pattern == 3 ? rng() % 2
+                                                 : false;
+                    block.coef[k] = negate ? static_cast<int16_t>(-1 - value) : value;
+                }
+                blocks.push_back(block);
+                Block single;
+                FlatQuant(single, quant);
+                single.coef[rng() % 64] = value;
+                blocks.push_back(single);
+            }
+        }
+    }
+    return blocks;
+}
+
+// The integer transforms must stay exact however large the products get. The float kernels can
+// only be expected to be free of undefined behavior, which sanitizer builds check.
+TEST(IdctAccuracy, SaturatedCoefficients) {
+    auto blocks = SaturatedBlocks();
+    Idct integer(IdctMethod::IntegerSlow);
+    for (int size : {8, 4, 2, 1}) {
+        EXPECT_LE(Measure(integer, blocks, size).max, kMaxError) << size;
+    }
+    for (const Kernel& kernel : Kernels()) {
+        Idct idct(kernel.method, kernel.avx2);
+        for (const auto& block : blocks) {
+            IdctTable table;
+            idct.BuildTable(block.quant, &table);
+            uint8_t out[64];
+            for (int last : {0, 9, 63}) {
+                idct.Transform(block.coef.data(), table, out, 8, 8, last);
+            }
+        }
+    }
+}
+
+// Coefficients in zigzag order up to `last`, which is nonzero, and zeros after it.
+Block BlockEndingAt(int last, std::mt19937& rng) {
+    static constexpr int kZigZag[64] = {
+        0,  1,  8,  16, 9,  2,  3,  10, 17, 24, 32, 25, 18, 11, 4,  5,  12, 19, 26, 33, 40, 48,
+        41, 34, 27, 20, 13, 6,  7,  14, 21, 28, 35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23,
+        30, 37, 44, 51, 58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63};
+    Block block;
+    for (int v = 0; v < 8; v++) {
+        for (int u = 0; u < 8; u++) {
+            block.quant[v][u] = 1 + u + v + static_cast<int>(rng() % 16);
+        }
+    }
+    for (int k = 0; k <= last; k++) {
+        int value = rng() % 3 == 0 || k == last ? 1 + static_cast<int>(rng() % 60) : 0;
+        block.coef[kZigZag[k]] = static_cast<int16_t>(rng() % 2 ? value : -value);
+    }
+    return block;
+}
+
+// The DC fill and the quarter kernel must give exactly what the full kernel gives for blocks that
+// end where the entropy decoder's end-of-block position sends them to these paths.
+TEST_P(IdctAccuracy, FastPathsMatchFullTransform) {
+    std::mt19937 rng(5);
+    for (int last : {0, 1, 2, 5, 9, 10, 11, 20, 63}) {
+        for (int i = 0; i < 500; i++) {
+            Block block = BlockEndingAt(last, rng);
+            IdctTable table;
+            idct_.BuildTable(block.quant, &table);
+            for (int size : {8, 4, 2, 1}) {
+                uint8_t fast[64], full[64];
+                idct_.Transform(block.coef.data(), table, fast, size, size, last);
+                idct_.Transform(block.coef.data(), table, full, size, size, 63);
+                ASSERT_TRUE(std::equal(fast, fast + size * size, full))
+                    << "last " << last << " size " << size;
+            }
+        }
+    }
+}
+
+INSTANTIATE_TEST_SUITE_P(Kernels, IdctAccuracy, ::testing::ValuesIn(Kernels()),
+                         [](const auto& info) { return info.param.name; });
+
+}  // namespace
@@ -0,0 +1,147 @@
+#include "decoder.h"
+#include "synthetic_jpeg.h"
+#include "test_util.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <functional>
+#include <string_view>
+#include <vector>
+
+namespace {
+
+// Feeds `data` in pieces of `next_size(offset)` bytes, polling after each, and assembles the
+// bands handed out into one image.
+Image DecodeInPieces(std::span<const uint8_t> data, const std::function<size_t(size_t)>& next_size,
+                     const DecodeOptions& options = {}) {
+    IncrementalDecoder decoder(options);
+    Image image;
+    auto callback = [&](size_t first_row, const Image& rows) {
+        if (image.Width() == 0) {
+            image.SetSize(decoder.Width(), decoder.Height(), rows.Format());
+        }
+        for (size_t plane = 0; plane < PlaneCount(rows.Format()); plane++) {
+            for (size_t y = 0; y < rows.Height(); y++) {
+                auto row = rows.Row(y, plane);
+                std::copy(row.begin(), row.end(), image.Row(first_row + y, plane).begin());
+            }
+        }
+    };
+    auto status = IncrementalDecoder::Status::NeedData;
+    for (size_t offset = 0; offset < data.size();) {
+        size_t size = std::min(next_size(offset), data.size() - offset);
+        decoder.Feed(data.subspan(offset, size));
+        offset += size;
+        status = decoder.Poll(callback);
+    }
+    decoder.Close();
+    if (status != IncrementalDecoder::Status::Done) {
+        status = decoder.Poll(callback);
+    }
+    EXPECT_EQ(status, IncrementalDecoder::Status::Done);
+    return image;
+}
+
+// Size of everything up to the entropy-coded data of the first scan.
+size_t HeaderSize(std::span<const uint8_t> jpeg) {
+    for (size_t i = 0; i + 3 < jpeg.size(); i++) {
+        if (jpeg[i] == 0xFF && jpeg[i + 1] == 0xDA) {
+            return i + 2 + (jpeg[i + 2] << 8 | jpeg[i + 3]);
+        }
+    }
+    return jpeg.size();
+}
+
+// The comment is parsed with the header; the data it was parsed from is moved by the following
+// feeds and partly released while the scan is decoded.
+TEST(IncrementalDecoder, KeepsCommentWhileDataMoves) {
+    std::string_view comment = "a comment long enough to outlive a few reallocations of the input";
+    auto jpeg = WithSegment(MakeSyntheticJpeg({.width = 160, .height = 160}), 0xFE,
+                            {reinterpret_cast<const uint8_t*>(comment.data()), comment.size()});
+    auto expected = Decode(jpeg);
+    EXPECT_EQ(expected.GetComment(), comment);
+    EXPECT_TRUE(SameImage(DecodeInPieces(jpeg, [](size_t) { return 1; }), expected));
+    size_t header = HeaderSize(jpeg);
+    auto header_first = [&](size_t offset) { return offset == 0 ? header : 1; };
+    EXPECT_TRUE(SameImage(DecodeInPieces(jpeg, header_first), expected));
+}
+
+// Whether the entropy-coded data holds both a stuffed 0xFF byte and a restart marker.
+bool HasStuffingAndRestarts(std::span<const uint8_t> jpeg) {
+    bool stuffing = false;
+    bool restart = false;
+    for (size_t i = HeaderSize(jpeg); i + 1 < jpeg.size(); i++) {
+        stuffing |= jpeg[i] == 0xFF && jpeg[i + 1] == 0x00;
+        restart |= jpeg[i] == 0xFF && jpeg[i + 1] >= 0xD0 && jpeg[i + 1] <= 0xD7;
+    }
+    return stuffing && restart;
+}
+
+class IncrementalPieces : public ::testing::TestWithParam<Subsampling> {
+protected:
+    void SetUp() override {
+        jpeg_ = MakeSyntheticJpeg(
+            {.width = 45, .height = 37, .subsampling = GetParam(), .restart_interval = 2});
+        ASSERT_TRUE(HasStuffingAndRestarts(jpeg_));
+        expected_ = Decode(jpeg_);
+    }
+
+    std::vector<uint8_t> jpeg_;
+    Image expected_;
+};
+
+TEST_P(IncrementalPieces, SingleBytes) {
+    EXPECT_TRUE(SameImage(DecodeInPieces(jpeg_, [](size_t) { return 1; }), expected_));
+}
+
+TEST_P(IncrementalPieces, OddSizes) {
+    for (size_t size : {3, 7, 13, 61, 255}) {
+        EXPECT_TRUE(SameImage(DecodeInPieces(jpeg_, [&](size_t) { return size; }), expected_))
+            << size;
+    }
+    const size_t sizes[] = {1, 5, 2, 11, 3, 97, 1, 1, 29};
+    size_t piece = 0;
+    auto varying = [&](size_t) { return sizes[piece++ % std::size(sizes)]; };
+    EXPECT_TRUE(SameImage(DecodeInPieces(jpeg_, varying), expected_));
+}
+
+// Splitting the file in two at every offset stops the first poll inside every marker segment,
+// between 0xFF and the zero stuffed after it and between the two bytes of every RST marker.
+TEST_P(IncrementalPieces, EverySplit) {
+    for (size_t split = 1; split < jpeg_.size(); split++) {
+        auto two = [&](size_t offset) { return offset == 0 ? split : jpeg_.size(); };
+        ASSERT_TRUE(SameImage(DecodeInPieces(jpeg_, two), expected_)) << split;
+    }
+}
+
+// Every other split also feeds the rest one byte at a time, so polls stop at each byte after it.
+TEST_P(IncrementalPieces, SplitThenSingleBytes) {
+    for (size_t split = 1; split < jpeg_.size(); split += 97) {
+        auto then_single = [&](size_t offset) { return offset == 0 ? split : 1; };
+        ASSERT_TRUE(SameImage(DecodeInPieces(jpeg_, then_single), expected_)) << split;
+    }
+}
+
+TEST_P(IncrementalPieces, PlanarOutput) {
+    DecodeOptions options;
+    options.format = PixelFormat::YCbCrPlanar;
+    auto expected = Decode(jpeg_, options);
+    EXPECT_TRUE(SameImage(DecodeInPieces(jpeg_, [](size_t) { return 7; }, options), expected));
+}
+
+INSTANTIATE_TEST_SUITE_P(Layouts, IncrementalPieces,
+                         ::testing::Values(Subsampling::Gray, Subsampling::S444,
+                                           Subsampling::S420, Subsampling::S411),
+                         [](const auto& info) { return LayoutName(info.param); });
+
+TEST(IncrementalDecoder, EverySplitWithoutRestarts) {
+    auto jpeg = MakeSyntheticJpeg({.width = 45, .height = 37, .subsampling = Subsampling::S422});
+    auto expected = Decode(jpeg);
+    for (size_t split = 1; split < jpeg.size(); split++) {
+        auto two = [&](size_t offset) { return offset == 0 ? split : jpeg.size(); };
+        ASSERT_TRUE(SameImage(DecodeInPieces(jpeg, two), expected)) << split;
+    }
+}
+
+}  // namespace
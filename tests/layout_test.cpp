@@ -0,0 +1,93 @@
+#include "decoder.h"
+#include "test_jpeg.h"
+#include "test_util.h"
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+namespace {
+
+struct Layout {
+    std::string name;
+    std::vector<Sampling> sampling;
+    int width;
+    int height;
+};
+
+struct Case {
+    Layout layout;
+    int restart_interval;
+};
+
+class SamplingLayout : public ::testing::TestWithParam<Case> {
+protected:
+    void SetUp() override {
+        const Layout& layout = GetParam().layout;
+        image_ = MakeCoefficients(layout.width, layout.height, layout.sampling,
+                                  GetParam().restart_interval);
+        jpeg_ = WriteBaseline(image_);
+    }
+
+    JpegCoefficients image_;
+    std::vector<uint8_t> jpeg_;
+};
+
+// The reference has exact transforms; a decoder's transforms and color conversion may each
+// round the other way.
+TEST_P(SamplingLayout, MatchesReference) {
+    for (auto method : {IdctMethod::IntegerSlow, IdctMethod::FloatAan, IdctMethod::Simd}) {
+        for (auto format : {PixelFormat::YCbCrPlanar, PixelFormat::Gray8, PixelFormat::RGB24}) {
+            DecodeOptions options;
+            options.idct_method = method;
+            options.format = format;
+            auto diff = Difference(Decode(jpeg_, options), ReferenceDecode(image_, format));
+            bool rgb = format == PixelFormat::RGB24;
+            EXPECT_LE(diff.max, rgb ? 3 : 1) << int(method) << " " << int(format);
+            EXPECT_LE(diff.mean, rgb ? 0.08 : 0.03) << int(method) << " " << int(format);
+        }
+    }
+}
+
+TEST_P(SamplingLayout, ReadsBackCoefficients) {
+    auto read = ReadCoefficients(jpeg_);
+    ASSERT_EQ(read.components.size(), image_.components.size());
+    for (size_t c = 0; c < read.components.size(); c++) {
+        EXPECT_EQ(read.components[c].coefficients, image_.components[c].coefficients) << c;
+    }
+}
+
+// An MCU holds at most ten blocks, so luma takes 4x2 or 2x4 at most next to 1x1 chroma.
+const Layout kLayouts[] = {
+    {"Gray", {{1, 1}}, 83, 61},
+    {"S444", {{1, 1}, {1, 1}, {1, 1}}, 83, 61},
+    {"S422", {{2, 1}, {1, 1}, {1, 1}}, 83, 61},
+    {"S420", {{2, 2}, {1, 1}, {1, 1}}, 83, 61},
+    {"S440", {{1, 2}, {1, 1}, {1, 1}}, 83, 61},
+    {"S411", {{4, 1}, {1, 1}, {1, 1}}, 83, 61},
+    {"S420Size4x4", {{2, 2}, {1, 1}, {1, 1}}, 4, 4},
+    {"S411Size5x3", {{4, 1}, {1, 1}, {1, 1}}, 5, 3},
+    {"S444Size1x1", {{1, 1}, {1, 1}, {1, 1}}, 1, 1},
+    {"S4x2", {{4, 2}, {1, 1}, {1, 1}}, 71, 45},
+    {"S2x4", {{2, 4}, {1, 1}, {1, 1}}, 37, 67},
+    {"S4x1Chroma2x1", {{4, 1}, {2, 1}, {2, 1}}, 71, 45},
+    {"S444As2x1", {{2, 1}, {2, 1}, {2, 1}}, 43, 27},
+};
+
+std::vector<Case> Cases() {
+    std::vector<Case> cases;
+    for (const Layout& layout : kLayouts) {
+        cases.push_back({layout, 0});
+        cases.push_back({layout, 3});
+    }
+    return cases;
+}
+
+INSTANTIATE_TEST_SUITE_P(Layouts, SamplingLayout, ::testing::ValuesIn(Cases()),
+                         [](const auto& info) {
+                             return info.param.layout.name +
+                                    (info.param.restart_interval ? "Restarts" : "");
+                         });
+
+}  // namespace
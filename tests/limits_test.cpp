@@ -0,0 +1,288 @@
+#include "decoder.h"
+#include "decoder/thread_pool.h"
+#include "test_jpeg.h"
+#include "test_util.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdlib>
+#include <functional>
+#include <new>
+#include <string>
+#include <vector>
+
+// Every allocation of the test program goes through these, so that a decode's peak memory can be
+// measured. Each block is prefixed with its size, in the bytes just before the pointer returned.
+
+namespace {
+
+std::atomic<size_t> live_bytes;
+std::atomic<size_t> peak_bytes;
+
+void* Allocate(size_t size, size_t alignment) {
+    size_t prefix = std::max(alignment, 2 * sizeof(size_t));
+    // aligned_alloc takes whole multiples of the alignment.
+    size_t total = (prefix + size + alignment - 1) / alignment * alignment;
+    auto* base = static_cast<char*>(alignment > alignof(std::max_align_t)
+                                        ? std::aligned_alloc(alignment, total)
+                                        : std::malloc(prefix + size));
+    if (!base) {
+        throw std::bad_alloc();
+    }
+    auto* block = base + prefix;
+    reinterpret_cast<size_t*>(block)[-1] = size;
+    reinterpret_cast<size_t*>(block)[-2] = prefix;
+    size_t live = live_bytes += size;
+    size_t peak = peak_bytes.load();
+    while (live > peak && !peak_bytes.compare_exchange_weak(peak, live)) {
+    }
+    return block;
+}
+
+void Free(void* pointer) {
+    if (!pointer) {
+        return;
+    }
+    auto* block = static_cast<char*>(pointer);
+    live_bytes -= reinterpret_cast<size_t*>(block)[-1];
+    std::free(block - reinterpret_cast<size_t*>(block)[-2]);
+}
+
+}  // namespace
+
+void* operator new(size_t size) {
+    return Allocate(size, alignof(std::max_align_t));
+}
+
+void* operator new(size_t size, std::align_val_t alignment) {
+    return Allocate(size, static_cast<size_t>(alignment));
+}
+
+void operator delete(void* pointer) noexcept {
+    Free(pointer);
+}
+
+void operator delete(void* pointer, size_t) noexcept {
+    Free(pointer);
+}
+
+void operator delete(void* pointer, std::align_val_t) noexcept {
+    Free(pointer);
+}
+
+void operator delete(void* pointer, size_t, std::align_val_t) noexcept {
+    Free(pointer);
+}
+
+namespace {
+
+// Most bytes allocated at once by `run` beyond what was live before it, its results included.
+size_t PeakBytes(const std::function<void()>& run) {
+    size_t before = live_bytes;
+    peak_bytes = before;
+    run();
+    return peak_bytes - before;
+}
+
+// Marker segments, their bytes and the entropy-coded bytes of a file as the limits count them.
+struct Counts {
+    size_t markers = 1;
+    size_t segment_bytes = 2;
+    size_t scan_bytes = 0;
+};
+
+Counts CountSegments(std::span<const uint8_t> jpeg) {
+    Counts counts;
+    size_t pos = 2;
+    while (pos + 1 < jpeg.size()) {
+        int marker = jpeg[pos + 1];
+        counts.markers++;
+        if (marker == 0xd9) {
+            counts.segment_bytes += 2;
+            break;
+        }
+        size_t length = jpeg[pos + 2] << 8 | jpeg[pos + 3];
+        pos += 2 + length;
+        counts.segment_bytes += 2 + length;
+        if (marker == 0xda) {
+            size_t start = pos;
+            while (jpeg[pos] != 0xff || jpeg[pos + 1] == 0 ||
+                   (jpeg[pos + 1] >= 0xd0 && jpeg[pos + 1] <= 0xd7)) {
+                pos++;
+            }
+            counts.scan_bytes += pos - start;
+        }
+    }
+    return counts;
+}
+
+struct Case {
+    std::string name;
+    bool progressive;
+    int restart_interval;
+};
+
+class Limits : public ::testing::TestWithParam<Case> {
+protected:
+    void SetUp() override {
+        const Sampling sampling[] = {{2, 2}, {1, 1}, {1, 1}};
+        auto image = MakeCoefficients(kWidth, kHeight, sampling, GetParam().restart_interval);
+        jpeg_ = GetParam().progressive ? WriteProgressive(image, StandardProgressiveScript(3))
+                                       : WriteBaseline(image);
+        expected_ = Decode(jpeg_);
+    }
+
+    // Decodes with `limits` as far as they allow and with one more unit of the limit, which
+    // decodes in full.
+    void ExpectLimit(DecodeLimit limit, const std::function<void(DecodeLimits&)>& tight,
+                     const std::function<void(DecodeLimits&)>& loose) {
+        DecodeOptions options;
+        tight(options.limits);
+        try {
+            Decode(jpeg_, options);
+            ADD_FAILURE() << "decoded within " << static_cast<int>(limit);
+        } catch (const LimitExceeded& error) {
+            EXPECT_EQ(error.Limit(), limit);
+        }
+        options.limits = {};
+        loose(options.limits);
+        EXPECT_TRUE(SameImage(Decode(jpeg_, options), expected_)) << static_cast<int>(limit);
+    }
+
+    static constexpr int kWidth = 97;
+    static constexpr int kHeight = 61;
+
+    std::vector<uint8_t> jpeg_;
+    Image expected_;
+};
+
+TEST_P(Limits, Pixels) {
+    uint64_t pixels = kWidth * kHeight;
+    ExpectLimit(
+        DecodeLimit::Pixels, [&](DecodeLimits& limits) { limits.max_pixels = pixels - 1; },
+        [&](DecodeLimits& limits) { limits.max_pixels = pixels; });
+}
+
+TEST_P(Limits, Memory) {
+    size_t memory = EstimateDecodeMemory(jpeg_);
+    ExpectLimit(
+        DecodeLimit::Memory, [&](DecodeLimits& limits) { limits.max_memory = memory - 1; },
+        [&](DecodeLimits& limits) { limits.max_memory = memory; });
+}
+
+TEST_P(Limits, Markers) {
+    size_t markers = CountSegments(jpeg_).markers;
+    ExpectLimit(
+        DecodeLimit::Markers, [&](DecodeLimits& limits) { limits.max_markers = markers - 1; },
+        [&](DecodeLimits& limits) { limits.max_markers = markers; });
+}
+
+TEST_P(Limits, SegmentBytes) {
+    size_t bytes = CountSegments(jpeg_).segment_bytes;
+    ExpectLimit(
+        DecodeLimit::SegmentBytes,
+        [&](DecodeLimits& limits) { limits.max_segment_bytes = bytes - 1; },
+        [&](DecodeLimits& limits) { limits.max_segment_bytes = bytes; });
+}
+
+TEST_P(Limits, ScanBytes) {
+    size_t bytes = CountSegments(jpeg_).scan_bytes;
+    ExpectLimit(
+        DecodeLimit::ScanBytes, [&](DecodeLimits& limits) { limits.max_scan_bytes = bytes - 1; },
+        [&](DecodeLimits& limits) { limits.max_scan_bytes = bytes; });
+}
+
+TEST_P(Limits, Deadline) {
+    auto now = std::chrono::steady_clock::now();
+    ExpectLimit(
+        DecodeLimit::Deadline,
+        [&](DecodeLimits& limits) { limits.deadline = now - std::chrono::seconds(1); },
+        [&](DecodeLimits& limits) { limits.deadline = now + std::chrono::hours(1); });
+}
+
+TEST_P(Limits, ZeroBoundsAreNotChecked) {
+    DecodeOptions options;
+    options.limits.max_pixels = 0;
+    options.limits.max_memory = 0;
+    options.limits.max_markers = 0;
+    options.limits.max_segment_bytes = 0;
+    options.limits.max_scan_bytes = 0;
+    EXPECT_TRUE(SameImage(Decode(jpeg_, options), expected_));
+}
+
+TEST_P(Limits, EstimateCoversPeakMemory) {
+    ThreadPool pool(3);
+    struct Variant {
+        std::string name;
+        std::function<void(DecodeOptions&)> apply;
+    };
+    const Variant variants[] = {
+        {"Default", [](DecodeOptions&) {}},
+        {"Fancy", [](DecodeOptions& options) { options.fancy_upsampling = true; }},
+        {"Planar", [](DecodeOptions& options) { options.format = PixelFormat::YCbCrPlanar; }},
+        {"Scale2", [](DecodeOptions& options) { options.scale = 2; }},
+        {"Scale8", [](DecodeOptions& options) { options.scale = 8; }},
+        {"Threads",
+         [&](DecodeOptions& options) {
+             options.threads = 4;
+             options.pool = &pool;
+         }},
+        {"ThreadsScale4",
+         [&](DecodeOptions& options) {
+             options.threads = 4;
+             options.pool = &pool;
+             options.scale = 4;
+             options.fancy_upsampling = true;
+         }},
+    };
+    for (const Variant& variant : variants) {
+        DecodeOptions options;
+        options.threads = 1;
+        variant.apply(options);
+        size_t estimate = EstimateDecodeMemory(jpeg_, options);
+        Image image;
+        size_t peak = PeakBytes([&] { image = Decode(jpeg_, options); });
+        EXPECT_GE(estimate, peak) << variant.name;
+    }
+}
+
+const Case kCases[] = {
+    {"Baseline", false, 0},
+    {"BaselineRestarts", false, 2},
+    {"Progressive", true, 0},
+    {"ProgressiveRestarts", true, 2},
+};
+
+INSTANTIATE_TEST_SUITE_P(Codings, Limits, ::testing::ValuesIn(kCases),
+                         [](const auto& info) { return info.param.name; });
+
+// The frame header alone asks for gigabytes, which are refused before any buffer is allocated.
+TEST(Limits, HugeFrameRejectedBeforeAllocating) {
+    const Sampling sampling[] = {{2, 2}, {1, 1}, {1, 1}};
+    auto jpeg = WriteBaseline(MakeCoefficients(16, 16, sampling));
+    size_t sof = 2;
+    while (jpeg[sof + 1] != 0xc0) {
+        sof += 2 + (jpeg[sof + 2] << 8 | jpeg[sof + 3]);
+    }
+    for (size_t i : {5, 6, 7, 8}) {
+        jpeg[sof + i] = 0xff;
+    }
+    DecodeOptions options;
+    options.limits.max_memory = 64 << 20;
+    EXPECT_GT(EstimateDecodeMemory(jpeg), options.limits.max_memory);
+    size_t peak = PeakBytes([&] {
+        try {
+            Decode(jpeg, options);
+            ADD_FAILURE() << "decoded a 65535x65535 frame";
+        } catch (const LimitExceeded& error) {
+            EXPECT_EQ(error.Limit(), DecodeLimit::Memory);
+        }
+    });
+    EXPECT_LT(peak, 1u << 20);
+}
+
+}  // namespace
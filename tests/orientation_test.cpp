@@ -0,0 +1,111 @@
+#include "decoder.h"
+#include "test_jpeg.h"
+#include "test_util.h"
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace {
+
+// EXIF with the orientation tag alone, in either TIFF byte order.
+std::vector<uint8_t> ExifOrientation(int orientation, bool little_endian) {
+    auto value = static_cast<uint8_t>(orientation);
+    if (little_endian) {
+        return {'E', 'x', 'i', 'f', 0, 0, 'I', 'I', 42, 0, 8, 0, 0, 0, 1, 0,
+                0x12, 0x01, 3, 0, 1, 0, 0, 0, value, 0, 0, 0, 0, 0, 0, 0};
+    }
+    return {'E', 'x', 'i', 'f', 0, 0, 'M', 'M', 0, 42, 0, 0, 0, 8, 0, 1,
+            0x01, 0x12, 0, 3, 0, 0, 0, 1, 0, value, 0, 0, 0, 0, 0, 0};
+}
+
+// Turns an image as stored upright as the TIFF orientation tag says: 2 to 4 mirror it, 5 transposes
+// it, and 6 to 8 transpose it and mirror the result.
+Image Turn(const Image& image, int orientation) {
+    size_t width = image.Width(), height = image.Height();
+    bool swap = orientation >= 5;
+    Image turned(swap ? height : width, swap ? width : height, image.Format());
+    for (size_t y = 0; y < turned.Height(); y++) {
+        for (size_t x = 0; x < turned.Width(); x++) {
+            size_t row = swap ? x : y, column = swap ? y : x;
+            if (orientation == 2 || orientation == 3 || orientation == 7 || orientation == 8) {
+                column = width - 1 - column;
+            }
+            if (orientation == 3 || orientation == 4 || orientation == 6 || orientation == 7) {
+                row = height - 1 - row;
+            }
+            turned.SetPixel(y, x, image.GetPixel(row, column));
+        }
+    }
+    return turned;
+}
+
+struct Layout {
+    std::string name;
+    std::vector<Sampling> sampling;
+};
+
+const Layout kLayouts[] = {
+    {"Gray", {{1, 1}}},
+    {"S444", {{1, 1}, {1, 1}, {1, 1}}},
+    {"S420", {{2, 2}, {1, 1}, {1, 1}}},
+};
+
+TEST(Orientation, MatchesTurnedPlainDecode) {
+    for (const Layout& layout : kLayouts) {
+        for (auto [width, height] : {std::pair{37, 23}, {16, 41}, {1, 9}}) {
+            auto jpeg = WriteBaseline(MakeCoefficients(width, height, layout.sampling));
+            for (auto format : {PixelFormat::RGB24, PixelFormat::Gray8, PixelFormat::YCbCrPlanar}) {
+                for (int scale : {1, 2, 8}) {
+                    DecodeOptions options;
+                    options.format = format;
+                    options.scale = scale;
+                    options.fancy_upsampling = scale == 2;
+                    auto plain = Decode(jpeg, options);
+                    options.apply_orientation = true;
+                    for (int orientation = 1; orientation <= 8; orientation++) {
+                        auto turned = WithSegment(jpeg, 0xe1, ExifOrientation(orientation, true));
+                        EXPECT_TRUE(SameImage(Decode(turned, options), Turn(plain, orientation)))
+                            << layout.name << " " << width << "x" << height << " "
+                            << int(format) << " /" << scale << " " << orientation;
+                    }
+                }
+            }
+        }
+    }
+}
+
+TEST(Orientation, ProgressiveMatchesTurnedPlainDecode) {
+    const Sampling sampling[] = {{2, 2}, {1, 1}, {1, 1}};
+    auto jpeg = WriteProgressive(MakeCoefficients(45, 29, sampling), StandardProgressiveScript(3));
+    DecodeOptions options;
+    auto plain = Decode(jpeg, options);
+    options.apply_orientation = true;
+    for (int orientation = 1; orientation <= 8; orientation++) {
+        auto turned = WithSegment(jpeg, 0xe1, ExifOrientation(orientation, false));
+        EXPECT_TRUE(SameImage(Decode(turned, options), Turn(plain, orientation))) << orientation;
+    }
+}
+
+TEST(Orientation, IgnoredUnlessApplied) {
+    const Sampling sampling[] = {{2, 2}, {1, 1}, {1, 1}};
+    auto jpeg = WriteBaseline(MakeCoefficients(37, 23, sampling));
+    auto turned = WithSegment(jpeg, 0xe1, ExifOrientation(6, false));
+    EXPECT_TRUE(SameImage(Decode(turned), Decode(jpeg)));
+}
+
+TEST(Orientation, ProbedInEitherByteOrder) {
+    const Sampling sampling[] = {{1, 1}};
+    auto jpeg = WriteBaseline(MakeCoefficients(16, 16, sampling));
+    EXPECT_EQ(ProbeJpeg(jpeg).orientation, 1);
+    for (bool little_endian : {true, false}) {
+        for (int orientation = 1; orientation <= 8; orientation++) {
+            auto turned = WithSegment(jpeg, 0xe1, ExifOrientation(orientation, little_endian));
+            EXPECT_EQ(ProbeJpeg(turned).orientation, orientation) << little_endian;
+        }
+    }
+}
+
+}  // namespace
@@ -0,0 +1,113 @@
+#include "decoder.h"
+#include "test_jpeg.h"
+#include "test_util.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <span>
+#include <string_view>
+#include <vector>
+
+namespace {
+
+std::vector<uint8_t> Bytes(std::string_view text) {
+    return {text.begin(), text.end()};
+}
+
+// Size of everything up to the entropy-coded data of the first scan.
+size_t HeaderSize(std::span<const uint8_t> jpeg) {
+    size_t pos = 2;
+    while (jpeg[pos + 1] != 0xda) {
+        pos += 2 + (jpeg[pos + 2] << 8 | jpeg[pos + 3]);
+    }
+    return pos + 2 + (jpeg[pos + 2] << 8 | jpeg[pos + 3]);
+}
+
+void ExpectFrame(const JpegInfo& info, const JpegCoefficients& image, bool progressive) {
+    EXPECT_EQ(info.width, image.info.width);
+    EXPECT_EQ(info.height, image.info.height);
+    EXPECT_EQ(info.precision, 8);
+    EXPECT_EQ(info.progressive, progressive);
+    EXPECT_EQ(info.restart_interval, image.info.restart_interval);
+    ASSERT_EQ(info.components.size(), image.info.components.size());
+    for (size_t c = 0; c < info.components.size(); c++) {
+        EXPECT_EQ(info.components[c].id, image.info.components[c].id) << c;
+        EXPECT_EQ(info.components[c].horizontal, image.info.components[c].horizontal) << c;
+        EXPECT_EQ(info.components[c].vertical, image.info.components[c].vertical) << c;
+        EXPECT_EQ(info.components[c].quant_table, image.info.components[c].quant_table) << c;
+    }
+}
+
+TEST(Probe, ReadsFrameHeader) {
+    const Sampling gray[] = {{1, 1}};
+    const Sampling s420[] = {{2, 2}, {1, 1}, {1, 1}};
+    const Sampling s422[] = {{2, 1}, {1, 1}, {1, 1}};
+    for (auto sampling : {std::span<const Sampling>(gray), std::span<const Sampling>(s420),
+                          std::span<const Sampling>(s422)}) {
+        for (int restart_interval : {0, 5}) {
+            auto image = MakeCoefficients(83, 61, sampling, restart_interval);
+            int components = static_cast<int>(sampling.size());
+            ExpectFrame(ProbeJpeg(WriteBaseline(image)), image, false);
+            ExpectFrame(ProbeJpeg(WriteProgressive(image, StandardProgressiveScript(components))),
+                        image, true);
+        }
+    }
+}
+
+// Segments are inserted right after SOI, so the last one inserted comes first in the file.
+TEST(Probe, LocatesSegments) {
+    const Sampling sampling[] = {{2, 2}, {1, 1}, {1, 1}};
+    auto jpeg = WriteBaseline(MakeCoefficients(40, 24, sampling));
+    auto comment = Bytes("made by a test");
+    auto exif = Bytes("Exif");
+    exif.resize(40, 0);
+    auto icc = Bytes("ICC_PROFILE");
+    icc.resize(300, 7);
+    jpeg = WithSegment(jpeg, 0xfe, comment);
+    jpeg = WithSegment(jpeg, 0xe2, icc);
+    jpeg = WithSegment(jpeg, 0xe1, exif);
+    auto info = ProbeJpeg(jpeg);
+    size_t exif_offset = 2 + 4;
+    size_t icc_offset = exif_offset + exif.size() + 4;
+    size_t comment_offset = icc_offset + icc.size() + 4;
+    ASSERT_EQ(info.app_segments.size(), 2u);
+    EXPECT_EQ(info.app_segments[0].marker, 0xe1);
+    EXPECT_EQ(info.app_segments[0].offset, exif_offset);
+    EXPECT_EQ(info.app_segments[0].size, exif.size());
+    EXPECT_EQ(info.app_segments[1].marker, 0xe2);
+    EXPECT_EQ(info.app_segments[1].offset, icc_offset);
+    EXPECT_EQ(info.app_segments[1].size, icc.size());
+    ASSERT_TRUE(info.comment);
+    EXPECT_EQ(info.comment->marker, 0xfe);
+    EXPECT_EQ(info.comment->offset, comment_offset);
+    EXPECT_EQ(info.comment->size, comment.size());
+    EXPECT_TRUE(std::equal(comment.begin(), comment.end(), jpeg.begin() + comment_offset));
+}
+
+TEST(Probe, NoSegments) {
+    const Sampling sampling[] = {{1, 1}};
+    auto info = ProbeJpeg(WriteBaseline(MakeCoefficients(16, 16, sampling)));
+    EXPECT_TRUE(info.app_segments.empty());
+    EXPECT_FALSE(info.comment);
+}
+
+// The entropy-coded data is never read, so a file cut right after its scan header probes the
+// same; one cut halfway through its headers does not.
+TEST(Probe, StopsAtFirstScanHeader) {
+    const Sampling sampling[] = {{2, 2}, {1, 1}, {1, 1}};
+    for (bool progressive : {false, true}) {
+        auto image = MakeCoefficients(83, 61, sampling, 4);
+        auto jpeg = progressive ? WriteProgressive(image, StandardProgressiveScript(3))
+                                : WriteBaseline(image);
+        jpeg = WithSegment(jpeg, 0xfe, Bytes("comment"));
+        jpeg.resize(HeaderSize(jpeg));
+        auto info = ProbeJpeg(jpeg);
+        ExpectFrame(info, image, progressive);
+        EXPECT_TRUE(info.comment);
+        jpeg.resize(jpeg.size() / 2);
+        EXPECT_THROW(ProbeJpeg(jpeg), std::runtime_error) << progressive;
+    }
+}
+
+}  // namespace
@@ -0,0 +1,246 @@
+#include "decoder.h"
+#include "test_jpeg.h"
+#include "test_util.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <span>
+#include <string>
+#include <vector>
+
+namespace {
+
+struct Layout {
+    std::string name;
+    std::vector<Sampling> sampling;
+};
+
+struct Case {
+    Layout layout;
+    int restart_interval;
+};
+
+// Bands split without successive approximation, with the DC of color images in separate scans.
+std::vector<ScanSpec> SpectralScript(int components) {
+    std::vector<ScanSpec> scans;
+    for (int c = 0; c < components; c++) {
+        scans.push_back({{c}, 0, 0, 0, 0});
+    }
+    for (int c = components - 1; c >= 0; c--) {
+        scans.push_back({{c}, 1, 2, 0, 0});
+        scans.push_back({{c}, 3, 9, 0, 0});
+        scans.push_back({{c}, 10, 63, 0, 0});
+    }
+    return scans;
+}
+
+// Every coefficient arrives in bits: the DC from bit 3 down and the AC bands from bit 4 down,
+// so that most nonzero coefficients become nonzero in a refinement scan.
+std::vector<ScanSpec> RefinementScript(int components) {
+    std::vector<int> all;
+    for (int c = 0; c < components; c++) {
+        all.push_back(c);
+    }
+    std::vector<ScanSpec> scans = {{all, 0, 0, 0, 3}};
+    for (int c = 0; c < components; c++) {
+        scans.push_back({{c}, 1, 9, 0, 4});
+        scans.push_back({{c}, 10, 63, 0, 4});
+    }
+    for (int bit = 2; bit >= 0; bit--) {
+        scans.push_back({all, 0, 0, bit + 1, bit});
+    }
+    for (int bit = 3; bit >= 0; bit--) {
+        for (int c = 0; c < components; c++) {
+            scans.push_back({{c}, 1, 9, bit + 1, bit});
+            scans.push_back({{c}, 10, 63, bit + 1, bit});
+        }
+    }
+    return scans;
+}
+
+// Keeps the DC coefficients with their `dropped` low bits cleared and zeroes every AC one.
+JpegCoefficients DcOnly(JpegCoefficients image, int dropped = 0) {
+    for (auto& component : image.components) {
+        for (size_t i = 0; i < component.coefficients.size(); i++) {
+            auto& value = component.coefficients[i];
+            value = i % 64 == 0 ? static_cast<int16_t>(value >> dropped << dropped) : 0;
+        }
+    }
+    return image;
+}
+
+// Blocks covering a component's samples along one side of the image.
+size_t Blocks(size_t size, int factor, int max_factor) {
+    size_t samples = (size * factor + max_factor - 1) / max_factor;
+    return (samples + 7) / 8;
+}
+
+class Progressive : public ::testing::TestWithParam<Case> {
+protected:
+    void SetUp() override {
+        image_ = MakeCoefficients(83, 61, GetParam().layout.sampling, GetParam().restart_interval);
+        components_ = static_cast<int>(image_.components.size());
+        baseline_ = WriteBaseline(image_);
+    }
+
+    // Decodes as the baseline encoding of the same coefficients does, to the pixel.
+    void ExpectSameAsBaseline(std::span<const ScanSpec> scans) {
+        auto jpeg = WriteProgressive(image_, scans);
+        for (auto format : {PixelFormat::YCbCrPlanar, PixelFormat::Gray8, PixelFormat::RGB24}) {
+            for (bool fancy : {false, true}) {
+                DecodeOptions options;
+                options.format = format;
+                options.fancy_upsampling = fancy;
+                EXPECT_TRUE(SameImage(Decode(jpeg, options), Decode(baseline_, options)))
+                    << int(format) << " " << fancy;
+            }
+        }
+    }
+
+    JpegCoefficients image_;
+    int components_ = 0;
+    std::vector<uint8_t> baseline_;
+};
+
+TEST_P(Progressive, StandardScriptMatchesReference) {
+    auto jpeg = WriteProgressive(image_, StandardProgressiveScript(components_));
+    for (auto method : {IdctMethod::IntegerSlow, IdctMethod::FloatAan, IdctMethod::Simd}) {
+        for (auto format : {PixelFormat::YCbCrPlanar, PixelFormat::RGB24}) {
+            DecodeOptions options;
+            options.idct_method = method;
+            options.format = format;
+            auto diff = Difference(Decode(jpeg, options), ReferenceDecode(image_, format));
+            bool rgb = format == PixelFormat::RGB24;
+            EXPECT_LE(diff.max, rgb ? 3 : 1) << int(method) << " " << int(format);
+            EXPECT_LE(diff.mean, rgb ? 0.08 : 0.03) << int(method) << " " << int(format);
+        }
+    }
+}
+
+TEST_P(Progressive, StandardScriptMatchesBaseline) {
+    ExpectSameAsBaseline(StandardProgressiveScript(components_));
+}
+
+TEST_P(Progressive, SpectralSelectionMatchesBaseline) {
+    ExpectSameAsBaseline(SpectralScript(components_));
+}
+
+TEST_P(Progressive, RefinementMatchesBaseline) {
+    ExpectSameAsBaseline(RefinementScript(components_));
+}
+
+TEST_P(Progressive, ReadsBackCoefficients) {
+    auto read = ReadCoefficients(WriteProgressive(image_, RefinementScript(components_)));
+    ASSERT_EQ(read.components.size(), image_.components.size());
+    for (size_t c = 0; c < read.components.size(); c++) {
+        const auto& expected = image_.components[c];
+        const auto& actual = read.components[c];
+        ASSERT_EQ(actual.coefficients.size(), expected.coefficients.size()) << c;
+        // Blocks outside the component's samples are only coded in interleaved scans.
+        const auto& sampling = GetParam().layout.sampling;
+        size_t width = Blocks(83, expected.info.horizontal, sampling[0].horizontal);
+        size_t height = Blocks(61, expected.info.vertical, sampling[0].vertical);
+        for (size_t row = 0; row < height; row++) {
+            for (size_t column = 0; column < width; column++) {
+                auto a = actual.Block(row, column);
+                auto b = expected.Block(row, column);
+                ASSERT_TRUE(std::equal(a.begin(), a.end(), b.begin())) << c << " " << row << " "
+                                                                       << column;
+            }
+        }
+    }
+}
+
+// The DC refinement scans are decoded and the AC scans skipped.
+TEST_P(Progressive, DcOnlyMatchesBaselineOfDcCoefficients) {
+    auto expected_jpeg = WriteBaseline(DcOnly(image_));
+    for (const auto& scans : {StandardProgressiveScript(components_),
+                              SpectralScript(components_), RefinementScript(components_)}) {
+        auto jpeg = WriteProgressive(image_, scans);
+        for (auto format : {PixelFormat::YCbCrPlanar, PixelFormat::RGB24}) {
+            DecodeOptions options;
+            options.format = format;
+            options.dc_only = true;
+            auto expected = Decode(expected_jpeg, options);
+            EXPECT_TRUE(SameImage(Decode(jpeg, options), expected)) << int(format);
+        }
+    }
+}
+
+// Each call renders the scans so far: the first holds the DC with its approximated low bit
+// cleared, and the last is the full decode.
+TEST_P(Progressive, CallbackFiresOncePerScan) {
+    auto scans = StandardProgressiveScript(components_);
+    auto jpeg = WriteProgressive(image_, scans);
+    DecodeOptions options;
+    options.format = PixelFormat::YCbCrPlanar;
+    auto first = Decode(WriteBaseline(DcOnly(image_, scans[0].approx_low)), options);
+    std::vector<int> calls;
+    Image last;
+    DecodeProgressive(
+        jpeg,
+        [&](int count, const Image& image) {
+            if (calls.empty()) {
+                EXPECT_TRUE(SameImage(image, first));
+            }
+            calls.push_back(count);
+            last = image;
+            return true;
+        },
+        options);
+    ASSERT_EQ(calls.size(), scans.size());
+    for (size_t i = 0; i < calls.size(); i++) {
+        EXPECT_EQ(calls[i], static_cast<int>(i) + 1);
+    }
+    EXPECT_TRUE(SameImage(last, Decode(jpeg, options)));
+}
+
+TEST_P(Progressive, CallbackStopsDecoding) {
+    auto jpeg = WriteProgressive(image_, StandardProgressiveScript(components_));
+    int calls = 0;
+    DecodeProgressive(jpeg, [&](int, const Image&) { return ++calls < 2; });
+    EXPECT_EQ(calls, 2);
+}
+
+TEST_P(Progressive, BaselineHasOneScan) {
+    int calls = 0;
+    DecodeOptions options;
+    options.format = PixelFormat::YCbCrPlanar;
+    auto expected = Decode(baseline_, options);
+    DecodeProgressive(
+        baseline_,
+        [&](int count, const Image& image) {
+            EXPECT_EQ(count, 1);
+            EXPECT_TRUE(SameImage(image, expected));
+            calls++;
+            return true;
+        },
+        options);
+    EXPECT_EQ(calls, 1);
+}
+
+const Layout kLayouts[] = {
+    {"Gray", {{1, 1}}},
+    {"S444", {{1, 1}, {1, 1}, {1, 1}}},
+    {"S420", {{2, 2}, {1, 1}, {1, 1}}},
+    {"S422", {{2, 1}, {1, 1}, {1, 1}}},
+    {"S411", {{4, 1}, {1, 1}, {1, 1}}},
+};
+
+std::vector<Case> Cases() {
+    std::vector<Case> cases;
+    for (const Layout& layout : kLayouts) {
+        cases.push_back({layout, 0});
+        cases.push_back({layout, 3});
+    }
+    return cases;
+}
+
+INSTANTIATE_TEST_SUITE_P(Layouts, Progressive, ::testing::ValuesIn(Cases()),
+                         [](const auto& info) {
+                             return info.param.layout.name +
+                                    (info.param.restart_interval ? "Restarts" : "");
+                         });
+
+}  // namespace
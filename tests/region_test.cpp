@@ -0,0 +1,129 @@
+#include "decoder.h"
+#include "synthetic_jpeg.h"
+#include "test_util.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <vector>
+
+namespace {
+
+Image Crop(const Image& image, const Rect& rect) {
+    Image crop(rect.width, rect.height, image.Format());
+    size_t bytes = BytesPerPixel(image.Format());
+    for (size_t plane = 0; plane < PlaneCount(image.Format()); plane++) {
+        for (size_t y = 0; y < rect.height; y++) {
+            auto row = image.Row(rect.y + y, plane).subspan(rect.x * bytes, rect.width * bytes);
+            std::copy(row.begin(), row.end(), crop.Row(y, plane).begin());
+        }
+    }
+    return crop;
+}
+
+// Rectangles within a `width` x `height` image: unaligned to any MCU, single pixels at the
+// corners and inside, rows and columns, ones touching the right and bottom edges, and the whole
+// image.
+std::vector<Rect> Regions(size_t width, size_t height) {
+    std::vector<Rect> regions = {
+        {0, 0, width, height},
+        {3, 5, width / 2, height / 3},
+        {width / 3, height / 4, width / 2, height / 2},
+        {0, 0, 1, 1},
+        {width - 1, height - 1, 1, 1},
+        {width / 2, height / 2, 1, 1},
+        {width - 1, 0, 1, height},
+        {0, height - 1, width, 1},
+        {width / 2 + 1, height / 2 + 3, width - width / 2 - 1, height - height / 2 - 3},
+        {7, 9, width - 7, height - 9},
+        {17, 0, 9, height},
+    };
+    regions.erase(std::remove_if(regions.begin(), regions.end(),
+                                 [&](const Rect& r) {
+                                     // Sizes computed for a larger image wrap around.
+                                     return r.width == 0 || r.height == 0 || r.x >= width ||
+                                            r.y >= height || r.width > width - r.x ||
+                                            r.height > height - r.y;
+                                 }),
+                  regions.end());
+    return regions;
+}
+
+struct Case {
+    Subsampling layout;
+    int restart_interval;
+};
+
+class Region : public ::testing::TestWithParam<Case> {
+protected:
+    void SetUp() override {
+        jpeg_ = MakeSyntheticJpeg({.width = 83,
+                                   .height = 61,
+                                   .subsampling = GetParam().layout,
+                                   .restart_interval = GetParam().restart_interval});
+    }
+
+    // Every region of the decode with `options` equals the same crop of the whole image.
+    void ExpectCrops(DecodeOptions options) {
+        auto full = Decode(jpeg_, options);
+        for (const Rect& rect : Regions(full.Width(), full.Height())) {
+            options.region = rect;
+            EXPECT_TRUE(SameImage(Decode(jpeg_, options), Crop(full, rect)))
+                << rect.x << "," << rect.y << " " << rect.width << "x" << rect.height;
+        }
+    }
+
+    std::vector<uint8_t> jpeg_;
+};
+
+TEST_P(Region, EqualsCrop) {
+    ExpectCrops({});
+}
+
+TEST_P(Region, EqualsCropWithFancyUpsampling) {
+    DecodeOptions options;
+    options.fancy_upsampling = true;
+    ExpectCrops(options);
+}
+
+TEST_P(Region, EqualsCropOfScaledImage) {
+    for (int scale : {2, 4, 8}) {
+        DecodeOptions options;
+        options.scale = scale;
+        options.fancy_upsampling = scale == 2;
+        ExpectCrops(options);
+    }
+}
+
+TEST_P(Region, EqualsCropInOtherFormats) {
+    for (auto format : {PixelFormat::Gray8, PixelFormat::YCbCrPlanar}) {
+        DecodeOptions options;
+        options.format = format;
+        ExpectCrops(options);
+    }
+}
+
+TEST_P(Region, RectOverloadMatchesOption) {
+    Rect rect{5, 6, 40, 30};
+    DecodeOptions options;
+    options.region = rect;
+    EXPECT_TRUE(SameImage(Decode(jpeg_, rect), Decode(jpeg_, options)));
+}
+
+TEST_P(Region, RejectsRegionsOutsideTheImage) {
+    for (Rect rect : {Rect{0, 0, 84, 61}, Rect{83, 0, 1, 1}, Rect{0, 60, 1, 2}, Rect{0, 0, 0, 1}}) {
+        EXPECT_THROW(Decode(jpeg_, rect), std::runtime_error);
+    }
+}
+
+INSTANTIATE_TEST_SUITE_P(Layouts, Region,
+                         ::testing::Values(Case{Subsampling::Gray, 0}, Case{Subsampling::S444, 0},
+                                           Case{Subsampling::S422, 0}, Case{Subsampling::S420, 0},
+                                           Case{Subsampling::S420, 3}, Case{Subsampling::S440, 0},
+                                           Case{Subsampling::S411, 2}),
+                         [](const auto& info) {
+                             return LayoutName(info.param.layout) +
+                                    (info.param.restart_interval ? "Restarts" : "");
+                         });
+
+}  // namespace
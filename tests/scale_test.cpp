@@ -0,0 +1,69 @@
+#include "decoder.h"
+#include "synthetic_jpeg.h"
+#include "test_util.h"
+
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <cstdlib>
+
+namespace {
+
+const Subsampling kLayouts[] = {Subsampling::Gray, Subsampling::S444, Subsampling::S422,
+                                Subsampling::S420, Subsampling::S440, Subsampling::S411};
+
+TEST(Scale, OutputIsCeilOfSizeOverScale) {
+    for (auto layout : kLayouts) {
+        for (auto [width, height] : {std::pair{1, 1}, {7, 9}, {33, 17}, {64, 48}, {101, 67}}) {
+            auto jpeg = MakeSyntheticJpeg(
+                {.width = width, .height = height, .subsampling = layout});
+            for (int scale : {1, 2, 4, 8}) {
+                DecodeOptions options;
+                options.scale = scale;
+                auto image = Decode(jpeg, options);
+                EXPECT_EQ(image.Width(), size_t((width + scale - 1) / scale))
+                    << LayoutName(layout) << " " << width << "x" << height << " /" << scale;
+                EXPECT_EQ(image.Height(), size_t((height + scale - 1) / scale))
+                    << LayoutName(layout) << " " << width << "x" << height << " /" << scale;
+            }
+        }
+    }
+}
+
+// A scaled decode is close to the full decode averaged over each group of pixels: the mean
+// difference per channel stays small.
+TEST(Scale, ApproximatesBoxFilteredFullDecode) {
+    for (auto layout : kLayouts) {
+        auto jpeg = MakeSyntheticJpeg({.width = 96, .height = 80, .subsampling = layout});
+        auto full = Decode(jpeg);
+        for (int scale : {2, 4, 8}) {
+            DecodeOptions options;
+            options.scale = scale;
+            auto image = Decode(jpeg, options);
+            double error = 0;
+            for (size_t y = 0; y < image.Height(); y++) {
+                for (size_t x = 0; x < image.Width(); x++) {
+                    int sums[3] = {};
+                    for (int i = 0; i < scale * scale; i++) {
+                        auto pixel = full.GetPixel(y * scale + i / scale, x * scale + i % scale);
+                        sums[0] += pixel.r;
+                        sums[1] += pixel.g;
+                        sums[2] += pixel.b;
+                    }
+                    auto pixel = image.GetPixel(y, x);
+                    int values[3] = {pixel.r, pixel.g, pixel.b};
+                    for (int c = 0; c < 3; c++) {
+                        error += std::abs(values[c] - double(sums[c]) / (scale * scale));
+                    }
+                }
+            }
+            error /= 3.0 * image.Width() * image.Height();
+            // Subsampled chroma is scaled by its own reduced transform and replicated, which
+            // drifts further from the box filter than luma does.
+            EXPECT_LT(error, layout == Subsampling::Gray ? 0.5 : 8.0)
+                << LayoutName(layout) << " /" << scale;
+        }
+    }
+}
+
+}  // namespace
@@ -0,0 +1,111 @@
+#include "decoder.h"
+#include "test_jpeg.h"
+#include "test_util.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+namespace {
+
+struct Case {
+    std::string name;
+    bool progressive;
+    bool fancy;
+    PixelFormat format;
+};
+
+class Scanlines : public ::testing::TestWithParam<Case> {
+protected:
+    void SetUp() override {
+        const Sampling sampling[] = {{2, 2}, {1, 1}, {1, 1}};
+        auto image = MakeCoefficients(kWidth, kHeight, sampling);
+        jpeg_ = GetParam().progressive ? WriteProgressive(image, StandardProgressiveScript(3))
+                                       : WriteBaseline(image);
+        options_.format = GetParam().format;
+        options_.fancy_upsampling = GetParam().fancy;
+        expected_ = Decode(jpeg_, options_);
+    }
+
+    // Odd and not a multiple of the 16-row MCU height.
+    static constexpr int kWidth = 45;
+    static constexpr int kHeight = 57;
+
+    std::vector<uint8_t> jpeg_;
+    DecodeOptions options_;
+    Image expected_;
+};
+
+TEST_P(Scanlines, ReadInChunksMatchesDecode) {
+    for (size_t chunk : {1, 7, 16, 40}) {
+        ScanlineDecoder decoder(jpeg_, options_);
+        ASSERT_EQ(decoder.Width(), size_t(kWidth));
+        ASSERT_EQ(decoder.Height(), size_t(kHeight));
+        Image rows(kWidth, chunk, options_.format);
+        Image image(kWidth, kHeight, options_.format);
+        for (size_t y = 0; y < size_t(kHeight);) {
+            ASSERT_EQ(decoder.NextScanline(), y) << chunk;
+            size_t read = decoder.ReadScanlines(rows, chunk);
+            ASSERT_EQ(read, std::min(chunk, kHeight - y)) << chunk << " " << y;
+            for (size_t plane = 0; plane < PlaneCount(options_.format); plane++) {
+                for (size_t k = 0; k < read; k++) {
+                    auto row = rows.Row(k, plane);
+                    std::copy(row.begin(), row.end(), image.Row(y + k, plane).begin());
+                }
+            }
+            y += read;
+        }
+        EXPECT_EQ(decoder.NextScanline(), size_t(kHeight)) << chunk;
+        EXPECT_EQ(decoder.ReadScanlines(rows, chunk), 0u) << chunk;
+        EXPECT_EQ(decoder.NextScanline(), size_t(kHeight)) << chunk;
+        EXPECT_TRUE(SameImage(image, expected_)) << chunk;
+    }
+}
+
+TEST_P(Scanlines, BandsTileTheImage) {
+    Image image(kWidth, kHeight, options_.format);
+    size_t next = 0;
+    DecodeScanlines(
+        jpeg_,
+        [&](size_t first_row, const Image& rows) {
+            ASSERT_EQ(first_row, next);
+            ASSERT_GT(rows.Height(), 0u);
+            ASSERT_LE(first_row + rows.Height(), size_t(kHeight));
+            ASSERT_EQ(rows.Width(), size_t(kWidth));
+            ASSERT_EQ(rows.Format(), options_.format);
+            for (size_t plane = 0; plane < PlaneCount(rows.Format()); plane++) {
+                for (size_t y = 0; y < rows.Height(); y++) {
+                    auto row = rows.Row(y, plane);
+                    std::copy(row.begin(), row.end(), image.Row(first_row + y, plane).begin());
+                }
+            }
+            next = first_row + rows.Height();
+        },
+        options_);
+    EXPECT_EQ(next, size_t(kHeight));
+    EXPECT_TRUE(SameImage(image, expected_));
+}
+
+TEST_P(Scanlines, RejectsMismatchedBuffer) {
+    ScanlineDecoder decoder(jpeg_, options_);
+    Image narrow(kWidth - 1, 8, options_.format);
+    EXPECT_THROW(decoder.ReadScanlines(narrow, 8), std::runtime_error);
+    Image short_rows(kWidth, 4, options_.format);
+    EXPECT_THROW(decoder.ReadScanlines(short_rows, 8), std::runtime_error);
+    EXPECT_EQ(decoder.NextScanline(), 0u);
+}
+
+const Case kCases[] = {
+    {"Baseline", false, false, PixelFormat::RGB24},
+    {"BaselineFancy", false, true, PixelFormat::RGB24},
+    {"BaselineFancyPlanar", false, true, PixelFormat::YCbCrPlanar},
+    {"Progressive", true, false, PixelFormat::RGB24},
+    {"ProgressiveFancy", true, true, PixelFormat::RGB24},
+};
+
+INSTANTIATE_TEST_SUITE_P(S420, Scanlines, ::testing::ValuesIn(kCases),
+                         [](const auto& info) { return info.param.name; });
+
+}  // namespace
@@ -0,0 +1,67 @@
+#include "decoder.h"
+#include "test_jpeg.h"
+
+#include <gtest/gtest.h>
+
+#include <vector>
+
+static_assert(JPEG_DECODER_STATS, "the statistics tests need the counters compiled in");
+
+namespace {
+
+// A gray 32x8 progressive image of four flat blocks: a DC scan, then an AC scan that codes all
+// four blocks with one EOB2 symbol, with tables holding a single one-bit code each.
+std::vector<uint8_t> EobRunJpeg() {
+    // SOI, then DQT 0 of all ones.
+    std::vector<uint8_t> jpeg = {0xff, 0xd8, 0xff, 0xdb, 0x00, 0x43, 0x00};
+    jpeg.insert(jpeg.end(), 64, 1);
+    jpeg.insert(jpeg.end(), {
+        // SOF2, 8 bits, 8x32, one component.
+        0xff, 0xc2, 0x00, 0x0b, 0x08, 0x00, 0x08, 0x00, 0x20, 0x01, 0x01, 0x11, 0x00,
+        // DC table 0 with symbol 0 and AC table 0 with symbol 0x20.
+        0xff, 0xc4, 0x00, 0x14, 0x00, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x00,
+        0xff, 0xc4, 0x00, 0x14, 0x10, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x20,
+        // DC scan: four zero differences.
+        0xff, 0xda, 0x00, 0x08, 0x01, 0x01, 0x00, 0x00, 0x00, 0x00, 0x0f,
+        // AC scan 1 to 63: EOB2 with extra bits 00, a run of four blocks.
+        0xff, 0xda, 0x00, 0x08, 0x01, 0x01, 0x00, 0x01, 0x3f, 0x00, 0x1f,
+        0xff, 0xd9});
+    return jpeg;
+}
+
+TEST(Stats, CountsBaselineBlocks) {
+    const Sampling sampling[] = {{2, 2}, {1, 1}, {1, 1}};
+    auto image = MakeCoefficients(37, 23, sampling);
+    // Blocks whose last zigzag coefficient is zero end with an end-of-block symbol.
+    uint64_t eobs = 0;
+    for (const auto& component : image.components) {
+        for (size_t i = 63; i < component.coefficients.size(); i += 64) {
+            eobs += component.coefficients[i] == 0;
+        }
+    }
+    DecodeStats stats;
+    DecodeOptions options;
+    options.stats = &stats;
+    Decode(WriteBaseline(image), options);
+    EXPECT_EQ(stats.mcus, 3u * 2);
+    EXPECT_EQ(stats.blocks, 3u * 2 * 6);
+    EXPECT_EQ(stats.eobs, eobs);
+    EXPECT_GT(stats.zero_runs, 0u);
+}
+
+TEST(Stats, CountsEobRunsOfProgressiveScans) {
+    DecodeStats stats;
+    DecodeOptions options;
+    options.format = PixelFormat::Gray8;
+    options.stats = &stats;
+    auto image = Decode(EobRunJpeg(), options);
+    EXPECT_EQ(image.Width(), 32u);
+    EXPECT_EQ(image.GetPixel(3, 20).r, 128);
+    EXPECT_EQ(stats.mcus, 8u);
+    EXPECT_EQ(stats.blocks, 8u);
+    EXPECT_EQ(stats.huffman_symbols, 5u);
+    EXPECT_EQ(stats.eobs, 1u);
+    EXPECT_EQ(stats.zero_runs, 0u);
+}
+
+}  // namespace
@@ -0,0 +1,502 @@
+#include "test_jpeg.h"
+
+#include "synthetic_jpeg.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <numbers>
+#include <stdexcept>
+
+namespace {
+
+constexpr int kZigZag[64] = {0,  1,  8,  16, 9,  2,  3,  10, 17, 24, 32, 25, 18, 11, 4,  5,
+                             12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13, 6,  7,  14, 21, 28,
+                             35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+                             58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63};
+
+double Basis(int u, int x) {
+    double scale = u == 0 ? std::numbers::sqrt2 / 2 : 1.0;
+    return scale * std::cos((2 * x + 1) * u * std::numbers::pi / 16);
+}
+
+uint32_t Hash(uint32_t x, uint32_t y) {
+    uint32_t h = x * 0x9e3779b1u ^ y * 0x85ebca77u;
+    h ^= h >> 15;
+    h *= 0x2c1b3c6du;
+    return h ^ (h >> 12);
+}
+
+int Sample(int component, int x, int y) {
+    double value;
+    int noise = static_cast<int>(Hash(x + 1000 * component, y) % 33) - 16;
+    switch (component) {
+        case 0:
+            value = 128 + 70 * std::sin(x * 0.21 + y * 0.05) + ((x / 13 + y / 9) % 3 - 1) * 30 +
+                    noise;
+            break;
+        case 1:
+            value = 128 + 50 * std::cos(y * 0.13) + noise / 2;
+            break;
+        default:
+            value = 128 + 40 * std::sin(x * 0.07 + y * 0.11) + (x / 11 % 2) * 20 + noise / 2;
+    }
+    return std::clamp(static_cast<int>(std::lround(value)), 0, 255);
+}
+
+struct Geometry {
+    explicit Geometry(const JpegInfo& info) {
+        for (const auto& component : info.components) {
+            max_h = std::max(max_h, component.horizontal);
+            max_v = std::max(max_v, component.vertical);
+        }
+        if (info.components.size() == 1) {
+            max_h = max_v = 1;
+        }
+        mcus_x = (info.width + 8 * max_h - 1) / (8 * max_h);
+        mcus_y = (info.height + 8 * max_v - 1) / (8 * max_v);
+    }
+
+    int max_h = 1;
+    int max_v = 1;
+    int mcus_x;
+    int mcus_y;
+};
+
+struct HuffmanCodes {
+    explicit HuffmanCodes(const HuffmanSpec& spec) {
+        int code = 0;
+        size_t index = 0;
+        for (int len = 1; len <= 16; len++) {
+            for (int i = 0; i < spec.counts[len - 1]; i++) {
+                uint8_t symbol = spec.symbols.at(index++);
+                codes_[symbol] = code++;
+                lengths_[symbol] = len;
+            }
+            code <<= 1;
+        }
+    }
+
+    uint16_t codes_[256] = {};
+    uint8_t lengths_[256] = {};
+};
+
+class BitWriter {
+public:
+    explicit BitWriter(std::vector<uint8_t>& out) : out_(out) {
+    }
+
+    void Write(uint32_t bits, int count) {
+        buffer_ = (buffer_ << count) | (bits & ((1u << count) - 1));
+        count_ += count;
+        while (count_ >= 8) {
+            count_ -= 8;
+            uint8_t byte = buffer_ >> count_;
+            out_.push_back(byte);
+            if (byte == 0xff) {
+                out_.push_back(0);
+            }
+        }
+    }
+
+    void Write(const HuffmanCodes& codes, int symbol) {
+        if (codes.lengths_[symbol] == 0) {
+            throw std::logic_error("Symbol is not in the table");
+        }
+        Write(codes.codes_[symbol], codes.lengths_[symbol]);
+    }
+
+    // Pads the last byte with ones.
+    void Flush() {
+        if (count_ > 0) {
+            Write(0x7f, 8 - count_);
+        }
+    }
+
+private:
+    std::vector<uint8_t>& out_;
+    uint64_t buffer_ = 0;
+    int count_ = 0;
+};
+
+int Category(int value) {
+    int magnitude = std::abs(value), size = 0;
+    while (magnitude) {
+        magnitude >>= 1;
+        size++;
+    }
+    return size;
+}
+
+void WriteValue(BitWriter& writer, int value, int size) {
+    writer.Write(value < 0 ? value - 1 : value, size);
+}
+
+void WriteMarker(std::vector<uint8_t>& out, int marker) {
+    out.push_back(0xff);
+    out.push_back(marker);
+}
+
+void WriteSegment(std::vector<uint8_t>& out, int marker, const std::vector<uint8_t>& payload) {
+    WriteMarker(out, marker);
+    out.push_back((payload.size() + 2) >> 8);
+    out.push_back(payload.size() + 2);
+    out.insert(out.end(), payload.begin(), payload.end());
+}
+
+// Codes the part of one block that `scan` covers, following G.1.2 for progressive scans.
+// Refinement scans send one end-of-block per block, with the correction bits that follow it.
+class ScanEncoder {
+public:
+    ScanEncoder(const ScanSpec& scan, BitWriter& writer) : scan_(scan), writer_(writer) {
+    }
+
+    void Restart() {
+        std::fill_n(last_dc_, 3, 0);
+    }
+
+    void WriteBlock(std::span<const int16_t, 64> block, int component) {
+        const HuffmanCodes& dc = dc_[component == 0 ? 0 : 1];
+        const HuffmanCodes& ac = ac_[component == 0 ? 0 : 1];
+        int al = scan_.approx_low;
+        if (scan_.spectral_start == 0) {
+            if (scan_.approx_high == 0) {
+                int value = block[0] >> al;
+                int diff = value - last_dc_[component];
+                last_dc_[component] = value;
+                int size = Category(diff);
+                writer_.Write(dc, size);
+                WriteValue(writer_, diff, size);
+            } else {
+                writer_.Write((block[0] >> al) & 1, 1);
+            }
+        }
+        int start = std::max(scan_.spectral_start, 1);
+        if (scan_.spectral_end == 0) {
+            return;
+        }
+        if (scan_.approx_high == 0) {
+            WriteAcFirst(block, ac, start);
+        } else {
+            WriteAcRefine(block, ac, start);
+        }
+    }
+
+private:
+    void WriteAcFirst(std::span<const int16_t, 64> block, const HuffmanCodes& ac, int start) {
+        int al = scan_.approx_low;
+        int run = 0;
+        for (int k = start; k <= scan_.spectral_end; k++) {
+            int coef = block[kZigZag[k]];
+            int value = coef < 0 ? -(-coef >> al) : coef >> al;
+            if (value == 0) {
+                run++;
+                continue;
+            }
+            for (; run > 15; run -= 16) {
+                writer_.Write(ac, 0xf0);
+            }
+            int size = Category(value);
+            writer_.Write(ac, run * 16 + size);
+            WriteValue(writer_, value, size);
+            run = 0;
+        }
+        if (run > 0) {
+            writer_.Write(ac, 0x00);
+        }
+    }
+
+    void WriteAcRefine(std::span<const int16_t, 64> block, const HuffmanCodes& ac, int start) {
+        int al = scan_.approx_low;
+        int magnitudes[64];
+        int end_of_new = 0;
+        for (int k = start; k <= scan_.spectral_end; k++) {
+            magnitudes[k] = std::abs(block[kZigZag[k]]) >> al;
+            if (magnitudes[k] == 1) {
+                end_of_new = k;
+            }
+        }
+        std::vector<int> corrections;
+        auto write_corrections = [&] {
+            for (int bit : corrections) {
+                writer_.Write(bit, 1);
+            }
+            corrections.clear();
+        };
+        int run = 0;
+        for (int k = start; k <= scan_.spectral_end; k++) {
+            if (magnitudes[k] == 0) {
+                run++;
+                continue;
+            }
+            // Runs of zeros are only coded up to the last newly nonzero coefficient.
+            for (; run > 15 && k <= end_of_new; run -= 16) {
+                writer_.Write(ac, 0xf0);
+                write_corrections();
+            }
+            if (magnitudes[k] > 1) {
+                corrections.push_back(magnitudes[k] & 1);
+                continue;
+            }
+            writer_.Write(ac, run * 16 + 1);
+            writer_.Write(block[kZigZag[k]] > 0 ? 1 : 0, 1);
+            write_corrections();
+            run = 0;
+        }
+        if (run > 0 || !corrections.empty()) {
+            writer_.Write(ac, 0x00);
+            write_corrections();
+        }
+    }
+
+    const ScanSpec& scan_;
+    BitWriter& writer_;
+    HuffmanCodes dc_[2] = {HuffmanCodes(StandardHuffmanSpec(0, 0)),
+                           HuffmanCodes(StandardHuffmanSpec(0, 1))};
+    HuffmanCodes ac_[2] = {HuffmanCodes(StandardHuffmanSpec(1, 0)),
+                           HuffmanCodes(StandardHuffmanSpec(1, 1))};
+    int last_dc_[3] = {};
+};
+
+std::vector<uint8_t> Write(const JpegCoefficients& image, std::span<const ScanSpec> scans,
+                           bool progressive) {
+    const JpegInfo& info = image.info;
+    int components = static_cast<int>(info.components.size());
+    std::vector<uint8_t> out;
+    WriteMarker(out, 0xd8);
+    for (size_t id = 0; id < image.quant_tables.size(); id++) {
+        std::vector<uint8_t> dqt = {static_cast<uint8_t>(id)};
+        for (int k = 0; k < 64; k++) {
+            dqt.push_back(image.quant_tables[id][kZigZag[k]]);
+        }
+        WriteSegment(out, 0xdb, dqt);
+    }
+    std::vector<uint8_t> sof = {8,
+                                static_cast<uint8_t>(info.height >> 8),
+                                static_cast<uint8_t>(info.height),
+                                static_cast<uint8_t>(info.width >> 8),
+                                static_cast<uint8_t>(info.width),
+                                static_cast<uint8_t>(components)};
+    for (const auto& component : info.components) {
+        sof.push_back(component.id);
+        sof.push_back(component.horizontal * 16 + component.vertical);
+        sof.push_back(component.quant_table);
+    }
+    WriteSegment(out, progressive ? 0xc2 : 0xc0, sof);
+    for (int id = 0; id < (components == 1 ? 1 : 2); id++) {
+        for (int table_class = 0; table_class < 2; table_class++) {
+            const HuffmanSpec& spec = StandardHuffmanSpec(table_class, id);
+            std::vector<uint8_t> dht = {static_cast<uint8_t>(table_class * 16 + id)};
+            dht.insert(dht.end(), spec.counts.begin(), spec.counts.end());
+            dht.insert(dht.end(), spec.symbols.begin(), spec.symbols.end());
+            WriteSegment(out, 0xc4, dht);
+        }
+    }
+    if (info.restart_interval > 0) {
+        WriteSegment(out, 0xdd, {static_cast<uint8_t>(info.restart_interval >> 8),
+                                 static_cast<uint8_t>(info.restart_interval)});
+    }
+    Geometry geometry(info);
+    for (const ScanSpec& scan : scans) {
+        std::vector<uint8_t> sos = {static_cast<uint8_t>(scan.components.size())};
+        for (int c : scan.components) {
+            sos.push_back(info.components[c].id);
+            sos.push_back(c == 0 ? 0x00 : 0x11);
+        }
+        sos.insert(sos.end(), {static_cast<uint8_t>(scan.spectral_start),
+                               static_cast<uint8_t>(scan.spectral_end),
+                               static_cast<uint8_t>(scan.approx_high * 16 + scan.approx_low)});
+        WriteSegment(out, 0xda, sos);
+        BitWriter writer(out);
+        ScanEncoder encoder(scan, writer);
+        int mcu = 0, restarts = 0;
+        auto next_mcu = [&] {
+            if (info.restart_interval > 0 && mcu > 0 && mcu % info.restart_interval == 0) {
+                writer.Flush();
+                WriteMarker(out, 0xd0 + restarts++ % 8);
+                encoder.Restart();
+            }
+            mcu++;
+        };
+        if (scan.components.size() == 1) {
+            // A single component is coded block by block over the blocks covering its samples.
+            int c = scan.components[0];
+            const auto& component = image.components[c];
+            int h = component.info.horizontal, v = component.info.vertical;
+            if (components == 1) {
+                h = v = 1;
+            }
+            int width = (info.width * h + geometry.max_h - 1) / geometry.max_h;
+            int height = (info.height * v + geometry.max_v - 1) / geometry.max_v;
+            for (int row = 0; row < (height + 7) / 8; row++) {
+                for (int column = 0; column < (width + 7) / 8; column++) {
+                    next_mcu();
+                    encoder.WriteBlock(component.Block(row, column), c);
+                }
+            }
+        } else {
+            for (int my = 0; my < geometry.mcus_y; my++) {
+                for (int mx = 0; mx < geometry.mcus_x; mx++) {
+                    next_mcu();
+                    for (int c : scan.components) {
+                        const auto& component = image.components[c];
+                        int h = component.info.horizontal, v = component.info.vertical;
+                        for (int by = 0; by < v; by++) {
+                            for (int bx = 0; bx < h; bx++) {
+                                encoder.WriteBlock(component.Block(my * v + by, mx * h + bx), c);
+                            }
+                        }
+                    }
+                }
+            }
+        }
+        writer.Flush();
+    }
+    WriteMarker(out, 0xd9);
+    return out;
+}
+
+}  // namespace
+
+JpegCoefficients MakeCoefficients(int width, int height, std::span<const Sampling> sampling,
+                                  int restart_interval) {
+    JpegCoefficients image;
+    JpegInfo& info = image.info;
+    info.width = width;
+    info.height = height;
+    info.precision = 8;
+    info.restart_interval = restart_interval;
+    int components = static_cast<int>(sampling.size());
+    for (int c = 0; c < components; c++) {
+        info.components.push_back(
+            {c + 1, sampling[c].horizontal, sampling[c].vertical, c == 0 ? 0 : 1});
+    }
+    image.quant_tables.resize(components == 1 ? 1 : 2);
+    for (int v = 0; v < 8; v++) {
+        for (int u = 0; u < 8; u++) {
+            image.quant_tables[0][v * 8 + u] = static_cast<uint16_t>(2 + u + v);
+            if (components > 1) {
+                image.quant_tables[1][v * 8 + u] = static_cast<uint16_t>(3 + 2 * (u + v));
+            }
+        }
+    }
+    Geometry geometry(info);
+    for (int c = 0; c < components; c++) {
+        ComponentCoefficients component;
+        component.info = info.components[c];
+        int h = components == 1 ? 1 : component.info.horizontal;
+        int v = components == 1 ? 1 : component.info.vertical;
+        component.width_in_blocks = geometry.mcus_x * h;
+        component.height_in_blocks = geometry.mcus_y * v;
+        component.coefficients.resize(component.width_in_blocks * component.height_in_blocks * 64);
+        const auto& quant = image.quant_tables[component.info.quant_table];
+        for (size_t row = 0; row < component.height_in_blocks; row++) {
+            for (size_t column = 0; column < component.width_in_blocks; column++) {
+                int samples[64];
+                for (int i = 0; i < 64; i++) {
+                    int x = std::min<int>((column * 8 + i % 8) * geometry.max_h / h, width - 1);
+                    int y = std::min<int>((row * 8 + i / 8) * geometry.max_v / v, height - 1);
+                    samples[i] = Sample(c, x, y) - 128;
+                }
+                int16_t* block = &component.coefficients[(row * component.width_in_blocks +
+                                                          column) * 64];
+                for (int k = 0; k < 64; k++) {
+                    double sum = 0;
+                    for (int i = 0; i < 64; i++) {
+                        sum += samples[i] * Basis(k / 8, i / 8) * Basis(k % 8, i % 8);
+                    }
+                    block[k] = static_cast<int16_t>(std::lround(sum / 4 / quant[k]));
+                }
+            }
+        }
+        image.components.push_back(std::move(component));
+    }
+    return image;
+}
+
+std::vector<ScanSpec> StandardProgressiveScript(int components) {
+    if (components == 1) {
+        return {{{0}, 0, 0, 0, 1},  {{0}, 1, 5, 0, 2},  {{0}, 6, 63, 0, 2},
+                {{0}, 1, 63, 2, 1}, {{0}, 0, 0, 1, 0},  {{0}, 1, 63, 1, 0}};
+    }
+    return {{{0, 1, 2}, 0, 0, 0, 1}, {{0}, 1, 5, 0, 2},  {{2}, 1, 63, 0, 1},
+            {{1}, 1, 63, 0, 1},      {{0}, 6, 63, 0, 2}, {{0}, 1, 63, 2, 1},
+            {{0, 1, 2}, 0, 0, 1, 0}, {{2}, 1, 63, 1, 0}, {{1}, 1, 63, 1, 0},
+            {{0}, 1, 63, 1, 0}};
+}
+
+std::vector<uint8_t> WriteBaseline(const JpegCoefficients& image) {
+    std::vector<int> components(image.components.size());
+    for (size_t c = 0; c < components.size(); c++) {
+        components[c] = static_cast<int>(c);
+    }
+    ScanSpec scan = {components, 0, 63, 0, 0};
+    return Write(image, {&scan, 1}, false);
+}
+
+std::vector<uint8_t> WriteProgressive(const JpegCoefficients& image,
+                                      std::span<const ScanSpec> scans) {
+    return Write(image, scans, true);
+}
+
+Image ReferenceDecode(const JpegCoefficients& image, PixelFormat format) {
+    const JpegInfo& info = image.info;
+    Geometry geometry(info);
+    struct Plane {
+        std::vector<uint8_t> samples;
+        size_t stride;
+        int h, v;
+    };
+    std::vector<Plane> planes;
+    for (const auto& component : image.components) {
+        Plane plane;
+        plane.stride = component.width_in_blocks * 8;
+        plane.samples.resize(plane.stride * component.height_in_blocks * 8);
+        plane.h = info.components.size() == 1 ? 1 : component.info.horizontal;
+        plane.v = info.components.size() == 1 ? 1 : component.info.vertical;
+        const auto& quant = image.quant_tables[component.info.quant_table];
+        for (size_t row = 0; row < component.height_in_blocks; row++) {
+            for (size_t column = 0; column < component.width_in_blocks; column++) {
+                auto block = component.Block(row, column);
+                for (int i = 0; i < 64; i++) {
+                    double sum = 0;
+                    for (int k = 0; k < 64; k++) {
+                        if (block[k]) {
+                            sum += block[k] * quant[k] * Basis(k / 8, i / 8) *
+                                   Basis(k % 8, i % 8);
+                        }
+                    }
+                    size_t y = row * 8 + i / 8, x = column * 8 + i % 8;
+                    plane.samples[y * plane.stride + x] = static_cast<uint8_t>(
+                        std::clamp(std::lround(sum / 4 + 128), 0l, 255l));
+                }
+            }
+        }
+        planes.push_back(std::move(plane));
+    }
+    auto sample = [&](int c, int x, int y) {
+        if (c >= static_cast<int>(planes.size())) {
+            return 128;
+        }
+        const Plane& plane = planes[c];
+        return int{plane.samples[size_t(y * plane.v / geometry.max_v) * plane.stride +
+                                 x * plane.h / geometry.max_h]};
+    };
+    Image out(info.width, info.height, format);
+    for (int y = 0; y < info.height; y++) {
+        for (int x = 0; x < info.width; x++) {
+            int luma = sample(0, x, y), cb = sample(1, x, y) - 128, cr = sample(2, x, y) - 128;
+            if (format == PixelFormat::YCbCrPlanar || format == PixelFormat::Gray8) {
+                out.SetPixel(y, x, {luma, cb + 128, cr + 128});
+                continue;
+            }
+            auto round = [](double value) {
+                return static_cast<int>(std::clamp(std::lround(value), 0l, 255l));
+            };
+            out.SetPixel(y, x, {round(luma + 1.402 * cr),
+                                round(luma - 0.344136 * cb - 0.714136 * cr),
+                                round(luma + 1.772 * cb)});
+        }
+    }
+    return out;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include "decoder.h"
+
+#include <span>
+#include <vector>
+
+// Test images built from their quantized coefficients, so that decodes can be checked against a
+// reference computed from the same coefficients.
+
+// Sampling factors of a component, luma first.
+struct Sampling {
+    int horizontal;
+    int vertical;
+};
+
+// Coefficients of a procedural image with gradients, edges and noise, quantized with fine
+// tables so that most blocks have coefficients in every band. Chroma uses table 1.
+JpegCoefficients MakeCoefficients(int width, int height, std::span<const Sampling> sampling,
+                                  int restart_interval = 0);
+
+// One scan of a progressive image: component indices, spectral band and successive
+// approximation bits.
+struct ScanSpec {
+    std::vector<int> components;
+    int spectral_start;
+    int spectral_end;
+    int approx_high;
+    int approx_low;
+};
+
+// The script libjpeg writes progressive images with: DC first, AC bands with two bits held back
+// for luma and one for chroma, then refinement scans down to the last bit.
+std::vector<ScanSpec> StandardProgressiveScript(int components);
+
+// Encodes with the standard Huffman tables; restart intervals come from `image.info`. Progressive
+// scans end every block with an end-of-block code rather than runs of them.
+std::vector<uint8_t> WriteBaseline(const JpegCoefficients& image);
+std::vector<uint8_t> WriteProgressive(const JpegCoefficients& image,
+                                      std::span<const ScanSpec> scans);
+
+// Decodes with double-precision inverse DCTs, replicated chroma and JFIF color conversion, each
+// step rounded to 8 bits as a decoder does. `format` is RGB24, Gray8 or YCbCrPlanar.
+Image ReferenceDecode(const JpegCoefficients& image, PixelFormat format);
@@ -0,0 +1,83 @@
+#pragma once
+
+#include "image.h"
+#include "synthetic_jpeg.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <span>
+#include <string>
+#include <vector>
+
+// Compares size, format and every plane's pixels, reporting the first differing row.
+inline ::testing::AssertionResult SameImage(const Image& actual, const Image& expected) {
+    if (actual.Width() != expected.Width() || actual.Height() != expected.Height() ||
+        actual.Format() != expected.Format()) {
+        return ::testing::AssertionFailure()
+               << "size " << actual.Width() << "x" << actual.Height() << ", expected "
+               << expected.Width() << "x" << expected.Height();
+    }
+    for (size_t plane = 0; plane < PlaneCount(actual.Format()); plane++) {
+        for (size_t y = 0; y < actual.Height(); y++) {
+            auto a = actual.Row(y, plane);
+            auto b = expected.Row(y, plane);
+            if (!std::equal(a.begin(), a.end(), b.begin())) {
+                return ::testing::AssertionFailure() << "plane " << plane << " row " << y
+                                                     << " differs";
+            }
+        }
+    }
+    return ::testing::AssertionSuccess();
+}
+
+// Inserts a marker segment with `payload` right after SOI.
+inline std::vector<uint8_t> WithSegment(std::vector<uint8_t> jpeg, int marker,
+                                        std::span<const uint8_t> payload) {
+    size_t length = payload.size() + 2;
+    std::vector<uint8_t> segment = {0xFF, static_cast<uint8_t>(marker),
+                                    static_cast<uint8_t>(length >> 8),
+                                    static_cast<uint8_t>(length)};
+    segment.insert(segment.end(), payload.begin(), payload.end());
+    jpeg.insert(jpeg.begin() + 2, segment.begin(), segment.end());
+    return jpeg;
+}
+
+inline std::string LayoutName(Subsampling layout) {
+    const char* names[] = {"Gray", "S444", "S422", "S420", "S440", "S411"};
+    return names[static_cast<int>(layout)];
+}
+
+struct PixelDifference {
+    int max = 0;
+    double mean = 0;
+};
+
+// Largest and mean absolute difference over every byte of two images of the same size and format.
+inline PixelDifference Difference(const Image& a, const Image& b) {
+    PixelDifference diff;
+    if (a.Width() != b.Width() || a.Height() != b.Height() || a.Format() != b.Format()) {
+        ADD_FAILURE() << "images differ in size or format";
+        diff.max = 256;
+        return diff;
+    }
+    double sum = 0;
+    size_t count = 0;
+    for (size_t plane = 0; plane < PlaneCount(a.Format()); plane++) {
+        for (size_t y = 0; y < a.Height(); y++) {
+            auto row_a = a.Row(y, plane);
+            auto row_b = b.Row(y, plane);
+            for (size_t i = 0; i < row_a.size(); i++) {
+                int d = std::abs(row_a[i] - row_b[i]);
+                diff.max = std::max(diff.max, d);
+                sum += d;
+            }
+            count += row_a.size();
+        }
+    }
+    diff.mean = count ? sum / count : 0;
+    return diff;
+}
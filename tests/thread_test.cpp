@@ -0,0 +1,208 @@
+#include "decoder.h"
+#include "decoder/thread_pool.h"
+#include "test_jpeg.h"
+#include "test_util.h"
+
+#include <gtest/gtest.h>
+
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+// Big-endian EXIF with the orientation tag alone.
+std::vector<uint8_t> ExifOrientation(int orientation) {
+    auto value = static_cast<uint8_t>(orientation);
+    return {'E', 'x', 'i', 'f', 0, 0, 'M', 'M', 0, 42, 0, 0, 0, 8, 0, 1,
+            0x01, 0x12, 0, 3, 0, 0, 0, 1, 0, value, 0, 0, 0, 0, 0, 0};
+}
+
+struct Layout {
+    std::string name;
+    std::vector<Sampling> sampling;
+};
+
+// Restart intervals are decoded in parallel, baseline images without them in a pipeline, and
+// progressive ones in bands.
+enum class Coding { Baseline, Restarts, Progressive, ProgressiveRestarts };
+
+struct Case {
+    Layout layout;
+    Coding coding;
+};
+
+struct Variant {
+    std::string name;
+    std::function<void(DecodeOptions&)> apply;
+};
+
+// Enough MCU rows for four threads at every layout.
+constexpr int kWidth = 75;
+constexpr int kHeight = 291;
+
+const Variant kVariants[] = {
+    {"RGB24", [](DecodeOptions&) {}},
+    {"Gray8", [](DecodeOptions& options) { options.format = PixelFormat::Gray8; }},
+    {"YCbCrPlanar", [](DecodeOptions& options) { options.format = PixelFormat::YCbCrPlanar; }},
+    {"RGBA32", [](DecodeOptions& options) { options.format = PixelFormat::RGBA32; }},
+    {"Fancy", [](DecodeOptions& options) { options.fancy_upsampling = true; }},
+    {"Scale2", [](DecodeOptions& options) { options.scale = 2; }},
+    {"Scale8", [](DecodeOptions& options) { options.scale = 8; }},
+    {"Region", [](DecodeOptions& options) { options.region = Rect{9, 40, 50, 200}; }},
+    {"Oriented", [](DecodeOptions& options) { options.apply_orientation = true; }},
+    {"OrientedScale4",
+     [](DecodeOptions& options) {
+         options.apply_orientation = true;
+         options.scale = 4;
+         options.fancy_upsampling = true;
+     }},
+};
+
+class Threads : public ::testing::TestWithParam<Case> {
+protected:
+    void SetUp() override {
+        Coding coding = GetParam().coding;
+        bool restarts = coding == Coding::Restarts || coding == Coding::ProgressiveRestarts;
+        auto image = MakeCoefficients(kWidth, kHeight, GetParam().layout.sampling,
+                                      restarts ? 3 : 0);
+        if (coding == Coding::Baseline || coding == Coding::Restarts) {
+            jpeg_ = WriteBaseline(image);
+        } else {
+            int components = static_cast<int>(image.components.size());
+            jpeg_ = WriteProgressive(image, StandardProgressiveScript(components));
+        }
+    }
+
+    // Decodes with every variant on one thread and on 3 and 4 of a pool of its own, which starts
+    // its workers whatever the core count.
+    void ExpectSameAsSerial(std::span<const uint8_t> jpeg) {
+        for (const Variant& variant : kVariants) {
+            DecodeOptions options;
+            variant.apply(options);
+            options.threads = 1;
+            auto expected = Decode(jpeg, options);
+            options.pool = &pool_;
+            for (int threads : {3, 4}) {
+                options.threads = threads;
+                EXPECT_TRUE(SameImage(Decode(jpeg, options), expected))
+                    << variant.name << " " << threads;
+            }
+        }
+    }
+
+    std::vector<uint8_t> jpeg_;
+    ThreadPool pool_{3};
+};
+
+TEST_P(Threads, MatchSerialDecode) {
+    ExpectSameAsSerial(jpeg_);
+}
+
+TEST_P(Threads, MatchSerialDecodeTurned) {
+    for (int orientation : {3, 6}) {
+        ExpectSameAsSerial(WithSegment(jpeg_, 0xe1, ExifOrientation(orientation)));
+    }
+}
+
+// Decodes share the pool from several threads at once, and from inside its own loops while its
+// workers are all busy.
+TEST_P(Threads, ShareOnePool) {
+    DecodeOptions options;
+    options.threads = 1;
+    auto expected = Decode(jpeg_, options);
+    options.threads = 4;
+    options.pool = &pool_;
+    std::vector<Image> outputs(6);
+    std::vector<std::thread> threads;
+    for (auto& output : outputs) {
+        threads.emplace_back([&] { output = Decode(jpeg_, options); });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    for (const auto& output : outputs) {
+        EXPECT_TRUE(SameImage(output, expected));
+    }
+    std::vector<Image> nested(8);
+    pool_.ParallelFor(nested.size(),
+                      [&](size_t i, size_t) { nested[i] = Decode(jpeg_, options); });
+    for (const auto& output : nested) {
+        EXPECT_TRUE(SameImage(output, expected));
+    }
+}
+
+TEST_P(Threads, BatchMatchesSerialDecode) {
+    DecodeOptions options;
+    options.threads = 1;
+    auto expected = Decode(jpeg_, options);
+    options.threads = 4;
+    options.pool = &pool_;
+    BatchDecoder batch(options);
+    std::vector<std::span<const uint8_t>> inputs(10, jpeg_);
+    std::vector<Image> outputs(inputs.size());
+    std::vector<std::exception_ptr> errors(inputs.size());
+    batch.Decode(inputs, outputs, errors);
+    for (size_t i = 0; i < inputs.size(); i++) {
+        EXPECT_FALSE(errors[i]) << i;
+        EXPECT_TRUE(SameImage(outputs[i], expected)) << i;
+    }
+}
+
+// A corrupt image fails alone, and the contexts that failed decode the next batch: a truncated
+// file, bytes without markers and no data at all, at other indices each time.
+TEST_P(Threads, BatchReportsCorruptImages) {
+    DecodeOptions options;
+    options.threads = 1;
+    auto expected = Decode(jpeg_, options);
+    options.threads = 4;
+    options.pool = &pool_;
+    BatchDecoder batch(options);
+    std::vector<uint8_t> truncated(jpeg_.begin(), jpeg_.begin() + jpeg_.size() / 2);
+    std::vector<uint8_t> garbage(jpeg_.size(), 0x5a);
+    std::vector<Image> outputs(9);
+    std::vector<std::exception_ptr> errors(outputs.size());
+    for (size_t shift = 0; shift < 3; shift++) {
+        std::vector<std::span<const uint8_t>> inputs(outputs.size(), jpeg_);
+        inputs[shift] = truncated;
+        inputs[shift + 3] = garbage;
+        inputs[shift + 6] = {};
+        batch.Decode(inputs, outputs, errors);
+        for (size_t i = 0; i < inputs.size(); i++) {
+            if (i % 3 == shift) {
+                EXPECT_TRUE(errors[i]) << shift << " " << i;
+            } else {
+                EXPECT_FALSE(errors[i]) << shift << " " << i;
+                EXPECT_TRUE(SameImage(outputs[i], expected)) << shift << " " << i;
+            }
+        }
+    }
+}
+
+const Layout kLayouts[] = {
+    {"Gray", {{1, 1}}},
+    {"S444", {{1, 1}, {1, 1}, {1, 1}}},
+    {"S422", {{2, 1}, {1, 1}, {1, 1}}},
+    {"S420", {{2, 2}, {1, 1}, {1, 1}}},
+};
+
+std::vector<Case> Cases() {
+    std::vector<Case> cases;
+    for (const Layout& layout : kLayouts) {
+        for (Coding coding : {Coding::Baseline, Coding::Restarts, Coding::Progressive,
+                              Coding::ProgressiveRestarts}) {
+            cases.push_back({layout, coding});
+        }
+    }
+    return cases;
+}
+
+std::string CaseName(const ::testing::TestParamInfo<Case>& info) {
+    const char* codings[] = {"Baseline", "Restarts", "Progressive", "ProgressiveRestarts"};
+    return info.param.layout.name + codings[static_cast<int>(info.param.coding)];
+}
+
+INSTANTIATE_TEST_SUITE_P(Layouts, Threads, ::testing::ValuesIn(Cases()), CaseName);
+
+}  // namespace